@@ -0,0 +1,320 @@
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../src/dataset.h"
+#include "../src/classifier.h"
+#include "../src/utils/feature_parser.h"
+#include "../src/utils/synthetic_corpus.h"
+#include "../src/utils/text_utils.h"
+#include "../src/utils/simple-cmd-line-helper.h"
+
+using namespace std;
+
+// A flat JSON object, printed as a single line
+class Record {
+    ostringstream fields;
+    bool empty = true;
+
+    Record &key(const string &name) {
+        fields<<(empty ? "" : ", ")<<"\""<<name<<"\": ";
+        empty = false;
+        return *this;
+    }
+
+    public:
+    Record(const string &bench) { add("bench", bench); }
+    Record &add(const string &name, const string &value) { key(name).fields<<"\""<<value<<"\""; return *this; }
+    Record &add(const string &name, double value) { key(name).fields<<value; return *this; }
+    void print() { cout<<"{"<<fields.str()<<"}"<<endl; }
+};
+
+// Runs `fn` --repeat times, and adds the min, median and mean milliseconds to `record`.
+// Returns the median in seconds.
+template<typename F>
+double measure(Record &record, F fn){
+    vector<double> times;
+    for(int i = 0; i < max(1, CMD_LINE_INTS["--repeat"]); i++){
+        auto start = chrono::steady_clock::now();
+        fn();
+        times.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    }
+    double mean = 0;
+    for(double t: times)
+        mean += t / times.size();
+    sort(times.begin(), times.end());
+    record.add("runs", times.size()).add("min_ms", times[0]).add("median_ms", times[times.size() / 2]).add("mean_ms", mean);
+    return times[times.size() / 2] / 1000;
+}
+
+vector<int> parse_list(const string &list){
+    vector<int> values;
+    stringstream ss(list);
+    string value;
+    while(getline(ss, value, ','))
+        values.push_back(stoi(value));
+    return values;
+}
+
+bool is_enabled(const string &suite){
+    return ("," + CMD_LINE_STRINGS["--suites"] + ",").find("," + suite + ",") != string::npos;
+}
+
+vector<float> random_weights(size_t dimensionality, mt19937 &rand_generator){
+    normal_distribution<float> distribution(0, 1);
+    vector<float> weights(dimensionality);
+    for(float &w: weights)
+        w = distribution(rand_generator);
+    return weights;
+}
+
+// Marks every 100th document as judged, as after a long session
+AtomicBitset judged_every_100th(size_t size){
+    AtomicBitset judged(size);
+    for(size_t i = 0; i < size; i += 100)
+        judged.set(i);
+    return judged;
+}
+
+void bench_loader(const string &path, const string &dataset_name, const Dataset *parent_dataset){
+    struct stat st;
+    stat(path.c_str(), &st);
+    for(int threads: parse_list(CMD_LINE_STRINGS["--threads"])){
+        Record record("loader");
+        record.add("dataset", dataset_name).add("bytes", st.st_size).add("threads", threads);
+        size_t size = 0;
+        double seconds = measure(record, [&](){
+            BinFeatureParser parser(path);
+            if(parent_dataset == nullptr)
+                size = Dataset::build(&parser, "", 0, threads)->size();
+            else
+                size = ParagraphDataset::build(&parser, *parent_dataset, "", 0, threads)->size();
+        });
+        record.add("docs", size).add("docs_per_sec", size / seconds).add("mb_per_sec", st.st_size / seconds / (1 << 20)).print();
+    }
+}
+
+void bench_rescore(Dataset &dataset, const string &dataset_name, mt19937 &rand_generator){
+    vector<float> weights = random_weights(dataset.get_dimensionality(), rand_generator);
+    AtomicBitset judged = judged_every_100th(dataset.get_store().num_parents() > 0 ?
+                                             dataset.get_store().num_parents() : dataset.size());
+    for(int threads: parse_list(CMD_LINE_STRINGS["--threads"])){
+        for(int k: parse_list(CMD_LINE_STRINGS["--k"])){
+            Record record("rescore");
+            record.add("dataset", dataset_name).add("docs", dataset.size()).add("threads", threads).add("k", k)
+                  .add("compressed", dataset.is_compressed()).add("feature_mb", dataset.get_store().features_size() >> 20);
+            double seconds = measure(record, [&](){
+                dataset.rescore(weights, threads, k, judged);
+            });
+            record.add("docs_per_sec", dataset.size() / seconds).print();
+        }
+    }
+}
+
+// Rescoring from a term index under the weights of a BMI session judging the planted relevant
+// documents, with the recall of the top k documents of an exhaustive rescore. Paragraphs are
+// found through the index of their documents.
+void bench_retrieved_rescore(Dataset &documents, ParagraphDataset &paragraphs, const SyntheticCorpus &corpus,
+                             mt19937 &rand_generator){
+    size_t seed_doc = 0;
+    while(seed_doc < documents.size() && !corpus.is_relevant(seed_doc))
+        seed_doc++;
+    if(seed_doc == documents.size()){
+        cerr<<"No relevant documents, see --relevant-rate"<<endl;
+        return;
+    }
+
+    Record index_record("term_index");
+    index_record.add("docs", documents.size()).add("terms", CMD_LINE_INTS["--retrieval-terms"]);
+    measure(index_record, [&](){
+        documents.build_term_index(CMD_LINE_INTS["--retrieval-terms"], 8);
+    });
+    index_record.add("postings", documents.get_term_index()->num_postings()).print();
+
+    // Judges the exact top documents of every iteration, growing the batches as BMI does
+    vector<SfSparseVector> judged_vectors;
+    judged_vectors.reserve(documents.size());
+    vector<const SfSparseVector*> positives, negatives;
+    judged_vectors.push_back(documents.get_sf_sparse_vector(seed_doc));
+    positives.push_back(&judged_vectors.back());
+    AtomicBitset judged(documents.size());
+    judged.set(seed_doc);
+    uniform_int_distribution<size_t> distribution(0, documents.size() - 1);
+    size_t batch_size = 1;
+    for(int iteration = 0; iteration < CMD_LINE_INTS["--retrieval-iterations"]; iteration++){
+        vector<SfSparseVector> random_negatives;
+        vector<const SfSparseVector*> training_negatives = negatives;
+        for(int i = 0; i < 100; i++)
+            random_negatives.push_back(documents.get_sf_sparse_vector(distribution(rand_generator)));
+        for(const SfSparseVector &spv: random_negatives)
+            training_negatives.push_back(&spv);
+        vector<float> weights = LRPegasosClassifier(200000).train(positives, training_negatives,
+                                                                  documents.get_dimensionality());
+
+        if(iteration % 5 == 4){
+            for(Dataset *dataset: {&documents, (Dataset *)&paragraphs}){
+                for(int threads: parse_list(CMD_LINE_STRINGS["--threads"])){
+                    for(int k: parse_list(CMD_LINE_STRINGS["--k"])){
+                        Record record("retrieved_rescore");
+                        record.add("dataset", dataset == &documents ? "docs" : "paras").add("docs", dataset->size())
+                              .add("threads", threads).add("k", k).add("iteration", iteration)
+                              .add("positives", positives.size()).add("candidates", CMD_LINE_INTS["--retrieval-candidates"]);
+                        vector<int> top_docs;
+                        uint64_t num_retrieved = Dataset::retrieved_rescores.get();
+                        double seconds = measure(record, [&](){
+                            top_docs = dataset->rescore_retrieved(weights, threads, k, judged, *documents.get_term_index(),
+                                                                  CMD_LINE_INTS["--retrieval-candidates"]);
+                        });
+                        num_retrieved = Dataset::retrieved_rescores.get() - num_retrieved;
+                        vector<int> expected = dataset->rescore(weights, threads, k, judged);
+                        sort(top_docs.begin(), top_docs.end());
+                        size_t num_found = 0;
+                        for(int idx: expected)
+                            num_found += binary_search(top_docs.begin(), top_docs.end(), idx);
+                        record.add("docs_per_sec", dataset->size() / seconds)
+                              .add("retrieved_share", (double)num_retrieved / max(1, CMD_LINE_INTS["--repeat"]))
+                              .add("recall", expected.empty() ? 1.0 : (double)num_found / expected.size()).print();
+                    }
+                }
+            }
+        }
+
+        vector<int> top_docs = documents.rescore(weights, 8, batch_size, judged);
+        for(auto it = top_docs.rbegin(); it != top_docs.rend(); it++){
+            judged.set(*it);
+            judged_vectors.push_back(documents.get_sf_sparse_vector(*it));
+            (corpus.is_relevant(*it) ? positives : negatives).push_back(&judged_vectors.back());
+        }
+        batch_size += (batch_size + 9) / 10;
+    }
+}
+
+void bench_train(const Dataset &dataset, mt19937 &rand_generator){
+    uniform_int_distribution<size_t> distribution(0, dataset.size() - 1);
+    for(int training_size: parse_list(CMD_LINE_STRINGS["--training-sizes"])){
+        vector<SfSparseVector> training;
+        for(int i = 0; i < training_size; i++)
+            training.push_back(dataset.get_sf_sparse_vector(distribution(rand_generator)));
+        vector<const SfSparseVector*> positives, negatives;
+        for(int i = 0; i < training_size; i++)
+            (i % 2 ? negatives : positives).push_back(&training[i]);
+
+        for(int iterations: parse_list(CMD_LINE_STRINGS["--training-iterations"])){
+            Record record("train");
+            record.add("training_size", training_size).add("iterations", iterations);
+            double seconds = measure(record, [&](){
+                LRPegasosClassifier(iterations).train(positives, negatives, dataset.get_dimensionality());
+            });
+            record.add("iterations_per_sec", iterations / seconds).print();
+        }
+    }
+}
+
+void bench_tokenizer(const SyntheticCorpus &corpus){
+    vector<string> texts;
+    size_t bytes = 0;
+    for(size_t i = 0; i < min(corpus.get_options().num_docs, (size_t)2000); i++){
+        texts.push_back(corpus.get_text(i));
+        bytes += texts.back().size();
+    }
+
+    Record record("tokenizer");
+    record.add("docs", texts.size()).add("bytes", bytes);
+    size_t tokens = 0;
+    double seconds = measure(record, [&](){
+        BMITokenizer tokenizer;
+        tokens = 0;
+        for(const string &text: texts)
+            tokens += tokenizer.tokenize(text).size();
+    });
+    record.add("tokens_per_sec", tokens / seconds).add("mb_per_sec", bytes / seconds / (1 << 20)).print();
+}
+
+int main(int argc, char **argv){
+    AddFlag("--suites", "Comma separated benchmarks to run: loader, rescore, retrieval, train, tokenizer", string("loader,rescore,retrieval,train,tokenizer"));
+    AddFlag("--docs", "Number of documents in the synthetic corpus", int(100000));
+    AddFlag("--vocabulary", "Number of distinct terms in the synthetic corpus", int(200000));
+    AddFlag("--doc-length", "Mean number of tokens per document", int(300));
+    AddFlag("--paragraphs", "Mean number of paragraphs per document", int(4));
+    AddFlag("--zipf", "Exponent of the Zipf distribution of term frequencies", float(1.0));
+    AddFlag("--relevant-rate", "Fraction of documents which are relevant to the planted topic", float(0.001));
+    AddFlag("--threads", "Comma separated thread counts for loading and rescoring", string("1,2,4,8"));
+    AddFlag("--k", "Comma separated numbers of top documents for rescoring", string("10,100,1000,10000"));
+    AddFlag("--training-sizes", "Comma separated numbers of training documents", string("100,1000,10000"));
+    AddFlag("--training-iterations", "Comma separated numbers of training iterations", string("20000,200000"));
+    AddFlag("--repeat", "Number of runs of every benchmark", int(5));
+    AddFlag("--compress-features", "Also benchmark rescoring the features compressed", bool(false));
+    AddFlag("--retrieval-candidates", "Number of documents first found from the term index for retrieved rescoring", int(2000));
+    AddFlag("--retrieval-terms", "Number of terms the term index estimates scores from", int(1000));
+    AddFlag("--retrieval-iterations", "Number of BMI iterations whose weights retrieved rescoring is measured with, every fifth", int(20));
+    AddFlag("--data-dir", "Directory for the generated feature files", string("/tmp"));
+    AddFlag("--help", "Show Help", bool(false));
+
+    ParseFlags(argc, argv);
+    if(CMD_LINE_BOOLS["--help"]){
+        ShowHelp();
+        return 0;
+    }
+
+    SyntheticCorpusOptions options;
+    options.num_docs = CMD_LINE_INTS["--docs"];
+    options.vocabulary_size = CMD_LINE_INTS["--vocabulary"];
+    options.mean_doc_length = CMD_LINE_INTS["--doc-length"];
+    options.mean_paragraphs = CMD_LINE_INTS["--paragraphs"];
+    options.zipf_exponent = CMD_LINE_FLOATS["--zipf"];
+    options.relevant_rate = CMD_LINE_FLOATS["--relevant-rate"];
+    SyntheticCorpus corpus(options);
+
+    string prefix = CMD_LINE_STRINGS["--data-dir"] + "/bmi_bench_" + to_string(getpid());
+    string doc_features = prefix + "_docs.bin", para_features = prefix + "_paras.bin";
+    cerr<<"Generating "<<options.num_docs<<" documents"<<endl;
+    corpus.write_features(doc_features, para_features);
+
+    mt19937 rand_generator(42);
+    unique_ptr<Dataset> documents;
+    unique_ptr<ParagraphDataset> paragraphs;
+    {
+        BinFeatureParser parser(doc_features);
+        documents = Dataset::build(&parser);
+    }
+    {
+        BinFeatureParser parser(para_features);
+        paragraphs = ParagraphDataset::build(&parser, *documents);
+    }
+
+    if(is_enabled("loader")){
+        cerr<<"Benchmarking loader"<<endl;
+        bench_loader(doc_features, "docs", nullptr);
+        bench_loader(para_features, "paras", documents.get());
+    }
+    if(is_enabled("rescore")){
+        cerr<<"Benchmarking rescore"<<endl;
+        bench_rescore(*documents, "docs", rand_generator);
+        bench_rescore(*paragraphs, "paras", rand_generator);
+        if(CMD_LINE_BOOLS["--compress-features"]){
+            BinFeatureParser doc_parser(doc_features), para_parser(para_features);
+            auto compressed = Dataset::build(&doc_parser, "", 0, 1, true);
+            auto compressed_paragraphs = ParagraphDataset::build(&para_parser, *compressed, "", 0, 1, true);
+            bench_rescore(*compressed, "docs", rand_generator);
+            bench_rescore(*compressed_paragraphs, "paras", rand_generator);
+        }
+    }
+    if(is_enabled("retrieval")){
+        cerr<<"Benchmarking retrieved rescore"<<endl;
+        bench_retrieved_rescore(*documents, *paragraphs, corpus, rand_generator);
+    }
+    if(is_enabled("train")){
+        cerr<<"Benchmarking training"<<endl;
+        bench_train(*documents, rand_generator);
+    }
+    if(is_enabled("tokenizer")){
+        cerr<<"Benchmarking tokenizer"<<endl;
+        bench_tokenizer(corpus);
+    }
+
+    unlink(doc_features.c_str());
+    unlink(para_features.c_str());
+}
@@ -3,11 +3,58 @@
 #include <thread>
 #include <algorithm>
 #include <climits>
+#include <sstream>
+#include <unordered_set>
 #include "bmi.h"
 #include "classifier.h"
 #include "utils/utils.h"
 
 using namespace std;
+
+metrics::Histogram &BMI::training_time = metrics::histogram("cal_training_seconds",
+        "Time to train the classifier");
+metrics::Histogram &BMI::rescoring_time = metrics::histogram("cal_rescoring_seconds",
+        "Time to rescore the collection");
+metrics::Histogram &BMI::training_queue_wait = metrics::histogram("cal_training_queue_wait_seconds",
+        "Time a training iteration waited for the previous iteration of its session");
+metrics::Histogram &BMI::get_docs_wait = metrics::histogram("cal_get_doc_to_judge_seconds",
+        "Time to get documents to judge, including waiting for the first ranking");
+metrics::Counter &BMI::judgments_recorded = metrics::counter("cal_judgments_total",
+        "Number of judgments recorded");
+metrics::Counter &BMI::retrieval_recall_hits = metrics::counter("cal_retrieval_recall_hits_total",
+        "Number of documents of exact rescores which rescores from a term index found as well");
+metrics::Counter &BMI::retrieval_recall_docs = metrics::counter("cal_retrieval_recall_documents_total",
+        "Number of documents of exact rescores compared with rescores from a term index");
+
+namespace {
+    const uint32_t STATE_VERSION = 1;
+
+    template<typename T>
+    void write_value(FILE *fp, const T &value){
+        fwrite(&value, sizeof(T), 1, fp);
+    }
+
+    template<typename T>
+    bool read_value(FILE *fp, T &value){
+        return fread(&value, sizeof(T), 1, fp) == 1;
+    }
+
+    template<typename T>
+    void write_vector(FILE *fp, const vector<T> &values){
+        write_value(fp, (uint64_t)values.size());
+        fwrite(values.data(), sizeof(T), values.size(), fp);
+    }
+
+    template<typename T>
+    bool read_vector(FILE *fp, vector<T> &values){
+        uint64_t size;
+        if(!read_value(fp, size) || size > (1ULL << 32))
+            return false;
+        values.resize(size);
+        return fread(values.data(), sizeof(T), size, fp) == size;
+    }
+}
+
 BMI::BMI(Seed _seed,
          Dataset *_documents,
          int _num_threads,
@@ -20,6 +67,7 @@ BMI::BMI(Seed _seed,
     judgments_per_iteration(_judgments_per_iteration),
     async_mode(_async_mode),
     seed(_seed),
+    judged_docs(_documents->size()),
     training_iterations(_training_iterations)
 {
     is_bmi = (judgments_per_iteration == -1);
@@ -44,9 +92,14 @@ BMI::BMI(Seed _seed,
 }
 
 void BMI::perform_iteration(){
-    lock_guard<mutex> lock(state_mutex);
+    unique_lock<mutex> lock(state_mutex, defer_lock);
+    {
+        tracing::Span span("state_lock_wait");
+        lock.lock();
+    }
+    tracing::ScopedContext iteration_context(state.cur_iteration);
     auto results = perform_training_iteration();
-    cerr<<"Fetched "<<results.size()<<" documents"<<endl;
+    logging::info("Fetched " + to_string(results.size()) + " documents");
     add_to_judgment_list(results);
     if(!async_mode){
         state.next_iteration_target = min(state.next_iteration_target + judgments_per_iteration, (uint32_t)get_dataset()->size());
@@ -56,42 +109,49 @@ void BMI::perform_iteration(){
     state.cur_iteration++;
 }
 
-void BMI::perform_iteration_async(){
+void BMI::perform_iteration_async(tracing::Context context){
+    tracing::ScopedContext scoped_context(context);
     if(async_training_mutex.try_lock()){
         while(!training_cache.empty()){
             perform_iteration();
         }
         async_training_mutex.unlock();
     }
+    pending_async_iterations--;
 }
 
 vector<float> BMI::train(){
     uniform_int_distribution<size_t> distribution(0, documents->size()-1);
+    random_negatives.clear();
     for(int i = 0;i<random_negatives_size;i++){
         size_t idx = distribution(rand_generator);
-        negatives[random_negatives_index + i] = &documents->get_sf_sparse_vector(idx);
+        random_negatives.push_back(documents->get_sf_sparse_vector(idx));
     }
+    for(int i = 0;i<random_negatives_size;i++)
+        negatives[random_negatives_index + i] = &random_negatives[i];
 
-    std::cerr<<"Training on "<<positives.size()<<" +ve docs and "<<negatives.size()<<" -ve docs"<<std::endl;
+    logging::info("Training on " + std::to_string(positives.size()) + " +ve docs and " + std::to_string(negatives.size()) + " -ve docs");
     
     return LRPegasosClassifier(training_iterations).train(positives, negatives, documents->get_dimensionality());
 }
 
-vector<string> BMI::get_doc_to_judge(uint32_t count=1){
+vector<int> BMI::get_doc_to_judge(uint32_t count=1){
+    tracing::Span span("get_doc_to_judge");
+    auto start = chrono::steady_clock::now();
     while(true){
         {
             lock_guard<mutex> lock_judgment_list(judgment_list_mutex);
-            lock_guard<mutex> lock_judgments(training_cache_mutex);
 
             if(!judgment_queue.empty()){
-                vector<string> ret;
+                vector<int> ret;
                 for(int i = judgment_queue.size()-1; i>=0 && judgment_queue[i] != -1 && ret.size() < count; i--){
                     if(!is_judged(judgment_queue[i]))
-                        ret.push_back(get_ranking_dataset()->get_sf_sparse_vector(judgment_queue[i]).doc_id);
+                        ret.push_back(judgment_queue[i]);
                     else {
                         judgment_queue.erase(judgment_queue.begin() + i);
                     }
                 }
+                get_docs_wait.observe_since(start);
                 return ret;
             }
         }
@@ -110,42 +170,81 @@ void BMI::add_to_judgment_list(const vector<int> &ids){
 void BMI::add_to_training_cache(int id, int judgment){
     lock_guard<mutex> lock(training_cache_mutex);
     training_cache[id] = judgment;
+    judged_docs.set(id);
+    judgments_recorded.add();
+}
+
+unique_lock<mutex> BMI::wait_for_training(){
+    auto start = chrono::steady_clock::now();
+    tracing::Span span("training_lock_wait");
+    unique_lock<mutex> lock(training_mutex);
+    training_queue_wait.observe_since(start);
+    return lock;
+}
+
+const SfSparseVector *BMI::get_training_vector(int id){
+    auto it = training_vectors.find(id);
+    if(it == training_vectors.end())
+        it = training_vectors.emplace(id, documents->get_sf_sparse_vector(id)).first;
+    return &it->second;
+}
+
+void BMI::set_judgment(int id, int judgment){
+    judgments[id] = judgment;
+    judged_docs.set(id);
 }
 
-void BMI::record_judgment_batch(vector<pair<string, int>> _judgments){
+void BMI::record_judgment_batch(vector<pair<int, int>> _judgments){
     for(const auto &judgment: _judgments){
-        size_t id = documents->get_index(judgment.first);
-        add_to_training_cache(id, judgment.second);
+        add_to_training_cache(judgment.first, judgment.second);
     }
 
     if(!async_mode){
         if(judgments.size() + training_cache.size() >= state.next_iteration_target)
             perform_iteration();
     }else{
-        auto t = thread(&BMI::perform_iteration_async, this);
+        pending_async_iterations++;
+        auto t = thread(&BMI::perform_iteration_async, this, tracing::get_context());
         t.detach();
     }
 }
 
-void BMI::record_judgment(string doc_id, int judgment){
-    record_judgment_batch({{doc_id, judgment}});
+void BMI::record_judgment(int id, int judgment){
+    record_judgment_batch({{id, judgment}});
+}
+
+void BMI::record_judgment_batch(const vector<pair<string, int>> &_judgments){
+    vector<pair<int, int>> judgments_by_index;
+    for(const auto &judgment: _judgments){
+        size_t id = documents->get_index(judgment.first);
+        if(id != documents->NPOS)
+            judgments_by_index.push_back({id, judgment.second});
+    }
+    record_judgment_batch(judgments_by_index);
+}
+
+void BMI::record_judgment(const string &doc_id, int judgment){
+    size_t id = documents->get_index(doc_id);
+    if(id != documents->NPOS)
+        record_judgment(id, judgment);
 }
 
 void BMI::sync_training_cache() {
+    tracing::Span span("sync_training_cache");
     lock_guard<mutex> lock(training_cache_mutex);
     for(pair<int, int> training: training_cache){
         if(judgments.find(training.first) != judgments.end()){
-            std::cerr<<"Rewriting judgment history"<<std::endl;
+            logging::info("Rewriting judgment history");
             if(judgments[training.first] > 0){
                 for(int i = (int)positives.size() - 1; i > 0; i--){
-                    if(documents->get_index(positives[i]->doc_id) == training.first){
+                    if(positives[i] == get_training_vector(training.first)){
                         positives.erase(positives.begin() + i);
                         break;
                     }
                 }
             } else {
                 for(int i = (int)negatives.size() - 1; i >= random_negatives_index + random_negatives_size; i--){
-                    if(documents->get_index(negatives[i]->doc_id) == training.first){
+                    if(negatives[i] == get_training_vector(training.first)){
                         negatives.erase(negatives.begin() + i);
                         break;
                     }
@@ -153,44 +252,215 @@ void BMI::sync_training_cache() {
             }
         }
 
-        judgments[training.first] = training.second;
+        set_judgment(training.first, training.second);
 
         if(training.second > 0)
-            positives.push_back(&documents->get_sf_sparse_vector(training.first));
+            positives.push_back(get_training_vector(training.first));
         else
-            negatives.push_back(&documents->get_sf_sparse_vector(training.first));
+            negatives.push_back(get_training_vector(training.first));
     }
     training_cache.clear();
 }
 
 vector<int> BMI::perform_training_iteration(){
-    lock_guard<mutex> lock_training(training_mutex);
+    unique_lock<mutex> lock_training = wait_for_training();
 
     sync_training_cache();
 
     // Training
     TIMER_BEGIN(training);
     auto weights = train();
-    TIMER_END(training);
+    TIMER_END_OBSERVE(training, training_time);
 
 
     // Scoring
     TIMER_BEGIN(rescoring);
-    auto results = documents->rescore(weights, num_threads,
-                              judgments_per_iteration + (async_mode ? extra_judgment_docs : 0), judgments);
-    TIMER_END(rescoring);
+    auto results = rescore(documents, weights, judgments_per_iteration + (async_mode ? extra_judgment_docs : 0));
+    TIMER_END_OBSERVE(rescoring, rescoring_time);
 
     return results;
 }
 
+vector<int> BMI::rescore(Dataset *dataset, const vector<float> &weights, int num_top_docs){
+    // Paragraphs are found through their parent documents
+    const TermIndex *index = documents->get_term_index();
+    if(retrieval_candidates > 0 && index != nullptr && state.cur_iteration % retrieval_refresh_period != 0){
+        auto results = dataset->rescore_retrieved(weights, num_threads, num_top_docs, judged_docs,
+                                                  *index, retrieval_candidates);
+        if(check_retrieval_recall){
+            auto exhaustive_results = dataset->rescore(weights, num_threads, num_top_docs, judged_docs);
+            unordered_set<int> found(results.begin(), results.end());
+            int hits = 0;
+            for(int result: exhaustive_results)
+                hits += found.count(result);
+            retrieval_recall_hits.add(hits);
+            retrieval_recall_docs.add(exhaustive_results.size());
+            logging::info("Retrieval recall: " + to_string(hits) + "/" + to_string(exhaustive_results.size()));
+        }
+        return results;
+    }
+    return dataset->rescore(weights, num_threads, num_top_docs, judged_docs);
+}
+
 std::vector<std::pair<string, float>> BMI::get_ranklist(){
     vector<std::pair<string, float>> ret_results;
     auto results = get_ranking_dataset()->rescore(train(), num_threads,
-                              get_ranking_dataset()->size(), map<int, int>());
+                              get_ranking_dataset()->size(), AtomicBitset());
 
     // to fix
     for(auto result: results){
-        ret_results.push_back({get_ranking_dataset()->get_sf_sparse_vector(result).doc_id, 0});
+        ret_results.push_back({get_ranking_dataset()->get_id(result), 0});
     }
     return ret_results;
 }
+
+void BMI::extend_datasets(Dataset *_documents, ParagraphDataset *_paragraphs){
+    // No training, rescoring or judgment may read the datasets or judged_docs meanwhile
+    lock_guard<mutex> lock_training(training_mutex);
+    lock_guard<mutex> lock_training_cache(training_cache_mutex);
+    lock_guard<mutex> lock_judgment_list(judgment_list_mutex);
+    set_datasets(_documents, _paragraphs);
+}
+
+bool BMI::move_to_corpus(const Corpus &_corpus){
+    lock_guard<mutex> lock_training(training_mutex);
+    lock_guard<mutex> lock_training_cache(training_cache_mutex);
+    lock_guard<mutex> lock_judgment_list(judgment_list_mutex);
+    if(_corpus.documents.get() != documents){
+        // Corpora of a generation only grow, an older one may be published concurrently
+        if(corpus.documents == nullptr || _corpus.generation != corpus.generation ||
+           _corpus.documents->size() < documents->size())
+            return false;
+        set_datasets(_corpus.documents.get(), _corpus.paragraphs.get());
+    }
+    corpus = _corpus;
+    return true;
+}
+
+Corpus BMI::get_corpus(){
+    lock_guard<mutex> lock(judgment_list_mutex);
+    return corpus;
+}
+
+vector<pair<string, int>> BMI::get_judgments(){
+    lock_guard<mutex> lock_training(training_mutex);
+    lock_guard<mutex> lock_training_cache(training_cache_mutex);
+    map<int, int> all_judgments = judgments;
+    for(auto &training: training_cache)
+        all_judgments[training.first] = training.second;
+    vector<pair<string, int>> judgments_by_id;
+    for(auto &judgment: all_judgments)
+        judgments_by_id.push_back({documents->get_id(judgment.first), judgment.second});
+    return judgments_by_id;
+}
+
+void BMI::set_datasets(Dataset *_documents, ParagraphDataset *_paragraphs){
+    documents = _documents;
+    judged_docs.resize(documents->size());
+    // The views are reassigned in place, as `positives` and `negatives` point to them.
+    // Random negatives are drawn again by the next training.
+    for(auto &training_vector: training_vectors)
+        training_vector.second = documents->get_sf_sparse_vector(training_vector.first);
+    random_negatives.clear();
+    score_cache.clear();
+}
+
+size_t BMI::memory_usage(){
+    size_t bytes = sizeof(*this) + judged_docs.num_words() * sizeof(uint64_t);
+    for(auto &judgment: seed)
+        bytes += sizeof(judgment) + judgment.first.NumFeatures() * sizeof(FeatureValuePair);
+    // Tree and hash nodes are counted as about four pointers each
+    bytes += (judgments.size() + training_cache.size()) * 4 * sizeof(void*);
+    bytes += training_vectors.size() * (sizeof(SfSparseVector) + 4 * sizeof(void*));
+    bytes += random_negatives.capacity() * sizeof(SfSparseVector);
+    bytes += (positives.capacity() + negatives.capacity()) * sizeof(void*);
+    bytes += judgment_queue.capacity() * sizeof(int);
+    bytes += score_cache.memory_usage();
+    return bytes;
+}
+
+void BMI::write_state(FILE *fp){
+    write_value(fp, STATE_VERSION);
+    write_value(fp, (uint64_t)documents->size());
+    write_value(fp, state.cur_iteration);
+    write_value(fp, state.next_iteration_target);
+    write_value(fp, (uint8_t)state.finished);
+    write_value(fp, (int32_t)judgments_per_iteration);
+
+    stringstream generator_state;
+    generator_state << rand_generator;
+    write_vector(fp, vector<char>(istreambuf_iterator<char>(generator_state), istreambuf_iterator<char>()));
+
+    write_vector(fp, vector<pair<int, int>>(judgments.begin(), judgments.end()));
+    write_vector(fp, vector<pair<int, int>>(training_cache.begin(), training_cache.end()));
+
+    // The seed and random negatives are rebuilt by the constructor and the
+    // next training, only the judged documents are written in training order
+    unordered_map<const SfSparseVector*, int> training_ids;
+    for(auto &training_vector: training_vectors)
+        training_ids[&training_vector.second] = training_vector.first;
+    for(auto *training_set: {&positives, &negatives}){
+        vector<int> ids;
+        for(const SfSparseVector *spv: *training_set){
+            auto it = training_ids.find(spv);
+            if(it != training_ids.end())
+                ids.push_back(it->second);
+        }
+        write_vector(fp, ids);
+    }
+
+    write_vector(fp, judgment_queue);
+}
+
+bool BMI::read_state(FILE *fp){
+    uint32_t version;
+    uint64_t num_documents;
+    uint8_t finished;
+    int32_t _judgments_per_iteration;
+    if(!read_value(fp, version) || version != STATE_VERSION)
+        return false;
+    // Documents may have been appended since the state was written, but none removed
+    if(!read_value(fp, num_documents) || num_documents > documents->size())
+        return false;
+    if(!read_value(fp, state.cur_iteration) || !read_value(fp, state.next_iteration_target) ||
+       !read_value(fp, finished) || !read_value(fp, _judgments_per_iteration))
+        return false;
+    state.finished = finished;
+    judgments_per_iteration = _judgments_per_iteration;
+
+    vector<char> generator_state;
+    if(!read_vector(fp, generator_state))
+        return false;
+    stringstream(string(generator_state.begin(), generator_state.end())) >> rand_generator;
+
+    vector<pair<int, int>> judgment_list, training_list;
+    vector<int> positive_ids, negative_ids;
+    if(!read_vector(fp, judgment_list) || !read_vector(fp, training_list) ||
+       !read_vector(fp, positive_ids) || !read_vector(fp, negative_ids) || !read_vector(fp, judgment_queue))
+        return false;
+
+    auto is_valid = [this](int id) -> bool { return id >= 0 && (size_t)id < documents->size(); };
+    for(auto *list: {&judgment_list, &training_list})
+        for(auto &judgment: *list)
+            if(!is_valid(judgment.first))
+                return false;
+    for(int id: positive_ids)
+        if(!is_valid(id)) return false;
+    for(int id: negative_ids)
+        if(!is_valid(id)) return false;
+    for(int id: judgment_queue)
+        if(id != -1 && (id < 0 || (size_t)id >= get_ranking_dataset()->size()))
+            return false;
+
+    for(auto &judgment: judgment_list)
+        set_judgment(judgment.first, judgment.second);
+    for(auto &training: training_list){
+        training_cache[training.first] = training.second;
+        judged_docs.set(training.first);
+    }
+    for(int id: positive_ids)
+        positives.push_back(get_training_vector(id));
+    for(int id: negative_ids)
+        negatives.push_back(get_training_vector(id));
+    return true;
+}
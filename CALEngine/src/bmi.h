@@ -3,9 +3,13 @@
 
 #include <random>
 #include <mutex>
+#include <atomic>
+#include <cstdio>
 #include <set>
 #include <map>
 #include "dataset.h"
+#include "utils/metrics.h"
+#include "utils/tracing.h"
 
 typedef std::vector<std::pair<SfSparseVector, int>> Seed;
 class BMI{
@@ -13,6 +17,10 @@ class BMI{
 
     Dataset *documents;
 
+    // The corpus `documents` belongs to, held so it stays loaded while the
+    // session uses it. Empty when the session was only given its datasets
+    Corpus corpus;
+
     // Number of threads used for rescoring docs
     int num_threads;
 
@@ -26,6 +34,20 @@ class BMI{
     // Async Mode
     bool async_mode;
 
+    // Scores of the last full rescore, from which online learning iterations rescore only
+    // the documents which may have moved into the top ones since. Retrained weights move
+    // too far between iterations for the scores to bound anything, so BMI does not use it.
+    ScoreCache score_cache;
+
+    // If non-zero and the documents have a term index, datasets are rescored from the
+    // `retrieval_candidates` documents it estimates highest, but on every
+    // `retrieval_refresh_period`-th iteration
+    size_t retrieval_candidates = 0;
+    uint32_t retrieval_refresh_period = 1;
+
+    // If true, rescores from the term index also rescore exactly to log their recall
+    bool check_retrieval_recall = false;
+
     // If true, the judgments_per_iteration grows with every iteration
     bool is_bmi;
 
@@ -49,11 +71,22 @@ class BMI{
     int random_negatives_index;
     int random_negatives_size = 100;
 
+    // Feature views which `positives` and `negatives` point to
+    std::unordered_map<int, SfSparseVector> training_vectors;
+    std::vector<SfSparseVector> random_negatives;
+
     // Whenever judgements are received, they are put into training_cache,
     // to prevent any race condition in case training_data is being used by the
     // classifier
     std::unordered_map<int, int> training_cache;
 
+    // Documents present in either `judgments` or `training_cache`. Safe to
+    // read from the scoring threads without any locking
+    AtomicBitset judged_docs;
+
+    // Number of async iterations started and not yet finished
+    std::atomic<int> pending_async_iterations{0};
+
     // Mutexes to control access to certain objects
     std::mutex judgment_list_mutex;
     std::mutex training_mutex;
@@ -61,6 +94,18 @@ class BMI{
     std::mutex training_cache_mutex;
     std::mutex state_mutex;
 
+    // Shared by all sessions
+    static metrics::Histogram &training_time;
+    static metrics::Histogram &rescoring_time;
+    static metrics::Histogram &training_queue_wait;
+    static metrics::Histogram &get_docs_wait;
+    static metrics::Counter &judgments_recorded;
+    static metrics::Counter &retrieval_recall_hits;
+    static metrics::Counter &retrieval_recall_docs;
+
+    // Locks training_mutex, recording how long the iteration waited for the previous one
+    std::unique_lock<std::mutex> wait_for_training();
+
     // Tasks to perform in order to finish the session
     void finish_session();
     bool try_finish_session();
@@ -74,9 +119,23 @@ class BMI{
     // Add to training_cache
     void add_to_training_cache(int id, int judgment);
 
+    // Returns a view of the document `id` which stays valid for the whole session
+    const SfSparseVector *get_training_vector(int id);
+
+    // Record `judgment` in the judgment history, use this instead of writing to `judgments`
+    void set_judgment(int id, int judgment);
+
+    // Top `num_top_docs` of `dataset` under `weights`, from the term index of the documents on
+    // most iterations if set_retrieval() was called
+    std::vector<int> rescore(Dataset *dataset, const std::vector<float> &weights, int num_top_docs);
+
+    // Points the session to `documents` and `paragraphs`, with every lock held by extend_datasets()
+    virtual void set_datasets(Dataset *documents, ParagraphDataset *paragraphs);
+
     // Handler for performing an iteration
     void perform_iteration();
-    void perform_iteration_async();
+    // Runs on its own thread, tracing spans under the `context` of the thread which started it
+    void perform_iteration_async(tracing::Context context);
     void sync_training_cache();
 
     public:
@@ -91,19 +150,32 @@ class BMI{
     // Handler for performing a training iteration
     virtual std::vector<int> perform_training_iteration();
 
-    // Check if a given document is judged, lock training_cache_mutex before using this (not done here for efficiency purpose)
+    // Rescores with Dataset::rescore_retrieved() from `num_candidates` documents when the documents
+    // have a term index. Every `refresh_period`-th iteration rescores exactly instead. With
+    // `check_recall`, every rescore from the index is compared with an exact one and its recall logged.
+    void set_retrieval(size_t num_candidates, uint32_t refresh_period, bool check_recall = false) {
+        retrieval_candidates = num_candidates;
+        retrieval_refresh_period = refresh_period;
+        check_retrieval_recall = check_recall;
+    }
+
+    // Check if a given document is judged
     virtual bool is_judged(int id) {
-        return judgments.find(id) != judgments.end() || training_cache.find(id) != training_cache.end();
+        return judged_docs.test(id);
     }
 
-    // Get upto `count` number of documents from `judgment_list`
-    virtual std::vector<std::string> get_doc_to_judge(uint32_t count);
+    // Get upto `count` number of documents from `judgment_list`, as indices into get_ranking_dataset()
+    virtual std::vector<int> get_doc_to_judge(uint32_t count);
 
-    // Record judgment (-1 or 1) for a given doc_id
-    virtual void record_judgment(std::string doc_id, int judgment);
+    // Record judgment (-1 or 1) for a given document index
+    virtual void record_judgment(int id, int judgment);
 
-    // Record batch judgments
-    virtual void record_judgment_batch(std::vector<std::pair<std::string, int>> judgments);
+    // Record batch judgments of document indices
+    virtual void record_judgment_batch(std::vector<std::pair<int, int>> judgments);
+
+    // Same as above for doc_ids, to be used at the API boundary. Unknown doc_ids are ignored
+    void record_judgment(const std::string &doc_id, int judgment);
+    void record_judgment_batch(const std::vector<std::pair<std::string, int>> &judgments);
 
     // Get ranklist for current classifier state
     virtual vector<std::pair<string, float>> get_ranklist();
@@ -114,6 +186,33 @@ class BMI{
     struct State get_state(){
         return state;
     }
+
+    // Moves the session onto datasets which extend its current ones with more documents
+    // and paragraphs, appended after the existing ones. The current datasets must stay
+    // valid until the call returns.
+    virtual void extend_datasets(Dataset *documents, ParagraphDataset *paragraphs);
+
+    // Holds `corpus` if it holds the session's datasets, or moves the session onto it as
+    // extend_datasets() does if it is a later corpus of the same generation as the one the
+    // session holds. Returns false if neither is the case.
+    bool move_to_corpus(const Corpus &corpus);
+
+    Corpus get_corpus();
+
+    // Judgments recorded so far, including those not trained on yet, by doc id
+    std::vector<std::pair<std::string, int>> get_judgments();
+
+    // True if no async iteration is running, the state can then be written out
+    bool is_idle() { return pending_async_iterations.load() == 0; }
+
+    // Approximate number of bytes held by the session
+    virtual size_t memory_usage();
+
+    // Write the judgments, training order, judgment queue and state of an idle
+    // session to `fp`, to be restored into a session constructed with the same
+    // seed and dataset but without initializing
+    virtual void write_state(FILE *fp);
+    virtual bool read_state(FILE *fp);
 };
 
 #endif // BMI_H
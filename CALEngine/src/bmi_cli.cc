@@ -88,7 +88,8 @@ map<string, Seed> generate_seed_queries(string fname, const Dataset &dataset){
 }
 
 void begin_bmi_helper(const pair<string, Seed> &seed_query, const unique_ptr<Dataset> &documents, const unique_ptr<ParagraphDataset> &paragraphs){
-    cerr<<"Topic "<<seed_query.first<<endl;
+    logging::info("Topic " + seed_query.first);
+    tracing::ScopedContext topic_context(seed_query.first);
     unique_ptr<BMI> bmi;
     const string &mode = CMD_LINE_STRINGS["--mode"];
     if(mode == "BMI_DOC"){
@@ -105,7 +106,9 @@ void begin_bmi_helper(const pair<string, Seed> &seed_query, const unique_ptr<Dat
             CMD_LINE_INTS["--threads"],
             CMD_LINE_INTS["--judgments-per-iteration"],
             CMD_LINE_INTS["--async-mode"],
-            CMD_LINE_INTS["--training-iterations"]);
+            CMD_LINE_INTS["--training-iterations"],
+            CMD_LINE_INTS["--para-candidate-depth"],
+            CMD_LINE_BOOLS["--para-candidate-recall"]);
     } else if(mode == "BMI_PARTIAL_RANKING"){
         bmi = make_unique<BMI_reduced_ranking>(seed_query.second,
             documents.get(),
@@ -152,13 +155,16 @@ void begin_bmi_helper(const pair<string, Seed> &seed_query, const unique_ptr<Dat
         cerr<<"Invalid bmi_type"<<endl;
         return;
     }
+    if(CMD_LINE_INTS["--retrieval-candidates"] > 0)
+        bmi->set_retrieval(CMD_LINE_INTS["--retrieval-candidates"], CMD_LINE_INTS["--retrieval-refresh-period"],
+                           CMD_LINE_BOOLS["--retrieval-recall"]);
 
     auto get_judgment = get_judgment_stdin;
     if(CMD_LINE_STRINGS["--qrel"] != ""){
         get_judgment = get_judgment_qrel;
     }
 
-    vector<string> doc_ids;
+    vector<int> doc_handles;
     int max_effort = CMD_LINE_INTS["--max-effort"];
     int max_iterations = CMD_LINE_INTS["--num-iterations"];
 
@@ -174,10 +180,11 @@ void begin_bmi_helper(const pair<string, Seed> &seed_query, const unique_ptr<Dat
 
     int effort = 0;
     ofstream logfile(CMD_LINE_STRINGS["--judgment-logpath"] + "/" + seed_query.first);
-    while(!(doc_ids = bmi->get_doc_to_judge(1)).empty()){
-        int judgment = get_judgment(seed_query.first, doc_ids[0]);
-        bmi->record_judgment(doc_ids[0], judgment);
-        logfile << doc_ids[0] <<" "<< (judgment == -1?0:judgment)<<endl;
+    while(!(doc_handles = bmi->get_doc_to_judge(1)).empty()){
+        string doc_id = bmi->get_ranking_dataset()->get_id(doc_handles[0]);
+        int judgment = get_judgment(seed_query.first, doc_id);
+        bmi->record_judgment(bmi->get_ranking_dataset()->translate_index(doc_handles[0]), judgment);
+        logfile << doc_id <<" "<< (judgment == -1?0:judgment)<<endl;
         effort++;
         if(effort >= max_effort || bmi->get_state().cur_iteration >= max_iterations)
             break;
@@ -212,6 +219,25 @@ void SanityCheck(){
         exit(1);
     }
 
+    if(CMD_LINE_INTS["--retrieval-candidates"] < 0){
+        cerr<<"non-negative --retrieval-candidates required"<<endl;
+        exit(1);
+    }
+    if(CMD_LINE_INTS["--retrieval-candidates"] > 0){
+        if(CMD_LINE_INTS["--retrieval-terms"] <= 0){
+            cerr<<"positive --retrieval-terms required"<<endl;
+            exit(1);
+        }
+        if(CMD_LINE_INTS["--retrieval-refresh-period"] <= 0){
+            cerr<<"positive --retrieval-refresh-period required"<<endl;
+            exit(1);
+        }
+        if(CMD_LINE_BOOLS["--stream-features"]){
+            cerr<<"--retrieval-candidates would index the streamed features in memory"<<endl;
+            exit(1);
+        }
+    }
+
     if(mode == "BMI_FORGET"){
         if(CMD_LINE_INTS["--forget-remember-count"] < 0){
             cerr<<"non-negative --forget-remember-count required"<<endl;
@@ -222,6 +248,10 @@ void SanityCheck(){
             cerr<<"--para-features required"<<endl;
             exit(1);
         }
+        if(CMD_LINE_INTS["--para-candidate-depth"] < 0){
+            cerr<<"non-negative --para-candidate-depth required"<<endl;
+            exit(1);
+        }
     } else if (mode == "BMI_PRECISION_DELAY") {
         if(CMD_LINE_INTS["--precision-delay-window"] < 1){
             cerr<<"positive --precision-delay-window required"<<endl;
@@ -252,6 +282,13 @@ void SanityCheck(){
         }
     }
 
+    logging::Level log_level;
+    if(!logging::parse_level(CMD_LINE_STRINGS["--log-level"], log_level)){
+        cerr<<"Invalid --log-level "<<CMD_LINE_STRINGS["--log-level"]<<endl;
+        exit(1);
+    }
+    logging::set_level(log_level);
+    tracing::set_enabled(CMD_LINE_STRINGS["--trace-path"].size() > 0);
 }
 
 string get_help_mode_string(){
@@ -265,8 +302,8 @@ string get_help_mode_string(){
 int main(int argc, char **argv){
     TIMER_BEGIN(BMI_CLI);
     AddFlag("--mode", get_help_mode_string().c_str(), string("BMI_DOC"));
-    AddFlag("--doc-features", "Path of the file with list of document features", string(""));
-    AddFlag("--para-features", "Path of the file with list of paragraph features (BMI_PARA)", string(""));
+    AddFlag("--doc-features", "Path of the file with list of document features, or their container", string(""));
+    AddFlag("--para-features", "Path of the file with list of paragraph features, or their container (BMI_PARA)", string(""));
     AddFlag("--query", string("Path of the file with queries (one seed per line; each line is <topic_id> <rel> <string>; can have multiple seeds per topic)"), string(""));
     AddFlag("--judgments-per-iteration", "Number of docs to judge per iteration (-1 for BMI default)", int(-1));
     AddFlag("--num-iterations", "Set max number of refresh iterations", int(-1));
@@ -282,12 +319,27 @@ int main(int argc, char **argv){
     AddFlag("--recency-weighting-param", "Set parameter for recency weighting (BMI_RECENCY_WEIGHTING)", float(-1));
     AddFlag("--forget-remember-count", "Number of documents to remember (BMI_FORGET)", int(-1));
     AddFlag("--forget-refresh-period", "Period for full training (BMI_FORGET)", int(-1));
+    AddFlag("--para-candidate-depth", "Score only the paragraphs of these many top documents, 0 to score all paragraphs (BMI_PARA)", int(0));
+    AddFlag("--para-candidate-recall", "Log the recall of --para-candidate-depth against scoring all paragraphs (BMI_PARA)", bool(false));
+    AddFlag("--retrieval-candidates", "Index the document features and rescore exactly only the documents estimated highest from the index, at least these many, 0 to rescore every document (BMI_DOC, BMI_PARA)", int(0));
+    AddFlag("--retrieval-terms", "Number of terms the index estimates scores from with --retrieval-candidates", int(1000));
+    AddFlag("--retrieval-refresh-period", "Rescore every document every these many iterations with --retrieval-candidates", int(10));
+    AddFlag("--retrieval-recall", "Log the recall of --retrieval-candidates against rescoring every document", bool(false));
     AddFlag("--qrel", "Qrel file to use for judgment", string(""));
-    AddFlag("--threads", "Number of threads to use for scoring", int(8));
+    AddFlag("--compress-features", "Hold the features built from feature files compressed in memory, with their values quantized to 16 bits. Containers keep the encoding they were packed with", bool(false));
+    AddFlag("--stream-features", "Stream the document features from their container while rescoring instead of loading them into memory", bool(false));
+    AddFlag("--stream-block-size", "Megabytes of document features read at once with --stream-features", int(64));
+    AddFlag("--threads", "Number of threads to use for loading features and scoring", int(8));
     AddFlag("--jobs", "Number of concurrent jobs (topics)", int(1));
     AddFlag("--async-mode", "Enable greedy async mode for classifier and rescorer, overrides --judgment-per-iteration and --num-iterations", bool(false));
     AddFlag("--judgment-logpath", "Path to log judgments. Specify a directory within which topic-specific logs will be generated.", string("./judgments.list"));
+    AddFlag("--numa", "Partition the features across NUMA nodes and score each partition on its own node", bool(false));
+    AddFlag("--hugepages", "Use explicit 2MB pages from the hugetlb pool for features not in a segment", bool(false));
+    AddFlag("--doc-segment", "Name of the shared memory segment (/name) or hugepage file holding the document features, built on first use", string(""));
+    AddFlag("--para-segment", "Name of the shared memory segment (/name) or hugepage file holding the paragraph features, built on first use", string(""));
     AddFlag("--df", "Path of the file with list of terms and their document frequencies. The file contains space-separated word and df on every line. Specify only when df information is not encoded in the document features file.", string(""));
+    AddFlag("--log-level", "Least severe messages to log: debug, info, warning or error", string("info"));
+    AddFlag("--trace-path", "Path to write a Chrome trace of the time spent in every stage", string(""));
     AddFlag("--help", "Show Help", bool(false));
 
     ParseFlags(argc, argv);
@@ -302,16 +354,32 @@ int main(int argc, char **argv){
     unique_ptr<Dataset> documents = nullptr;
     unique_ptr<ParagraphDataset> paragraphs = nullptr;
 
+    MemoryRegion::use_explicit_huge_pages(CMD_LINE_BOOLS["--hugepages"]);
     TIMER_BEGIN(documents_loader);
-    cerr<<"Loading document features on memory"<<endl;
+    logging::info("Loading document features on memory");
     {
-        unique_ptr<FeatureParser> feature_parser;
+        vector<string> source_files = {CMD_LINE_STRINGS["--doc-features"]};
         if(CMD_LINE_STRINGS["--df"].size() > 0)
-            feature_parser = make_unique<BinFeatureParser>(CMD_LINE_STRINGS["--doc-features"], CMD_LINE_STRINGS["--df"]);
-        else
-            feature_parser = make_unique<BinFeatureParser>(CMD_LINE_STRINGS["--doc-features"]);
-        documents = Dataset::build(feature_parser.get());
-        cerr<<"Read "<<documents->size()<<" docs"<<endl;
+            source_files.push_back(CMD_LINE_STRINGS["--df"]);
+        if(CMD_LINE_BOOLS["--stream-features"]){
+            if(!FeatureStore::is_container(CMD_LINE_STRINGS["--doc-features"]))
+                fail("--stream-features requires --doc-features to be a container, see feature_packer", -1);
+            documents = StreamedDataset::open(CMD_LINE_STRINGS["--doc-features"],
+                                              (size_t)CMD_LINE_INTS["--stream-block-size"] << 20);
+        }else{
+            documents = Dataset::attach_or_build(CMD_LINE_STRINGS["--doc-segment"], source_files, []() -> unique_ptr<FeatureParser> {
+                if(CMD_LINE_STRINGS["--df"].size() > 0)
+                    return make_unique<BinFeatureParser>(CMD_LINE_STRINGS["--doc-features"], CMD_LINE_STRINGS["--df"]);
+                return make_unique<BinFeatureParser>(CMD_LINE_STRINGS["--doc-features"]);
+            }, CMD_LINE_INTS["--threads"], CMD_LINE_BOOLS["--compress-features"]);
+        }
+        if(documents == nullptr)
+            fail("Failed to load document features " + CMD_LINE_STRINGS["--doc-features"], -1);
+        logging::info("Read " + to_string(documents->size()) + " docs");
+        if(CMD_LINE_BOOLS["--numa"] && !CMD_LINE_BOOLS["--stream-features"])
+            documents->place_on_nodes();
+        if(CMD_LINE_INTS["--retrieval-candidates"] > 0)
+            documents->build_term_index(CMD_LINE_INTS["--retrieval-terms"], CMD_LINE_INTS["--threads"]);
     }
     TIMER_END(documents_loader);
 
@@ -319,15 +387,19 @@ int main(int argc, char **argv){
     string para_features_path = CMD_LINE_STRINGS["--para-features"];
     if(para_features_path.length() > 0){
         TIMER_BEGIN(paragraph_loader);
-        cerr<<"Loading paragraph features on memory"<<endl;
+        logging::info("Loading paragraph features on memory");
         {
-            unique_ptr<FeatureParser> feature_parser;
-            if(CMD_LINE_STRINGS["--df"].size() > 0)
-                feature_parser = make_unique<BinFeatureParser>(para_features_path, "");
-            else
-                feature_parser = make_unique<BinFeatureParser>(para_features_path);
-            paragraphs = ParagraphDataset::build(feature_parser.get(), *documents);
-            cerr<<"Read "<<paragraphs->size()<<" paragraphs"<<endl;
+            paragraphs = ParagraphDataset::attach_or_build(CMD_LINE_STRINGS["--para-segment"], {para_features_path},
+                [&para_features_path]() -> unique_ptr<FeatureParser> {
+                    if(CMD_LINE_STRINGS["--df"].size() > 0)
+                        return make_unique<BinFeatureParser>(para_features_path, "");
+                    return make_unique<BinFeatureParser>(para_features_path);
+                }, *documents, CMD_LINE_INTS["--threads"], CMD_LINE_BOOLS["--compress-features"]);
+            if(paragraphs == nullptr)
+                fail("Failed to load paragraph features " + para_features_path, -1);
+            logging::info("Read " + to_string(paragraphs->size()) + " paragraphs");
+            if(CMD_LINE_BOOLS["--numa"])
+                paragraphs->place_on_nodes();
         }
         TIMER_END(paragraph_loader);
     }
@@ -351,4 +423,12 @@ int main(int argc, char **argv){
         t.join();
 
     TIMER_END(BMI_CLI);
+
+    if(tracing::enabled()){
+        long num_spans = tracing::write_chrome_trace(CMD_LINE_STRINGS["--trace-path"]);
+        if(num_spans < 0)
+            logging::error("Failed to write the trace to " + CMD_LINE_STRINGS["--trace-path"]);
+        else
+            logging::info("Wrote " + to_string(num_spans) + " spans to " + CMD_LINE_STRINGS["--trace-path"]);
+    }
 }
@@ -1,17 +1,44 @@
+#include <atomic>
 #include <fstream>
+#include <map>
 #include <thread>
+#include <unistd.h>
 #include <fcgio.h>
 #include "utils/simple-cmd-line-helper.h"
 #include "bmi_para.h"
 #include "bmi_para_scal.h"
+#include "session_manager.h"
+#include "corpus_updater.h"
 #include "features.h"
 #include "utils/feature_parser.h"
 #include "utils/utils.h"
+#include "utils/metrics.h"
+#include "utils/tracing.h"
 
 using namespace std;
-unordered_map<string, unique_ptr<BMI>> SESSIONS;
-unique_ptr<Dataset> documents = nullptr;
-unique_ptr<ParagraphDataset> paragraphs = nullptr;
+unique_ptr<SessionManager> SESSIONS;
+unique_ptr<CorpusUpdater> CORPUS;
+// Set while a reload started by /reload is running
+atomic<bool> RELOADING{false};
+
+metrics::Counter &sessions_started = metrics::counter("cal_sessions_started_total", "Number of sessions begun");
+metrics::Counter &corpus_reloads = metrics::counter("cal_corpus_reloads_total", "Number of corpora reloaded");
+metrics::Counter &sessions_migrated = metrics::counter("cal_sessions_migrated_total",
+        "Number of sessions rebuilt on a reloaded corpus");
+
+// Latency histogram of the route `action`, unknown actions share one histogram
+metrics::Histogram &get_route_latency(const string &action){
+    static const unordered_map<string, metrics::Histogram*> latencies = [](){
+        unordered_map<string, metrics::Histogram*> latencies;
+        for(string route: {"begin", "get_docs", "judge", "get_ranklist", "delete_session", "add_document", "merge",
+                           "reload", "corpus", "metrics", "trace", "other"})
+            latencies[route] = &metrics::histogram("cal_http_request_seconds", "Time to handle a request",
+                                                   "route=\"" + route + "\"");
+        return latencies;
+    }();
+    auto it = latencies.find(action);
+    return *(it != latencies.end() ? it : latencies.find("other"))->second;
+}
 
 // Get the uri without following and preceding slashes
 string parse_action_from_uri(string uri){
@@ -73,16 +100,16 @@ string read_content(const FCGX_Request & request){
 }
 
 // Given info write to the request's response
-void write_response(const FCGX_Request & request, int status, string content_type, string content){
+void write_response(const FCGX_Request & request, int status, string content_type, string content, bool log_content = true){
     fcgi_streambuf cout_fcgi_streambuf(request.out);
     ostream response_stream(&cout_fcgi_streambuf);
     response_stream << "Status: " << to_string(status) << "\r\n"
                     << "Content-type: " << content_type << "\r\n"
                     << "\r\n"
                     << content << "\n";
-    /* if(content.length() > 50) */
-    /*     content = content.substr(0, 50) + "..."; */
-    cerr<<"Wrote response: "<<content<<endl;
+    logging::info("Wrote response: status=" + to_string(status) + " bytes=" + to_string(content.size()));
+    if(log_content && logging::enabled(logging::DEBUG))
+        logging::debug("Response body: " + content.substr(0, logging::MAX_MESSAGE_LENGTH));
 }
 
 bool parse_seed_judgments(const string &str, vector<pair<string, int>> &seed_judgments){
@@ -109,6 +136,81 @@ bool parse_seed_judgments(const string &str, vector<pair<string, int>> &seed_jud
     return true;
 }
 
+// Builds a session on `corpus`, which it holds, for the parameters of /begin,
+// performing its first iteration if `initialize` is set. Returns nullptr for an invalid mode
+unique_ptr<BMI> create_session(const Corpus &corpus, const string &mode, const string &query,
+                               int judgments_per_iteration, bool async_mode, bool initialize){
+    Dataset *documents = corpus.documents.get();
+    ParagraphDataset *paragraphs = corpus.paragraphs.get();
+    Seed seed_query = {{features::get_features(query, *documents), 1}};
+
+    unique_ptr<BMI> bmi;
+    if(mode == "doc"){
+        bmi = make_unique<BMI>(
+                seed_query,
+                documents,
+                CMD_LINE_INTS["--threads"],
+                judgments_per_iteration,
+                async_mode,
+                200000,
+                initialize);
+    }else if(mode == "para"){
+        bmi = make_unique<BMI_para>(
+                seed_query,
+                documents,
+                paragraphs,
+                CMD_LINE_INTS["--threads"],
+                judgments_per_iteration,
+                async_mode,
+                200000,
+                CMD_LINE_INTS["--para-candidate-depth"],
+                false,
+                initialize);
+    }else if(mode == "para_scal"){
+        bmi = make_unique<BMI_para_scal>(
+                seed_query,
+                documents,
+                paragraphs,
+                CMD_LINE_INTS["--threads"],
+                200000, 5,
+                CMD_LINE_INTS["--para-candidate-depth"],
+                initialize);
+    }
+    if(bmi != nullptr){
+        bmi->move_to_corpus(corpus);
+        if(CMD_LINE_INTS["--retrieval-candidates"] > 0)
+            bmi->set_retrieval(CMD_LINE_INTS["--retrieval-candidates"], CMD_LINE_INTS["--retrieval-refresh-period"],
+                               CMD_LINE_BOOLS["--retrieval-recall"]);
+    }
+    return bmi;
+}
+
+// Builds a session on `corpus` from the parameters it was begun with
+unique_ptr<BMI> create_session_from_params(const string &params, const Corpus &corpus, bool initialize){
+    string mode, query;
+    int judgments_per_iteration = -1;
+    bool async_mode = false;
+    for(auto kv: parse_query_string(params)){
+        if(kv.first == "mode")
+            mode = kv.second;
+        else if(kv.first == "seed_query")
+            query = kv.second;
+        else if(kv.first == "judgments_per_iteration")
+            judgments_per_iteration = atoi(kv.second.c_str());
+        else if(kv.first == "async")
+            async_mode = kv.second == "true";
+    }
+    return create_session(corpus, mode, query, judgments_per_iteration, async_mode, initialize);
+}
+
+// Rebuilds a spilled session on the current corpus, unless it held a corpus of an earlier
+// generation, which it is rebuilt on. Sessions spilled by an earlier process held none.
+unique_ptr<BMI> restore_session(const string &params, const Corpus &corpus){
+    Corpus current = CORPUS->get_corpus();
+    bool reloaded = corpus.documents != nullptr && corpus.generation != current.generation;
+    return create_session_from_params(params, reloaded ? corpus : current, false);
+}
+
 // Handler for API endpoint /begin
 void begin_session_view(const FCGX_Request & request, const vector<pair<string, string>> &params){
     string session_id, query, mode = "doc";
@@ -144,7 +246,7 @@ void begin_session_view(const FCGX_Request & request, const vector<pair<string,
         }
     }
 
-    if(SESSIONS.find(session_id) != SESSIONS.end()){
+    if(SESSIONS->contains(session_id)){
         write_response(request, 400, "application/json", "{\"error\": \"session already exists\"}");
         return;
     }
@@ -154,57 +256,43 @@ void begin_session_view(const FCGX_Request & request, const vector<pair<string,
         return;
     }
 
-    Seed seed_query = {{features::get_features(query, *documents.get()), 1}};
-
-    if(mode == "doc"){
-        SESSIONS[session_id] = make_unique<BMI>(
-                seed_query,
-                documents.get(),
-                CMD_LINE_INTS["--threads"],
-                judgments_per_iteration,
-                async_mode,
-                200000);
-    }else if(mode == "para"){
-        SESSIONS[session_id] = make_unique<BMI_para>(
-                seed_query,
-                documents.get(),
-                paragraphs.get(),
-                CMD_LINE_INTS["--threads"],
-                judgments_per_iteration,
-                async_mode,
-                200000);
-    }else if(mode == "para_scal"){
-        SESSIONS[session_id] = make_unique<BMI_para_scal>(
-                seed_query,
-                documents.get(),
-                paragraphs.get(),
-                CMD_LINE_INTS["--threads"],
-                200000, 5);
-    }else {
+    // The session is moved onto any corpus merged meanwhile, but stays on this one if it was reloaded
+    Corpus corpus = CORPUS->get_corpus();
+    unique_ptr<BMI> bmi = create_session(corpus, mode, query, judgments_per_iteration, async_mode, true);
+    if(bmi == nullptr){
         write_response(request, 400, "application/json", "{\"error\": \"Invalid mode\"}");
         return;
     }
+    bmi->record_judgment_batch(seed_judgments);
+    bmi->perform_training_iteration();
 
-    SESSIONS[session_id]->record_judgment_batch(seed_judgments);
-    SESSIONS[session_id]->perform_training_iteration();
+    string session_params = "mode=" + mode + "&seed_query=" + query + "&judgments_per_iteration=" +
+                    to_string(judgments_per_iteration) + "&async=" + (async_mode ? "true" : "false");
+    if(!SESSIONS->add(session_id, session_params, move(bmi))){
+        write_response(request, 400, "application/json", "{\"error\": \"session already exists\"}");
+        return;
+    }
+    shared_ptr<BMI> session = SESSIONS->get(session_id);
+    if(session != nullptr)
+        session->move_to_corpus(CORPUS->get_corpus());
+    sessions_started.add();
 
     // need proper json parsing!!
     write_response(request, 200, "application/json", "{\"session-id\": \""+session_id+"\"}");
 }
 
 // Fetch doc-ids in JSON
-string get_docs(string session_id, int max_count, int num_top_terms = 10){
-    const unique_ptr<BMI> &bmi = SESSIONS[session_id];
-    vector<string> doc_ids = bmi->get_doc_to_judge(max_count);
+string get_docs(const string &session_id, BMI *bmi, int max_count, int num_top_terms = 10){
+    vector<int> doc_handles = bmi->get_doc_to_judge(max_count);
 
     string doc_json = "[";
     string top_terms_json = "{";
-    for(string doc_id: doc_ids){
+    for(int doc_handle: doc_handles){
         if(doc_json.length() > 1)
             doc_json.push_back(',');
         if(top_terms_json.length() > 1)
             top_terms_json.push_back(',');
-        doc_json += "\"" + doc_id + "\"";
+        doc_json += "\"" + bmi->get_ranking_dataset()->get_id(doc_handle) + "\"";
     }
     doc_json.push_back(']');
 
@@ -221,13 +309,11 @@ void delete_session_view(const FCGX_Request & request, const vector<pair<string,
         }
     }
 
-    if(SESSIONS.find(session_id) == SESSIONS.end()){
+    if(!SESSIONS->remove(session_id)){
         write_response(request, 404, "application/json", "{\"error\": \"session not found\"}");
         return;
     }
 
-    SESSIONS.erase(session_id);
-
     write_response(request, 200, "application/json", "{\"session-id\": \"" + session_id + "\"}");
 }
 
@@ -249,12 +335,13 @@ void get_docs_view(const FCGX_Request & request, const vector<pair<string, strin
         return;
     }
 
-    if(SESSIONS.find(session_id) == SESSIONS.end()){
+    shared_ptr<BMI> bmi = SESSIONS->get(session_id);
+    if(bmi == nullptr){
         write_response(request, 404, "application/json", "{\"error\": \"session not found\"}");
         return;
     }
 
-    write_response(request, 200, "application/json", get_docs(session_id, max_count));
+    write_response(request, 200, "application/json", get_docs(session_id, bmi.get(), max_count));
 }
 
 // Handler for /get_ranklist
@@ -271,12 +358,13 @@ void get_ranklist(const FCGX_Request & request, const vector<pair<string, string
         write_response(request, 400, "application/json", "{\"error\": \"Non empty session_id required\"}");
     }
 
-    if(SESSIONS.find(session_id) == SESSIONS.end()){
+    shared_ptr<BMI> bmi = SESSIONS->get(session_id);
+    if(bmi == nullptr){
         write_response(request, 404, "application/json", "{\"error\": \"session not found\"}");
         return;
     }
 
-    vector<pair<string, float>> ranklist = SESSIONS[session_id]->get_ranklist();
+    vector<pair<string, float>> ranklist = bmi->get_ranklist();
     string ranklist_str = "";
     for(auto item: ranklist){
         ranklist_str += item.first + " " + to_string(item.second) + "\n";
@@ -303,13 +391,14 @@ void judge_view(const FCGX_Request & request, const vector<pair<string, string>>
         write_response(request, 400, "application/json", "{\"error\": \"Non empty session_id and doc_id required\"}");
     }
 
-    if(SESSIONS.find(session_id) == SESSIONS.end()){
+    shared_ptr<BMI> bmi = SESSIONS->get(session_id);
+    if(bmi == nullptr){
         write_response(request, 404, "application/json", "{\"error\": \"session not found\"}");
         return;
     }
 
-    const unique_ptr<BMI> &bmi = SESSIONS[session_id];
-    if(bmi->get_dataset()->get_index(doc_id) == bmi->get_dataset()->NPOS){
+    size_t doc_idx = bmi->get_dataset()->get_index(doc_id);
+    if(doc_idx == bmi->get_dataset()->NPOS){
         write_response(request, 404, "application/json", "{\"error\": \"doc_id not found\"}");
         return;
     }
@@ -319,20 +408,242 @@ void judge_view(const FCGX_Request & request, const vector<pair<string, string>>
         return;
     }
 
-    bmi->record_judgment(doc_id, rel);
-    write_response(request, 200, "application/json", get_docs(session_id, 20));
+    bmi->record_judgment(doc_idx, rel);
+    write_response(request, 200, "application/json", get_docs(session_id, bmi.get(), 20));
 }
 
-void log_request(const FCGX_Request & request, const vector<pair<string, string>> &params){
-    cerr<<string(FCGX_GetParam("RELATIVE_URI", request.envp))<<endl;
-    cerr<<FCGX_GetParam("REQUEST_METHOD", request.envp)<<endl;
+// Handler for /add_document
+void add_document_view(const FCGX_Request & request, const vector<pair<string, string>> &params){
+    string doc_id, text;
+    vector<string> paragraphs;
+
+    for(auto kv: params){
+        if(kv.first == "doc_id"){
+            doc_id = kv.second;
+        }else if(kv.first == "text"){
+            text = kv.second;
+        }else if(kv.first == "paragraph"){
+            paragraphs.push_back(kv.second);
+        }
+    }
+
+    // Merging copies the corpus into memory
+    if(CMD_LINE_BOOLS["--stream-features"]){
+        write_response(request, 400, "application/json", "{\"error\": \"documents cannot be added to streamed features\"}");
+        return;
+    }
+
+    if(!CORPUS->add_document(doc_id, text, paragraphs)){
+        write_response(request, 400, "application/json", "{\"error\": \"doc_id is empty, taken or contains a '.' with paragraphs\"}");
+        return;
+    }
+    write_response(request, 200, "application/json", "{\"doc-id\": \"" + doc_id + "\", \"pending\": " + to_string(CORPUS->num_pending()) + "}");
+}
+
+// Handler for /merge
+void merge_view(const FCGX_Request & request, const vector<pair<string, string>> &params){
+    CORPUS->merge();
+    Corpus corpus = CORPUS->get_corpus();
+    write_response(request, 200, "application/json", "{\"documents\": " + to_string(corpus.documents->size()) +
+                   ", \"paragraphs\": " + to_string(corpus.paragraphs != nullptr ? corpus.paragraphs->size() : 0) + "}");
+}
+
+// Loads the corpus from the feature files given by the flags, building or attaching
+// to `doc_segment` and `para_segment` unless they are empty. Returns an empty corpus
+// if a container is not valid.
+Corpus load_corpus(const string &doc_segment, const string &para_segment){
+    Corpus corpus;
+    TIMER_BEGIN(documents_loader);
+    logging::info("Loading document features on memory");
+    vector<string> source_files = {CMD_LINE_STRINGS["--doc-features"]};
+    if(CMD_LINE_STRINGS["--df"].size() > 0)
+        source_files.push_back(CMD_LINE_STRINGS["--df"]);
+    if(CMD_LINE_BOOLS["--stream-features"]){
+        corpus.documents = StreamedDataset::open(CMD_LINE_STRINGS["--doc-features"],
+                                                 (size_t)CMD_LINE_INTS["--stream-block-size"] << 20);
+    }else{
+        corpus.documents = Dataset::attach_or_build(doc_segment, source_files, []() -> unique_ptr<FeatureParser> {
+            if(CMD_LINE_STRINGS["--df"].size() > 0)
+                return make_unique<BinFeatureParser>(CMD_LINE_STRINGS["--doc-features"], CMD_LINE_STRINGS["--df"]);
+            return make_unique<BinFeatureParser>(CMD_LINE_STRINGS["--doc-features"]);
+        }, CMD_LINE_INTS["--threads"], CMD_LINE_BOOLS["--compress-features"]);
+    }
+    if(corpus.documents == nullptr)
+        return Corpus();
+    logging::info("Read " + to_string(corpus.documents->size()) + " docs");
+    if(CMD_LINE_BOOLS["--numa"] && !CMD_LINE_BOOLS["--stream-features"])
+        corpus.documents->place_on_nodes();
+    if(CMD_LINE_INTS["--retrieval-candidates"] > 0)
+        corpus.documents->build_term_index(CMD_LINE_INTS["--retrieval-terms"], CMD_LINE_INTS["--threads"]);
+    TIMER_END(documents_loader);
+
+    string para_features_path = CMD_LINE_STRINGS["--para-features"];
+    if(para_features_path.length() > 0){
+        TIMER_BEGIN(paragraph_loader);
+        logging::info("Loading paragraph features on memory");
+        corpus.paragraphs = ParagraphDataset::attach_or_build(para_segment, {para_features_path},
+            [&para_features_path]() -> unique_ptr<FeatureParser> {
+                if(CMD_LINE_STRINGS["--df"].size() > 0)
+                    return make_unique<BinFeatureParser>(para_features_path, "");
+                return make_unique<BinFeatureParser>(para_features_path);
+            }, *corpus.documents, CMD_LINE_INTS["--threads"], CMD_LINE_BOOLS["--compress-features"]);
+        if(corpus.paragraphs == nullptr)
+            return Corpus();
+        logging::info("Read " + to_string(corpus.paragraphs->size()) + " paragraphs");
+        if(CMD_LINE_BOOLS["--numa"])
+            corpus.paragraphs->place_on_nodes();
+        TIMER_END(paragraph_loader);
+    }
+    return corpus;
+}
+
+// Rebuilds every session on an earlier generation than `corpus` onto it, from the
+// parameters it was begun with and its judgments by doc id. Judgments of documents
+// missing from `corpus` are dropped. Returns the number of sessions migrated
+size_t migrate_sessions(const Corpus &corpus){
+    size_t num_migrated = 0;
+    for(const string &session_id: SESSIONS->get_ids()){
+        shared_ptr<BMI> bmi = SESSIONS->get(session_id);
+        if(bmi == nullptr || bmi->get_corpus().generation == corpus.generation)
+            continue;
+
+        vector<pair<string, int>> judgments = bmi->get_judgments();
+        unique_ptr<BMI> migrated = create_session_from_params(SESSIONS->get_params(session_id), corpus, true);
+        if(migrated == nullptr)
+            continue;
+        migrated->record_judgment_batch(judgments);
+        migrated->perform_training_iteration();
+        if(!SESSIONS->replace(session_id, bmi, move(migrated)))
+            continue;
+
+        // Requests which got the session before it was replaced may have judged it since
+        while(bmi.use_count() > 1 || !bmi->is_idle())
+            this_thread::sleep_for(chrono::milliseconds(10));
+        map<string, int> migrated_judgments(judgments.begin(), judgments.end());
+        vector<pair<string, int>> late_judgments;
+        for(auto &judgment: bmi->get_judgments()){
+            auto it = migrated_judgments.find(judgment.first);
+            if(it == migrated_judgments.end() || it->second != judgment.second)
+                late_judgments.push_back(judgment);
+        }
+        bmi = nullptr;
+        shared_ptr<BMI> session = SESSIONS->get(session_id);
+        if(session != nullptr && !late_judgments.empty())
+            session->record_judgment_batch(late_judgments);
+
+        size_t num_dropped = 0;
+        for(auto &judgment: judgments)
+            if(corpus.documents->get_index(judgment.first) == corpus.documents->NPOS)
+                num_dropped++;
+        logging::info("Migrated session " + session_id + " with " + to_string(judgments.size()) + " judgments, " +
+                      to_string(num_dropped) + " of them of documents missing from the new corpus");
+        sessions_migrated.add();
+        num_migrated++;
+    }
+    return num_migrated;
+}
+
+// Loads the feature files again and replaces the corpus with them, migrating the
+// sessions onto the new corpus if `migrate` is set
+void reload_corpus(bool migrate){
+    TIMER_BEGIN(corpus_reload);
+    // Segments are only used at startup, the previous corpus may still be in them
+    Corpus corpus = load_corpus("", "");
+    if(corpus.documents == nullptr){
+        logging::error("Failed to reload the corpus from " + CMD_LINE_STRINGS["--doc-features"]);
+        RELOADING = false;
+        return;
+    }
+    corpus = CORPUS->reload(corpus);
+    corpus_reloads.add();
+    logging::info("Reloaded a corpus of " + to_string(corpus.documents->size()) + " docs as generation " +
+                  to_string(corpus.generation));
+    if(migrate)
+        logging::info("Migrated " + to_string(migrate_sessions(corpus)) + " sessions onto the reloaded corpus");
+    TIMER_END(corpus_reload);
+    RELOADING = false;
+}
+
+// Handler for /reload
+void reload_view(const FCGX_Request & request, const vector<pair<string, string>> &params){
+    bool migrate = false;
+
     for(auto kv: params){
-        cerr<<kv.first<<" "<<kv.second<<endl;
+        if(kv.first == "migrate"){
+            migrate = kv.second == "true" || kv.second == "True";
+        }
     }
-    cerr<<endl;
+
+    for(string flag: {"--doc-features", "--para-features", "--df"}){
+        const string &path = CMD_LINE_STRINGS[flag];
+        if(path.size() > 0 && access(path.c_str(), R_OK) != 0){
+            write_response(request, 400, "application/json", "{\"error\": \"cannot read " + path + "\"}");
+            return;
+        }
+    }
+
+    if(RELOADING.exchange(true)){
+        write_response(request, 409, "application/json", "{\"error\": \"a reload is in progress\"}");
+        return;
+    }
+    uint64_t generation = CORPUS->get_corpus().generation + 1;
+    thread(reload_corpus, migrate).detach();
+    write_response(request, 202, "application/json", "{\"generation\": " + to_string(generation) + "}");
+}
+
+// Handler for /corpus
+void corpus_view(const FCGX_Request & request, const vector<pair<string, string>> &params){
+    Corpus corpus = CORPUS->get_corpus();
+    write_response(request, 200, "application/json", "{\"generation\": " + to_string(corpus.generation) +
+                   ", \"documents\": " + to_string(corpus.documents->size()) +
+                   ", \"paragraphs\": " + to_string(corpus.paragraphs != nullptr ? corpus.paragraphs->size() : 0) +
+                   ", \"compressed\": " + (corpus.documents->is_compressed() ? "true" : "false") +
+                   ", \"pending\": " + to_string(CORPUS->num_pending()) +
+                   ", \"reloading\": " + (RELOADING ? "true" : "false") + "}");
+}
+
+// Moves the sessions in memory onto a newly merged corpus. Spilled sessions move
+// onto it when they are restored.
+void publish_corpus(const Corpus &corpus){
+    for(auto &bmi: SESSIONS->get_resident())
+        bmi->move_to_corpus(corpus);
+    logging::info("Published a corpus of " + to_string(corpus.documents->size()) + " docs");
+}
+
+// Handler for /metrics
+void metrics_view(const FCGX_Request & request, const vector<pair<string, string>> &params){
+    write_response(request, 200, "text/plain; version=0.0.4", metrics::render(), false);
+}
+
+// Handler for /trace
+void trace_view(const FCGX_Request & request, const vector<pair<string, string>> &params){
+    if(!tracing::enabled()){
+        write_response(request, 400, "application/json", "{\"error\": \"tracing is disabled, set --trace-path\"}");
+        return;
+    }
+
+    long num_spans = tracing::write_chrome_trace(CMD_LINE_STRINGS["--trace-path"]);
+    if(num_spans < 0){
+        write_response(request, 500, "application/json", "{\"error\": \"failed to write the trace\"}");
+        return;
+    }
+    write_response(request, 200, "application/json", "{\"path\": \"" + CMD_LINE_STRINGS["--trace-path"] + "\", \"spans\": " + to_string(num_spans) + "}");
+}
+
+void log_request(const FCGX_Request & request, const vector<pair<string, string>> &params){
+    if(!logging::enabled(logging::INFO))
+        return;
+    string line = string(FCGX_GetParam("REQUEST_METHOD", request.envp)) + " " + FCGX_GetParam("RELATIVE_URI", request.envp);
+    for(auto &kv: params){
+        if(line.size() > logging::MAX_MESSAGE_LENGTH)
+            break;
+        line += " " + kv.first + "=" + kv.second.substr(0, logging::MAX_MESSAGE_LENGTH);
+    }
+    logging::info(line);
 }
 
 void process_request(const FCGX_Request & request) {
+    auto start = chrono::steady_clock::now();
     string action = parse_action_from_uri(FCGX_GetParam("RELATIVE_URI", request.envp));
     string method = FCGX_GetParam("REQUEST_METHOD", request.envp);
 
@@ -345,6 +656,13 @@ void process_request(const FCGX_Request & request) {
 
     log_request(request, params);
 
+    string session_id;
+    for(auto &kv: params)
+        if(kv.first == "session_id")
+            session_id = kv.second;
+    tracing::ScopedContext request_context(session_id);
+    tracing::Span request_span(action.c_str());
+
     if(action == "begin"){
         if(method == "POST"){
             begin_session_view(request, params);
@@ -365,7 +683,33 @@ void process_request(const FCGX_Request & request) {
         if(method == "DELETE"){
             delete_session_view(request, params);
         }
+    }else if(action == "add_document"){
+        if(method == "POST"){
+            add_document_view(request, params);
+        }
+    }else if(action == "merge"){
+        if(method == "POST"){
+            merge_view(request, params);
+        }
+    }else if(action == "reload"){
+        if(method == "POST"){
+            reload_view(request, params);
+        }
+    }else if(action == "corpus"){
+        if(method == "GET"){
+            corpus_view(request, params);
+        }
+    }else if(action == "metrics"){
+        if(method == "GET"){
+            metrics_view(request, params);
+        }
+    }else if(action == "trace"){
+        if(method == "GET"){
+            trace_view(request, params);
+        }
     }
+
+    get_route_latency(action).observe_since(start);
 }
 
 void fcgi_listener(){
@@ -378,10 +722,27 @@ void fcgi_listener(){
 }
 
 int main(int argc, char **argv){
-    AddFlag("--doc-features", "Path of the file with list of document features", string(""));
-    AddFlag("--para-features", "Path of the file with list of paragraph features", string(""));
+    AddFlag("--doc-features", "Path of the file with list of document features, or their container", string(""));
+    AddFlag("--para-features", "Path of the file with list of paragraph features, or their container", string(""));
     AddFlag("--df", "Path of the file with list of terms and their document frequencies", string(""));
-    AddFlag("--threads", "Number of threads to use for scoring", int(8));
+    AddFlag("--numa", "Partition the features across NUMA nodes and score each partition on its own node", bool(false));
+    AddFlag("--hugepages", "Use explicit 2MB pages from the hugetlb pool for features not in a segment", bool(false));
+    AddFlag("--doc-segment", "Name of the shared memory segment (/name) or hugepage file holding the document features, built on first use", string(""));
+    AddFlag("--para-segment", "Name of the shared memory segment (/name) or hugepage file holding the paragraph features, built on first use", string(""));
+    AddFlag("--compress-features", "Hold the features built from feature files compressed in memory, with their values quantized to 16 bits. Containers keep the encoding they were packed with", bool(false));
+    AddFlag("--stream-features", "Stream the document features from their container while rescoring instead of loading them into memory", bool(false));
+    AddFlag("--stream-block-size", "Megabytes of document features read at once with --stream-features", int(64));
+    AddFlag("--threads", "Number of threads to use for loading features and scoring", int(8));
+    AddFlag("--para-candidate-depth", "Score only the paragraphs of these many top documents, 0 to score all paragraphs", int(0));
+    AddFlag("--retrieval-candidates", "Index the document features and rescore exactly only the documents estimated highest from the index, at least these many, 0 to rescore every document", int(0));
+    AddFlag("--retrieval-terms", "Number of terms the index estimates scores from with --retrieval-candidates", int(1000));
+    AddFlag("--retrieval-refresh-period", "Rescore every document every these many iterations with --retrieval-candidates", int(10));
+    AddFlag("--retrieval-recall", "Also rescore every document to record the recall of --retrieval-candidates", bool(false));
+    AddFlag("--log-level", "Least severe messages to log: debug, info, warning or error", string("info"));
+    AddFlag("--session-memory-budget", "Megabytes of session state to keep in memory, the least recently used sessions are spilled to --session-spill-dir beyond it; 0 for no limit", int(0));
+    AddFlag("--session-spill-dir", "Directory to spill sessions to, sessions spilled to it earlier can be resumed", string(""));
+    AddFlag("--merge-interval", "Seconds between merges of the documents added through /add_document into the corpus, 0 to only merge on /merge", int(60));
+    AddFlag("--trace-path", "Record tracing spans, written to this file as a Chrome trace on GET /trace", string(""));
     AddFlag("--help", "Show Help", bool(false));
 
     ParseFlags(argc, argv);
@@ -396,36 +757,46 @@ int main(int argc, char **argv){
         return -1;
     }
 
-    // Load docs
-    TIMER_BEGIN(documents_loader);
-    cerr<<"Loading document features on memory"<<endl;
-    {
-        unique_ptr<FeatureParser> feature_parser;
-        if(CMD_LINE_STRINGS["--df"].size() > 0)
-            feature_parser = make_unique<BinFeatureParser>(CMD_LINE_STRINGS["--doc-features"], CMD_LINE_STRINGS["--df"]);
-        else
-            feature_parser = make_unique<BinFeatureParser>(CMD_LINE_STRINGS["--doc-features"]);
-        documents = Dataset::build(feature_parser.get());
-        cerr<<"Read "<<documents->size()<<" docs"<<endl;
+    logging::Level log_level;
+    if(!logging::parse_level(CMD_LINE_STRINGS["--log-level"], log_level)){
+        cerr<<"Invalid --log-level "<<CMD_LINE_STRINGS["--log-level"]<<endl;
+        return -1;
     }
-    TIMER_END(documents_loader);
+    logging::set_level(log_level);
+    tracing::set_enabled(CMD_LINE_STRINGS["--trace-path"].size() > 0);
 
-    // Load para
-    string para_features_path = CMD_LINE_STRINGS["--para-features"];
-    if(para_features_path.length() > 0){
-        TIMER_BEGIN(paragraph_loader);
-        cerr<<"Loading paragraph features on memory"<<endl;
-        {
-            unique_ptr<FeatureParser> feature_parser;
-            if(CMD_LINE_STRINGS["--df"].size() > 0)
-                feature_parser = make_unique<BinFeatureParser>(para_features_path, "");
-            else
-                feature_parser = make_unique<BinFeatureParser>(para_features_path);
-            paragraphs = ParagraphDataset::build(feature_parser.get(), *documents);
-            cerr<<"Read "<<paragraphs->size()<<" paragraphs"<<endl;
-        }
-        TIMER_END(paragraph_loader);
+    if(CMD_LINE_INTS["--retrieval-candidates"] < 0 ||
+       (CMD_LINE_INTS["--retrieval-candidates"] > 0 && (CMD_LINE_INTS["--retrieval-terms"] <= 0 || CMD_LINE_INTS["--retrieval-refresh-period"] <= 0))){
+        cerr<<"non-negative --retrieval-candidates, and positive --retrieval-terms and --retrieval-refresh-period with it, required"<<endl;
+        return -1;
+    }
+    if(CMD_LINE_INTS["--retrieval-candidates"] > 0 && CMD_LINE_BOOLS["--stream-features"]){
+        cerr<<"--retrieval-candidates would index the streamed features in memory"<<endl;
+        return -1;
+    }
+
+    if(CMD_LINE_BOOLS["--stream-features"] && !FeatureStore::is_container(CMD_LINE_STRINGS["--doc-features"])){
+        cerr<<"--stream-features requires --doc-features to be a container, see feature_packer"<<endl;
+        return -1;
+    }
+
+    MemoryRegion::use_explicit_huge_pages(CMD_LINE_BOOLS["--hugepages"]);
+    Corpus corpus = load_corpus(CMD_LINE_STRINGS["--doc-segment"], CMD_LINE_STRINGS["--para-segment"]);
+    if(corpus.documents == nullptr){
+        cerr<<"Failed to load the features"<<endl;
+        return -1;
+    }
+
+    if(CMD_LINE_INTS["--session-memory-budget"] > 0 && CMD_LINE_STRINGS["--session-spill-dir"].empty()){
+        cerr<<"--session-memory-budget requires --session-spill-dir"<<endl;
+        return -1;
     }
+    SESSIONS = make_unique<SessionManager>(restore_session,
+            (size_t)max(CMD_LINE_INTS["--session-memory-budget"], 0) << 20, CMD_LINE_STRINGS["--session-spill-dir"]);
+    CORPUS = make_unique<CorpusUpdater>(corpus, CMD_LINE_BOOLS["--numa"], publish_corpus);
+    corpus = Corpus();
+    if(CMD_LINE_INTS["--merge-interval"] > 0)
+        CORPUS->start_background_merges(chrono::seconds(CMD_LINE_INTS["--merge-interval"]));
 
     FCGX_Init();
 
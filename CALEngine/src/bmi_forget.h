@@ -7,7 +7,7 @@
 #include "classifier.h"
 
 class BMI_forget:public BMI {
-    std::unordered_map<const SfSparseVector*, int> judgment_order;
+    std::unordered_map<int, int> judgment_order;
     const int num_remember;
     int cur_time_rel  = 0;
     int cur_time_nonrel  = 0;
@@ -29,13 +29,13 @@ class BMI_forget:public BMI {
         perform_iteration();
     }
 
-    virtual void record_judgment(std::string doc_id, int judgment){
-        size_t id = documents->get_index(doc_id);
+    using BMI::record_judgment;
+    virtual void record_judgment(int id, int judgment){
         if(judgment > 0)
-            judgment_order[&documents->get_sf_sparse_vector(id)] = ++cur_time_rel;
+            judgment_order[id] = ++cur_time_rel;
         else
-            judgment_order[&documents->get_sf_sparse_vector(id)] = ++cur_time_nonrel;
-        record_judgment_batch({{doc_id, judgment}});
+            judgment_order[id] = ++cur_time_nonrel;
+        record_judgment_batch({{id, judgment}});
     }
 };
 
@@ -51,27 +51,30 @@ vector<float> BMI_forget::train(){
 
     // Sampling random non_rel documents
     std::uniform_int_distribution<size_t> distribution(0, documents->size()-1);
+    random_negatives.clear();
     for(int i = 1;i<=100;i++){
         size_t idx = distribution(rand_generator);
-        negatives.push_back(&documents->get_sf_sparse_vector(idx));
+        random_negatives.push_back(documents->get_sf_sparse_vector(idx));
     }
+    for(auto &spv: random_negatives)
+        negatives.push_back(&spv);
 
     int cur_time = cur_time_rel + cur_time_nonrel;
     bool full_train = (full_train_period != -1 && (cur_time-1) % full_train_period == 0);
 
     for(const std::pair<int, int> &judgment: judgments){
         if(judgment.second > 0){
-            if(full_train || judgment_order[&documents->get_sf_sparse_vector(judgment.first)] > cur_time_rel - num_remember)
-                positives.push_back(&documents->get_sf_sparse_vector(judgment.first));
+            if(full_train || judgment_order[judgment.first] > cur_time_rel - num_remember)
+                positives.push_back(get_training_vector(judgment.first));
         }
         else{
-            if(full_train || judgment_order[&documents->get_sf_sparse_vector(judgment.first)] > cur_time_nonrel - num_remember)
-                negatives.push_back(&documents->get_sf_sparse_vector(judgment.first));
+            if(full_train || judgment_order[judgment.first] > cur_time_nonrel - num_remember)
+                negatives.push_back(get_training_vector(judgment.first));
         }
 
     }
 
-    std::cerr<<"Training on "<<positives.size()<<" +ve docs and "<<negatives.size()<<" -ve docs"<<std::endl;
+    logging::info("Training on " + std::to_string(positives.size()) + " +ve docs and " + std::to_string(negatives.size()) + " -ve docs");
     
     return LRPegasosClassifier(training_iterations).train(positives, negatives, documents->get_dimensionality());
 }
@@ -16,7 +16,7 @@ BMI_online_learning::BMI_online_learning(Seed _seed,
     perform_iteration();
 }
 vector<int> BMI_online_learning::perform_training_iteration(){
-    lock_guard<mutex> lock_training(training_mutex);
+    unique_lock<mutex> lock_training = wait_for_training();
 
     {
         lock_guard<mutex> lock(training_cache_mutex);
@@ -24,11 +24,12 @@ vector<int> BMI_online_learning::perform_training_iteration(){
             if(!is_it_refresh_time()){
                 float p = 1 / (1 + exp(-documents->inner_product(training.first, this->weight)));
                 int is_rel = (training.second > 0);
-                for(FeatureValuePair feature: documents->get_sf_sparse_vector(training.first).features_){
+                SfSparseVector spv = documents->get_sf_sparse_vector(training.first);
+                for(FeatureValuePair feature: spv.features_){
                     this->weight[feature.id_] += (is_rel - p) * delta;
                 }
             }
-            judgments[training.first] = training.second;
+            set_judgment(training.first, training.second);
         }
         training_cache.clear();
     }
@@ -36,22 +37,29 @@ vector<int> BMI_online_learning::perform_training_iteration(){
     // Training
 
     if(is_it_refresh_time()){
+        tracing::Span span("training");
         auto start = std::chrono::steady_clock::now();
         this->weight = train();
+        // Retrained weights are too far from the cached scores for them to bound anything
+        score_cache.clear();
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds> 
             (std::chrono::steady_clock::now() - start);
-        cerr<<"Training finished in "<<duration.count()<<"ms"<<endl;
+        logging::info("Training finished in " + to_string(duration.count()) + "ms");
+        training_time.observe_since(start);
     }
 
 
 
     // Scoring
+    tracing::Span span("rescoring");
     auto start = std::chrono::steady_clock::now();
-    auto results = documents->rescore(this->weight, num_threads,
-                              judgments_per_iteration + (async_mode ? extra_judgment_docs : 0), judgments);
+    // Online updates only move the weights of the judged documents' features, by delta
+    auto results = documents->rescore_cached(this->weight, num_threads,
+                              judgments_per_iteration + (async_mode ? extra_judgment_docs : 0), judged_docs, score_cache);
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds> 
         (std::chrono::steady_clock::now() - start);
-    cerr<<"Rescored "<<documents->size()<<" documents in "<<duration.count()<<"ms"<<endl;
+    logging::info("Rescored " + to_string(documents->size()) + " documents in " + to_string(duration.count()) + "ms");
+    rescoring_time.observe_since(start);
 
     return results;
 }
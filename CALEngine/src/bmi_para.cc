@@ -13,48 +13,71 @@ BMI_para::BMI_para(Seed _seed,
         int _num_threads,
         int _judgments_per_iteration,
         bool _async_mode,
-        int _training_iterations)
+        int _training_iterations,
+        size_t _candidate_depth,
+        bool _check_candidate_recall,
+        bool initialize)
     :BMI(_seed, _documents, _num_threads, _judgments_per_iteration, _async_mode, _training_iterations, false),
-    paragraphs(_paragraphs)
+    paragraphs(_paragraphs),
+    candidate_depth(_candidate_depth),
+    check_candidate_recall(_check_candidate_recall)
 {
-    perform_iteration();
+    if(initialize)
+        perform_iteration();
 }
 
-void BMI_para::record_judgment(string doc_id, int judgment){
-    record_judgment_batch({{doc_id.substr(0, doc_id.find(".")), judgment}});
+void BMI_para::set_datasets(Dataset *_documents, ParagraphDataset *_paragraphs){
+    BMI::set_datasets(_documents, _paragraphs);
+    paragraphs = _paragraphs;
+}
+
+vector<int> BMI_para::rescore_paragraphs(const vector<float> &weights, int num_top_docs){
+    if(candidate_depth == 0)
+        return rescore(paragraphs, weights, num_top_docs);
+
+    auto candidates = rescore(documents, weights, max(candidate_depth, (size_t)num_top_docs));
+    auto results = paragraphs->rescore_candidates(weights, num_threads, num_top_docs, candidates);
+
+    if(check_candidate_recall){
+        auto exhaustive_results = paragraphs->rescore(weights, num_threads, num_top_docs, judged_docs);
+        unordered_set<int> found(results.begin(), results.end());
+        int hits = 0;
+        for(int result: exhaustive_results)
+            hits += found.count(result);
+        logging::info("Candidate recall: " + to_string(hits) + "/" + to_string(exhaustive_results.size()));
+    }
+    return results;
 }
 
 vector<int> BMI_para::perform_training_iteration(){
-    lock_guard<mutex> lock_training(training_mutex);
+    unique_lock<mutex> lock_training = wait_for_training();
     sync_training_cache();
 
     // Training
     TIMER_BEGIN(training);
     auto weights = train();
-    TIMER_END(training);
+    TIMER_END_OBSERVE(training, training_time);
 
     // Scoring
     TIMER_BEGIN(rescoring);
-    auto results = paragraphs->rescore(weights, num_threads,
-                              judgments_per_iteration + (async_mode ? extra_judgment_docs : 0),
-                              judgments);
-    TIMER_END(rescoring);
+    auto results = rescore_paragraphs(weights,
+                              judgments_per_iteration + (async_mode ? extra_judgment_docs : 0));
+    TIMER_END_OBSERVE(rescoring, rescoring_time);
 
     return results;
 }
 
 std::vector<std::pair<string, float>> BMI_para::get_ranklist(){
     vector<std::pair<string, float>> ret_results;
-    unordered_set<string> doc_id_seen;
+    vector<bool> doc_seen(documents->size());
     auto results = get_ranking_dataset()->rescore(train(), num_threads,
-                              get_ranking_dataset()->size(), map<int, int>());
+                              get_ranking_dataset()->size(), AtomicBitset());
 
     for(auto result: results){
-        string para_id = get_ranking_dataset()->get_sf_sparse_vector(result).doc_id;
-        string doc_id = para_id.substr(0, para_id.find('.'));
-        if(doc_id_seen.find(doc_id) == doc_id_seen.end()){
-            ret_results.push_back({doc_id, 0});
-            doc_id_seen.insert(doc_id);
+        int doc_idx = paragraphs->translate_index(result);
+        if(doc_idx >= 0 && (size_t)doc_idx < doc_seen.size() && !doc_seen[doc_idx]){
+            ret_results.push_back({documents->get_id(doc_idx), 0});
+            doc_seen[doc_idx] = true;
         }
     }
     return ret_results;
@@ -9,6 +9,18 @@ class BMI_para:public BMI {
     protected:
     ParagraphDataset *paragraphs;
 
+    // If non-zero, rescoring is done in two stages: documents are scored
+    // first, and only the paragraphs of the top `candidate_depth` documents
+    // are scored after that
+    size_t candidate_depth;
+
+    // Compare the two-stage results with exhaustive paragraph scoring on every iteration
+    bool check_candidate_recall;
+
+    std::vector<int> rescore_paragraphs(const std::vector<float> &weights, int num_top_docs);
+
+    void set_datasets(Dataset *documents, ParagraphDataset *paragraphs);
+
     public:
     BMI_para(Seed seed,
         Dataset *documents,
@@ -16,17 +28,17 @@ class BMI_para:public BMI {
         int num_threads,
         int judgments_per_iteration,
         bool async_mode,
-        int training_iterations);
+        int training_iterations,
+        size_t candidate_depth = 0,
+        bool check_candidate_recall = false,
+        bool initialize = true);
 
-    virtual void record_judgment(std::string doc_id, int judgment);
     Dataset *get_ranking_dataset() {return paragraphs;};
     vector<std::pair<string, float>> get_ranklist();
     std::vector<int> perform_training_iteration();
 
     bool is_judged(int id) {
-        std::string para = (paragraphs->get_sf_sparse_vector(id)).doc_id;
-        id = documents->get_index(para.substr(0, para.find(".")));
-        return judgments.find(id) != judgments.end() || training_cache.find(id) != training_cache.end();
+        return judged_docs.test(paragraphs->translate_index(id));
     }
 };
 
@@ -7,21 +7,39 @@ BMI_para_scal::BMI_para_scal(Seed _seed,
         Dataset *_documents,
         ParagraphDataset *_paragraphs,
         int _num_threads,
-        int _training_iterations, int _N)
-    :BMI_para(_seed, _documents, _paragraphs, _num_threads, -1, false, _training_iterations)
+        int _training_iterations, int _N,
+        size_t _candidate_depth,
+        bool initialize)
+    :BMI_para(_seed, _documents, _paragraphs, _num_threads, -1, false, _training_iterations, _candidate_depth, false, initialize)
 {
     N = _N;
     T = N;
     R = 0;
     judgments_per_iteration = B;
-    perform_iteration();
-    B = B + ceil(B/10.0);
+    if(initialize){
+        perform_iteration();
+        B = B + ceil(B/10.0);
+    }
+}
+
+void BMI_para_scal::write_state(FILE *fp){
+    BMI::write_state(fp);
+    int32_t values[] = {B, T, R};
+    fwrite(values, sizeof(int32_t), 3, fp);
+}
+
+bool BMI_para_scal::read_state(FILE *fp){
+    int32_t values[3];
+    if(!BMI::read_state(fp) || fread(values, sizeof(int32_t), 3, fp) != 3)
+        return false;
+    B = values[0], T = values[1], R = values[2];
+    return true;
 }
 
-void BMI_para_scal::record_judgment_batch(vector<pair<string, int>> _judgments){
+void BMI_para_scal::record_judgment_batch(vector<pair<int, int>> _judgments){
     lock_guard<mutex> lock(judgment_list_mutex);
     for(const auto &judgment: _judgments){
-        size_t id = documents->get_index(judgment.first);
+        int id = judgment.first;
         add_to_training_cache(id, judgment.second);
         for(int i = (int)judgment_queue.size() - 1; i >= 0; i--){
             if(paragraphs->translate_index(judgment_queue[i]) == id){
@@ -33,25 +51,25 @@ void BMI_para_scal::record_judgment_batch(vector<pair<string, int>> _judgments){
     }
 
     if(judgment_queue.size() == 0){
-        cerr<<"Refreshing"<<endl;
-        cerr<<"R = "<<R<<endl;
+        logging::info("Refreshing");
+        logging::info("R = " + to_string(R));
         if(R >= T) {
             T <<= 1;
-            cerr<<"Doubling T to "<<T<<endl;
+            logging::info("Doubling T to " + to_string(T));
         }
-        cerr<<"Batch Size = "<<B<<endl;
+        logging::info("Batch Size = " + to_string(B));
         judgments_per_iteration = B;
         vector<int> batch = perform_training_iteration();
 
         int n = ceil(B*N/(float)T);
-        cerr<<"Sampling "<<n<<" documents"<<endl;
+        logging::info("Sampling " + to_string(n) + " documents");
         vector<int> selector(batch.size());
         for(int i = 0; i < selector.size(); i++)
             selector[i] = (i < n?1:0);
         shuffle(batch.begin(), batch.end(), rand_generator);
         for(int i = 0; i < batch.size(); i++){
             if(selector[i]) judgment_queue.push_back(batch[i]);
-            else judgments[batch[i]] = -2;
+            else set_judgment(paragraphs->translate_index(batch[i]), -2);
         }
         B = B + ceil(B/10.0);
     }
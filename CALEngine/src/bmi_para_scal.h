@@ -13,9 +13,15 @@ class BMI_para_scal:public BMI_para {
         Dataset *documents,
         ParagraphDataset *paragraphs,
         int num_threads,
-        int training_iterations, int N);
+        int training_iterations, int N,
+        size_t candidate_depth = 0,
+        bool initialize = true);
 
-    virtual void record_judgment_batch(std::vector<std::pair<std::string, int>> judgments);
+    using BMI::record_judgment_batch;
+    virtual void record_judgment_batch(std::vector<std::pair<int, int>> judgments);
+
+    void write_state(FILE *fp);
+    bool read_state(FILE *fp);
 };
 
 #endif // BMI_PARA_SCAL_H
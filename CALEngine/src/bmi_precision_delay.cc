@@ -18,7 +18,7 @@ BMI_precision_delay::BMI_precision_delay(Seed _seed,
 }
 
 vector<int> BMI_precision_delay::perform_training_iteration(){
-    lock_guard<mutex> lock_training(training_mutex);
+    unique_lock<mutex> lock_training = wait_for_training();
 
     sync_training_cache();
 
@@ -26,24 +26,24 @@ vector<int> BMI_precision_delay::perform_training_iteration(){
     if(!skip_training){
         TIMER_BEGIN(training);
         weights = train();
-        TIMER_END(training);
+        TIMER_END_OBSERVE(training, training_time);
     }
 
 
     // Scoring
     TIMER_BEGIN(rescoring);
     auto results = documents->rescore(weights, num_threads,
-                              judgments_per_iteration + (async_mode ? extra_judgment_docs : 0), judgments);
-    TIMER_END(rescoring);
+                              judgments_per_iteration + (async_mode ? extra_judgment_docs : 0), judged_docs);
+    TIMER_END_OBSERVE(rescoring, rescoring_time);
 
     return results;
 }
 
-void BMI_precision_delay::record_judgment_batch(std::vector<std::pair<std::string, int>> _judgments){
+void BMI_precision_delay::record_judgment_batch(std::vector<std::pair<int, int>> _judgments){
     state.next_iteration_target += 1;
     int last_rel;
     for(const auto &judgment: _judgments){
-        size_t id = documents->get_index(judgment.first);
+        int id = judgment.first;
         if(judgment_queue.size() > 0 && id == judgment_queue.back()){
             judgment_queue.pop_back();
         }
@@ -73,7 +73,7 @@ void BMI_precision_delay::record_judgment_batch(std::vector<std::pair<std::strin
             skip_training = false;
         }
     }else{
-        auto t = std::thread(&BMI_precision_delay::perform_iteration_async, this);
+        auto t = std::thread(&BMI_precision_delay::perform_iteration_async, this, tracing::get_context());
         t.detach();
     }
 }
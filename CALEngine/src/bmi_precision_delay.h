@@ -10,7 +10,7 @@ class BMI_precision_delay:public BMI {
     std::queue<int> q;
     int rel = 0;
     int tot = 0;
-    void record_judgment_batch(std::vector<std::pair<std::string, int>> _judgments);
+    void record_judgment_batch(std::vector<std::pair<int, int>> _judgments);
     vector<float> weights;
     bool skip_training = false;
     vector<int> perform_training_iteration();
@@ -7,7 +7,7 @@
 #include "classifier.h"
 
 class BMI_recency_weighting:public BMI {
-    std::unordered_map<const SfSparseVector*, int> judgment_order;
+    std::unordered_map<int, int> judgment_order;
     const float max_relative_weight;
     int cur_time  = 0;
     protected:
@@ -25,27 +25,35 @@ class BMI_recency_weighting:public BMI {
         perform_iteration();
     }
 
-    virtual void record_judgment(std::string doc_id, int judgment){
-        size_t id = documents->get_index(doc_id);
-        judgment_order[&documents->get_sf_sparse_vector(id)] = ++cur_time;
-        record_judgment_batch({{doc_id, judgment}});
+    using BMI::record_judgment;
+    virtual void record_judgment(int id, int judgment){
+        judgment_order[id] = ++cur_time;
+        record_judgment_batch({{id, judgment}});
     }
 };
 
 vector<float> BMI_recency_weighting::train(){
     std::uniform_int_distribution<size_t> distribution(0, documents->size()-1);
+    random_negatives.clear();
     for(int i = 0;i<random_negatives_size;i++){
         size_t idx = distribution(rand_generator);
-        negatives[random_negatives_index + i] = &documents->get_sf_sparse_vector(idx);
+        random_negatives.push_back(documents->get_sf_sparse_vector(idx));
     }
+    for(int i = 0;i<random_negatives_size;i++)
+        negatives[random_negatives_index + i] = &random_negatives[i];
 
-    std::cerr<<"Training on "<<positives.size()<<" +ve docs and "<<negatives.size()<<" -ve docs"<<std::endl;
+    // Training vectors are keyed by document, the classifier needs them keyed by vector
+    std::unordered_map<const SfSparseVector*, int> order;
+    for(auto &judgment: judgment_order)
+        order[get_training_vector(judgment.first)] = judgment.second;
+
+    logging::info("Training on " + std::to_string(positives.size()) + " +ve docs and " + std::to_string(negatives.size()) + " -ve docs");
     
 
-    std::sort(positives.begin(), positives.end(), [this](const SfSparseVector *a, const SfSparseVector *b) -> bool {return this->judgment_order[a] < this->judgment_order[b];});
-    std::sort(negatives.begin()+100, negatives.end(), [this](const SfSparseVector *a, const SfSparseVector *b) -> bool {return this->judgment_order[a] < this->judgment_order[b];});
+    std::sort(positives.begin(), positives.end(), [&order](const SfSparseVector *a, const SfSparseVector *b) -> bool {return order[a] < order[b];});
+    std::sort(negatives.begin()+100, negatives.end(), [&order](const SfSparseVector *a, const SfSparseVector *b) -> bool {return order[a] < order[b];});
 
-    std::cerr<<"Training on "<<positives.size()<<" +ve docs and "<<negatives.size()<<" -ve docs"<<std::endl;
+    logging::info("Training on " + std::to_string(positives.size()) + " +ve docs and " + std::to_string(negatives.size()) + " -ve docs");
     
     return LRPegasosWeightedRecencyClassifier(max_relative_weight, training_iterations).train(positives, negatives, documents->get_dimensionality());
 }
@@ -1,13 +1,15 @@
 #ifndef BMI_REDUCED_RANKING_H
 #define BMI_REDUCED_RANKING_H
 
+#include <memory>
 #include <mutex>
 #include "bmi.h"
+#include "subset_scorer.h"
 
 class BMI_reduced_ranking:public BMI {
     protected:
-    Dataset *subset;
-    vector<int> indices;
+    // Top documents of the last full rescore, rescored alone until the next refresh
+    std::unique_ptr<SubsetScorer> subset;
     size_t subset_size;
     size_t refresh_period;
 
@@ -16,12 +18,6 @@ class BMI_reduced_ranking:public BMI {
         return (state.cur_iteration % refresh_period == 0);
     }
 
-    void score_docs_insertion_sort(const vector<float> &weights,
-                               int st, int end,
-                               std::pair<float, int> *top_docs);
-
-    vector<int> subset_rescore(const vector<float> &weights);
-
     public:
     BMI_reduced_ranking(Seed seed,
         Dataset *documents,
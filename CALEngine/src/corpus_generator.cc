@@ -0,0 +1,82 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+#include "utils/synthetic_corpus.h"
+#include "utils/utils.h"
+#include "utils/simple-cmd-line-helper.h"
+
+using namespace std;
+
+// Writes the features of a synthetic corpus with one planted topic, along with
+// its qrels and seed query, for running bmi_cli on collections of any size
+int main(int argc, char **argv){
+    AddFlag("--out", "Output document feature file", string(""));
+    AddFlag("--para-out", "Output paragraph feature file", string(""));
+    AddFlag("--qrel-out", "Output qrel file of the relevant documents", string(""));
+    AddFlag("--query-out", "Output seed query file", string(""));
+    AddFlag("--topic", "Topic id used in the qrel and query files", string("1"));
+    AddFlag("--docs", "Number of documents", int(100000));
+    AddFlag("--vocabulary", "Number of distinct terms", int(200000));
+    AddFlag("--doc-length", "Mean number of tokens per document", int(300));
+    AddFlag("--paragraphs", "Mean number of paragraphs per document", int(4));
+    AddFlag("--zipf", "Exponent of the Zipf distribution of term frequencies", float(1.0));
+    AddFlag("--relevant-rate", "Fraction of documents which are relevant to the topic", float(0.001));
+    AddFlag("--topic-terms", "Number of terms describing the topic", int(20));
+    AddFlag("--topic-weight", "Fraction of the tokens of a relevant document drawn from the topic terms", float(0.05));
+    AddFlag("--query-terms", "Number of topic terms in the seed query", int(5));
+    AddFlag("--seed", "Random seed", int(0));
+    AddFlag("--threads", "Number of threads used to generate features", int(1));
+    AddFlag("--help", "Show Help", bool(false));
+
+    ParseFlags(argc, argv);
+
+    if(CMD_LINE_BOOLS["--help"]){
+        ShowHelp();
+        return 0;
+    }
+
+    if(CMD_LINE_STRINGS["--out"].length() == 0)
+        fail("--out missing", 1);
+    if(CMD_LINE_INTS["--docs"] <= 0 || CMD_LINE_INTS["--vocabulary"] <= 0 || CMD_LINE_INTS["--doc-length"] <= 0)
+        fail("--docs, --vocabulary and --doc-length should be positive", 1);
+
+    SyntheticCorpusOptions options;
+    options.num_docs = CMD_LINE_INTS["--docs"];
+    options.vocabulary_size = CMD_LINE_INTS["--vocabulary"];
+    options.mean_doc_length = CMD_LINE_INTS["--doc-length"];
+    options.mean_paragraphs = max(CMD_LINE_INTS["--paragraphs"], 1);
+    options.zipf_exponent = CMD_LINE_FLOATS["--zipf"];
+    options.relevant_rate = CMD_LINE_FLOATS["--relevant-rate"];
+    options.num_topic_terms = max(CMD_LINE_INTS["--topic-terms"], 0);
+    options.topic_weight = CMD_LINE_FLOATS["--topic-weight"];
+    options.seed = CMD_LINE_INTS["--seed"];
+    SyntheticCorpus corpus(options);
+    const string &topic = CMD_LINE_STRINGS["--topic"];
+
+    cerr<<"Writing features of "<<options.num_docs<<" documents"<<endl;
+    corpus.write_features(CMD_LINE_STRINGS["--out"], CMD_LINE_STRINGS["--para-out"], CMD_LINE_INTS["--threads"]);
+
+    // Only relevant documents are listed, everything else is judged non-relevant.
+    // bmi_cli judges paragraphs by their parent document, so these serve BMI_PARA too.
+    if(CMD_LINE_STRINGS["--qrel-out"].length() > 0){
+        ofstream qrel_file(CMD_LINE_STRINGS["--qrel-out"]);
+        size_t num_relevant = 0;
+        for(size_t d = 0; d < options.num_docs; d++){
+            if(!corpus.is_relevant(d))
+                continue;
+            num_relevant++;
+            qrel_file<<topic<<" 0 "<<corpus.get_doc_id(d)<<" 1\n";
+        }
+        cerr<<num_relevant<<" relevant documents"<<endl;
+    }
+
+    if(CMD_LINE_STRINGS["--query-out"].length() > 0){
+        const vector<uint32_t> &topic_terms = corpus.get_topic_terms();
+        ofstream query_file(CMD_LINE_STRINGS["--query-out"]);
+        query_file<<topic<<" 1";
+        for(size_t i = 0; i < min((size_t)max(CMD_LINE_INTS["--query-terms"], 1), topic_terms.size()); i++)
+            query_file<<" "<<corpus.get_term(topic_terms[i]);
+        query_file<<endl;
+    }
+}
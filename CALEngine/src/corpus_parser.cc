@@ -167,9 +167,9 @@ int main(int argc, char **argv){
         double sum = 0;
         for(auto &f: spv->features_){
             if(f.id_ != 0){
-                f.id_ = new_ids[f.id_-1] + 1;
-                if(f.id_ - 1 < dictionary.size() && dictionary[f.id_-1].second > 1){
-                    features.push_back({f.id_, (float) ((1 + log(f.value_)) * idf[f.id_])});
+                uint32_t id = new_ids[f.id_-1] + 1;
+                if(id - 1 < dictionary.size() && dictionary[id-1].second > 1){
+                    features.push_back({id, (float) ((1 + log(f.value_)) * idf[id])});
                     sum += features.back().value_ * features.back().value_;
                 }
             }
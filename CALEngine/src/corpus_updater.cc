@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <cmath>
+#include "corpus_updater.h"
+#include "features.h"
+#include "utils/text_utils.h"
+#include "utils/utils.h"
+
+using namespace std;
+
+metrics::Counter &CorpusUpdater::documents_added = metrics::counter("cal_documents_added_total",
+        "Number of documents added to the corpus while serving it");
+metrics::Histogram &CorpusUpdater::merge_time = metrics::histogram("cal_corpus_merge_seconds",
+        "Time to merge added documents into a new corpus");
+
+// Appends `spv` to `parsed` as FeatureParser::parse_all() would
+static void append_parsed(ParsedFeatures &parsed, const SfSparseVector &spv){
+    for(auto &feature: spv.features_)
+        parsed.dimensionality = max(parsed.dimensionality, feature.id_ + 1);
+    parsed.features.insert(parsed.features.end(), spv.features_.begin(), spv.features_.end());
+    parsed.doc_offsets.push_back(parsed.features.size());
+    parsed.squared_norms.push_back(spv.GetSquaredNorm());
+    parsed.doc_ids.push_back(spv.doc_id);
+}
+
+CorpusUpdater::CorpusUpdater(const Corpus &corpus, bool _numa, PublishCallback _on_publish):
+    on_publish(_on_publish), numa(_numa)
+{
+    reset(corpus);
+}
+
+void CorpusUpdater::reset(const Corpus &_corpus){
+    corpus = _corpus;
+    const FeatureStore &store = corpus.documents->get_store();
+    next_term_id = max((size_t)store.get_dimensionality(), store.num_idf());
+    df_increments.clear();
+    new_terms.clear();
+    pending_documents = ParsedFeatures();
+    pending_paragraphs = ParsedFeatures();
+    pending_ids.clear();
+}
+
+CorpusUpdater::~CorpusUpdater(){
+    {
+        lock_guard<mutex> lock(update_mutex);
+        stopping = true;
+    }
+    stop_condition.notify_all();
+    if(merge_thread.joinable())
+        merge_thread.join();
+}
+
+TermInfo CorpusUpdater::find_term(const string &term) const {
+    const TermInfo *term_info = corpus.documents->get_dictionary().find(term);
+    if(term_info != nullptr){
+        auto it = df_increments.find(term_info->id);
+        return {term_info->id, term_info->df + (it != df_increments.end() ? it->second : 0)};
+    }
+    auto it = new_terms.find(term);
+    return it != new_terms.end() ? it->second : TermInfo{0, 0};
+}
+
+TermInfo CorpusUpdater::add_term(const string &term){
+    const TermInfo *term_info = corpus.documents->get_dictionary().find(term);
+    if(term_info != nullptr)
+        return {term_info->id, term_info->df + ++df_increments[term_info->id]};
+
+    TermInfo &new_term = new_terms[term];
+    if(++new_term.df == 2)
+        new_term.id = next_term_id++;
+    return new_term;
+}
+
+bool CorpusUpdater::add_document(const string &doc_id, const string &text, const vector<string> &paragraphs){
+    lock_guard<mutex> lock(update_mutex);
+    if(doc_id.empty() || (corpus.paragraphs != nullptr && doc_id.find('.') != string::npos))
+        return false;
+    if(corpus.documents->get_index(doc_id) != corpus.documents->NPOS || pending_ids.count(doc_id) > 0)
+        return false;
+
+    // Document features are (1 + log tf) idf, normalized to unit length
+    size_t num_docs = corpus.documents->size() + pending_ids.size() + 1;
+    vector<FeatureValuePair> features;
+    double sum = 0;
+    for(auto &term: features::get_tf(BMITokenizer().tokenize(text))){
+        TermInfo term_info = add_term(term.first);
+        if(term_info.id == 0)
+            continue;
+        features.push_back({(uint32_t)term_info.id, (float)((1 + log(term.second)) * log(num_docs / (float)term_info.df))});
+        sum += features.back().value_ * features.back().value_;
+    }
+    sum = sqrt(sum);
+    for(auto &feature: features)
+        feature.value_ = sum > 0 ? feature.value_ / sum : 0;
+    sort(features.begin(), features.end(), [](auto &a, auto &b) -> bool { return a.id_ < b.id_; });
+    append_parsed(pending_documents, SfSparseVector(doc_id, features));
+    pending_ids.insert(doc_id);
+
+    // Paragraph features are tf idf, normalized to a length of at most one
+    if(corpus.paragraphs != nullptr){
+        const vector<string> &texts = paragraphs.empty() ? vector<string>{text} : paragraphs;
+        for(size_t i = 0; i < texts.size(); i++){
+            vector<FeatureValuePair> features;
+            double sum = 0;
+            for(auto &term: features::get_tf(BMITokenizer().tokenize(texts[i]))){
+                TermInfo term_info = find_term(term.first);
+                if(term_info.id == 0)
+                    continue;
+                features.push_back({(uint32_t)term_info.id, (float)(term.second * log(num_docs / (float)term_info.df))});
+                sum += features.back().value_ * features.back().value_;
+            }
+            sum = max(20.0, sqrt(sum));
+            for(auto &feature: features)
+                feature.value_ /= sum;
+            sort(features.begin(), features.end(), [](auto &a, auto &b) -> bool { return a.id_ < b.id_; });
+            append_parsed(pending_paragraphs, SfSparseVector(doc_id + "." + to_string(i), features));
+        }
+    }
+    documents_added.add();
+    return true;
+}
+
+bool CorpusUpdater::merge(){
+    lock_guard<mutex> lock_merge(merge_mutex);
+    Corpus merged;
+    {
+        lock_guard<mutex> lock(update_mutex);
+        if(pending_ids.empty())
+            return false;
+        TIMER_BEGIN(corpus_merge);
+
+        const Dictionary &dictionary = corpus.documents->get_dictionary();
+        vector<pair<string, TermInfo>> merged_dictionary;
+        merged_dictionary.reserve(dictionary.size() + new_terms.size());
+        for(size_t i = 0; i < dictionary.size(); i++){
+            TermInfo term_info = dictionary.get_term_info(i);
+            auto it = df_increments.find(term_info.id);
+            if(it != df_increments.end())
+                term_info.df += it->second;
+            merged_dictionary.push_back({dictionary.get_term(i), term_info});
+        }
+        for(auto it = new_terms.begin(); it != new_terms.end();){
+            if(it->second.id == 0){
+                it++;
+                continue;
+            }
+            merged_dictionary.push_back(*it);
+            it = new_terms.erase(it);
+        }
+
+        pending_documents.doc_ids.build();
+        merged.documents = corpus.documents->append(pending_documents, merged_dictionary);
+        if(corpus.paragraphs != nullptr){
+            pending_paragraphs.doc_ids.build();
+            // Paragraph files carry the dictionary only if the document file does
+            merged.paragraphs = corpus.paragraphs->append(pending_paragraphs,
+                corpus.paragraphs->get_dictionary().size() > 0 ? merged_dictionary : vector<pair<string, TermInfo>>(),
+                *merged.documents);
+        }
+        merged.generation = corpus.generation;
+        if(numa){
+            merged.documents->place_on_nodes();
+            if(merged.paragraphs != nullptr)
+                merged.paragraphs->place_on_nodes();
+        }
+
+        logging::info("Merged " + to_string(pending_ids.size()) + " added documents into a corpus of " +
+                      to_string(merged.documents->size()));
+        retired = corpus;
+        corpus = merged;
+        df_increments.clear();
+        pending_documents = ParsedFeatures();
+        pending_paragraphs = ParsedFeatures();
+        pending_ids.clear();
+        TIMER_END_OBSERVE(corpus_merge, merge_time);
+    }
+    if(on_publish)
+        on_publish(merged);
+    return true;
+}
+
+Corpus CorpusUpdater::reload(Corpus reloaded){
+    lock_guard<mutex> lock_merge(merge_mutex);
+    lock_guard<mutex> lock(update_mutex);
+    if(!pending_ids.empty())
+        logging::warning("Dropped " + to_string(pending_ids.size()) + " added documents not merged before the reload");
+    reloaded.generation = corpus.generation + 1;
+    // Sessions hold the corpora they use, nothing else needs the previous ones
+    retired = Corpus();
+    reset(reloaded);
+    return reloaded;
+}
+
+void CorpusUpdater::start_background_merges(chrono::seconds interval){
+    merge_thread = thread([this, interval](){
+        unique_lock<mutex> lock(update_mutex);
+        while(!stop_condition.wait_for(lock, interval, [this]() -> bool { return stopping; })){
+            lock.unlock();
+            merge();
+            lock.lock();
+        }
+    });
+}
+
+Corpus CorpusUpdater::get_corpus(){
+    lock_guard<mutex> lock(update_mutex);
+    return corpus;
+}
+
+size_t CorpusUpdater::num_pending(){
+    lock_guard<mutex> lock(update_mutex);
+    return pending_ids.size();
+}
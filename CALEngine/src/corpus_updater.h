@@ -0,0 +1,112 @@
+#ifndef CORPUS_UPDATER_H
+#define CORPUS_UPDATER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "dataset.h"
+#include "utils/metrics.h"
+
+/*
+ * Adds documents to a corpus while it is being served.
+ *
+ * Documents are added as text and featurized the way corpus_parser does,
+ * with the document frequencies of the corpus plus those of every document
+ * added since it was parsed. They collect in a delta which is merged into a
+ * new corpus on demand or periodically on a background thread. The datasets
+ * are scanned as one contiguous image, so merging copies the current corpus
+ * and appends the delta to it rather than serving the delta separately.
+ *
+ * Added documents and their paragraphs come after the existing ones, so
+ * indices into the current corpus stay valid in the new one and sessions can
+ * move onto it as they are, which the publish callback is expected to do.
+ * Features of documents already in the corpus are not reweighted for the new
+ * document frequencies; the idf of query terms is. Merged corpora keep the
+ * generation of the corpus they extend.
+ *
+ * A corpus loaded anew replaces the current one with reload(), starting the
+ * next generation. Its indices are unrelated to the previous generation's, so
+ * sessions either stay on the corpus they hold or are rebuilt on the new one.
+ */
+class CorpusUpdater {
+    public:
+    // Called with every new corpus right after it is published
+    typedef std::function<void(const Corpus &)> PublishCallback;
+
+    private:
+    PublishCallback on_publish;
+    bool numa;
+
+    // Held for the whole of a merge, so corpora are published in order
+    std::mutex merge_mutex;
+
+    // Guards everything below
+    std::mutex update_mutex;
+    Corpus corpus;
+    // The previous corpus, kept until the next merge for requests which were
+    // still reading it while their sessions moved onto the current one
+    Corpus retired;
+
+    // Added documents per term id of the dictionary of `corpus`
+    std::unordered_map<uint32_t, int> df_increments;
+    // Terms not in the dictionary of `corpus`. Like corpus_parser, only terms
+    // in at least two documents get an id and enter the dictionary.
+    std::unordered_map<std::string, TermInfo> new_terms;
+    uint32_t next_term_id;
+
+    ParsedFeatures pending_documents, pending_paragraphs;
+    std::unordered_set<std::string> pending_ids;
+
+    std::thread merge_thread;
+    std::condition_variable stop_condition;
+    bool stopping = false;
+
+    static metrics::Counter &documents_added;
+    static metrics::Histogram &merge_time;
+
+    // Counts a document containing `term` and returns the term's id and
+    // document frequency, with an id of 0 if it is not in the dictionary yet
+    TermInfo add_term(const std::string &term);
+
+    // Id and document frequency of `term`, with an id of 0 if it is not in the dictionary yet
+    TermInfo find_term(const std::string &term) const;
+
+    // Makes `corpus` current with an empty delta
+    void reset(const Corpus &corpus);
+
+    public:
+    // Places every new corpus on the NUMA nodes before publishing it if `numa` is set
+    CorpusUpdater(const Corpus &corpus, bool numa, PublishCallback on_publish);
+    ~CorpusUpdater();
+
+    // Adds the document `doc_id` with its paragraphs to the delta. When paragraphs are served,
+    // a document without any has its whole text as its only paragraph. Returns false if the
+    // id is empty, already taken or, when paragraphs are served, contains a '.'
+    bool add_document(const std::string &doc_id, const std::string &text,
+                      const std::vector<std::string> &paragraphs);
+
+    // Merges the delta into a new corpus and publishes it. Returns false if the delta is empty
+    bool merge();
+
+    // Replaces the corpus with `corpus`, in the generation after the current one, and
+    // returns it. Documents added since the last merge are dropped. The callback is not
+    // called, as sessions cannot move onto another generation.
+    Corpus reload(Corpus corpus);
+
+    // Merges every `interval` on a background thread, until destruction
+    void start_background_merges(std::chrono::seconds interval);
+
+    Corpus get_corpus();
+
+    // Number of documents waiting for the next merge
+    size_t num_pending();
+};
+
+#endif // CORPUS_UPDATER_H
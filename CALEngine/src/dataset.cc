@@ -1,26 +1,49 @@
 #include <thread>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 #include "dataset.h"
+#include "utils/feature_codec.h"
+#include "utils/select.h"
 #include "utils/utils.h"
 
 using namespace std;
 
-typedef unique_ptr<vector<unique_ptr<SfSparseVector>>> SparseVectors;
+// Smallest number of top documents to select from an array of all the scores instead of a heap
+static const int SELECT_MIN_TOP_DOCS = 1000;
 
-unordered_map<string, size_t> generate_inverted_index(const SparseVectors &sparse_vectors) {
-    unordered_map<string, size_t> inverted_index;
-    for(size_t i = 0; i < sparse_vectors->size(); i++){
-        inverted_index[sparse_vectors->at(i)->doc_id] = i;
-    }
-    return inverted_index;
-}
+// Largest fraction of the scan units rescore_cached() rescores before rescoring all of them
+static const double CACHED_RESCORE_MAX_FRACTION = 0.25;
+
+// Same for rescore_retrieved()
+static const double RETRIEVED_RESCORE_MAX_FRACTION = 0.125;
+
+// Smallest number of top documents by which rescore_retrieved() judges its candidates
+static const int RETRIEVED_RESCORE_MIN_CHECKED = 100;
 
-vector<int> generate_parent_documents(const Dataset &parent_dataset, const SparseVectors &sparse_vectors){
-    vector<int> parent_documents(sparse_vectors->size());
+metrics::Counter &Dataset::documents_scanned = metrics::counter("cal_documents_scanned_total",
+        "Number of documents and paragraphs scored");
+metrics::Counter &Dataset::cached_rescores = metrics::counter("cal_cached_rescores_total",
+        "Number of rescores which only scored the documents possibly moved into the top documents since the previous scores");
+metrics::Counter &Dataset::retrieved_rescores = metrics::counter("cal_retrieved_rescores_total",
+        "Number of rescores which only scored the documents estimated highest from a term index");
+
+static vector<int> generate_parent_documents(const Dataset &parent_dataset, const DocIdIndex &para_ids){
+    vector<int> parent_documents(para_ids.size());
     for(int i = 0; i < parent_documents.size(); i++){
-        auto &para_id = sparse_vectors->at(i)->doc_id;
-        string doc_id = para_id.substr(0, para_id.find("."));
-        parent_documents[i] = parent_dataset.get_index(doc_id);
-        
+        const char *para_id = para_ids.data(i);
+        const char *sep = (const char *)memchr(para_id, '.', para_ids.length(i));
+        uint32_t parent = parent_dataset.get_index(para_id, sep ? sep - para_id : para_ids.length(i));
+
+        if(parent == parent_dataset.NPOS){
+            fail("Parent document of paragraph " + para_ids.get(i) + " not found", -1);
+        }
+        parent_documents[i] = parent;
         if(i > 0 && parent_documents[i] < parent_documents[i-1]){
             fail("Paragraphs must be in increasing order of their parent document ids", -1);
         }
@@ -28,63 +51,185 @@ vector<int> generate_parent_documents(const Dataset &parent_dataset, const Spars
     return parent_documents;
 }
 
-uint32_t compute_dimensionality(const SparseVectors &sparse_vectors) {
-    uint32_t dimensionality = 0;
-    for (auto &spv : *sparse_vectors) {
-        for(auto feature: spv->features_)
-            dimensionality = max(dimensionality, feature.id_);
+static vector<uint32_t> generate_paragraph_offsets(const Dataset &parent_dataset, const vector<int> &parent_documents){
+    vector<uint32_t> paragraph_offsets(parent_dataset.size() + 1, 0);
+    for(int parent: parent_documents)
+        paragraph_offsets[parent + 1]++;
+    for(size_t i = 0; i < parent_dataset.size(); i++)
+        paragraph_offsets[i + 1] += paragraph_offsets[i];
+    return paragraph_offsets;
+}
+
+// Concatenates the documents of `store` and `delta`
+static ParsedFeatures concatenate(const FeatureStore &store, const ParsedFeatures &delta){
+    size_t num_docs = store.size(), num_delta = delta.squared_norms.size();
+    const uint64_t *doc_offsets = store.get_doc_offsets();
+    uint64_t num_features = doc_offsets[num_docs];
+
+    ParsedFeatures parsed;
+    parsed.doc_offsets.assign(doc_offsets, doc_offsets + num_docs + 1);
+    for(size_t i = 1; i <= num_delta; i++)
+        parsed.doc_offsets.push_back(num_features + delta.doc_offsets[i]);
+    parsed.features.reserve(num_features + delta.features.size());
+    if(store.is_compressed()){
+        parsed.features.resize(num_features);
+        for(size_t i = 0; i < num_docs; i++)
+            feature_codec::decode(store.get_compressed_features() + store.get_compressed_offsets()[i],
+                                  doc_offsets[i + 1] - doc_offsets[i], parsed.features.data() + doc_offsets[i]);
+    }else{
+        parsed.features.assign(store.get_features(), store.get_features() + num_features);
     }
-    return 1 + dimensionality;
+    parsed.features.insert(parsed.features.end(), delta.features.begin(), delta.features.end());
+    parsed.squared_norms.assign(store.get_squared_norms(), store.get_squared_norms() + num_docs);
+    parsed.squared_norms.insert(parsed.squared_norms.end(), delta.squared_norms.begin(), delta.squared_norms.end());
+
+    DocIdIndex doc_ids = store.get_doc_ids();
+    parsed.doc_ids.reserve(num_docs + num_delta, doc_ids.get_view().offsets[num_docs] + delta.doc_ids.get_view().offsets[num_delta]);
+    for(size_t i = 0; i < num_docs; i++)
+        parsed.doc_ids.push_back(doc_ids.data(i), doc_ids.length(i));
+    for(size_t i = 0; i < num_delta; i++)
+        parsed.doc_ids.push_back(delta.doc_ids.data(i), delta.doc_ids.length(i));
+    parsed.doc_ids.build();
+    parsed.dimensionality = max(store.get_dimensionality(), delta.dimensionality);
+    return parsed;
 }
 
-Dataset::Dataset(SparseVectors sparse_vectors, std::unordered_map<std::string, TermInfo> _dictionary):
-dictionary(_dictionary),
-dimensionality(compute_dimensionality(sparse_vectors)),
-doc_ids_inv_map(generate_inverted_index(sparse_vectors)),
-NPOS(sparse_vectors->size())
+Dataset::Dataset(unique_ptr<FeatureStore> _store):
+store(move(_store)),
+doc_offsets(store->get_doc_offsets()),
+features(store->is_compressed() ? nullptr : store->get_features()),
+compressed_features(store->is_compressed() ? store->get_compressed_features() : nullptr),
+compressed_offsets(store->is_compressed() ? store->get_compressed_offsets() : nullptr),
+squared_norms(store->get_squared_norms()),
+dictionary(store->get_dictionary()),
+dimensionality(store->get_dimensionality()),
+doc_ids(store->get_doc_ids()),
+NPOS(store->size())
 {
-    doc_features = move(sparse_vectors);
+}
+
+unique_ptr<Dataset> Dataset::build(FeatureParser *feature_parser, const string &segment, uint64_t fingerprint,
+                                   int num_threads, bool compress){
+    ParsedFeatures parsed = feature_parser->parse_all(num_threads);
+
+    FeatureStore::Contents contents;
+    contents.parsed = &parsed;
+    contents.dictionary = &feature_parser->get_dictionary();
+    contents.compress = compress;
+    return make_unique<Dataset>(FeatureStore::build(contents, fingerprint, segment));
+}
+
+unique_ptr<Dataset> Dataset::load(const string &path){
+    auto store = FeatureStore::load(path);
+    if(store == nullptr)
+        return nullptr;
+    return make_unique<Dataset>(move(store));
+}
+
+unique_ptr<Dataset> Dataset::append(const ParsedFeatures &delta, const vector<pair<string, TermInfo>> &dictionary) const {
+    ParsedFeatures parsed = concatenate(*store, delta);
+    FeatureStore::Contents contents;
+    contents.parsed = &parsed;
+    contents.dictionary = &dictionary;
+    contents.compress = store->is_compressed();
+    auto appended = make_unique<Dataset>(FeatureStore::build(contents, 0));
+    if(term_index != nullptr)
+        appended->build_term_index(term_index->get_num_terms());
+    return appended;
+}
+
+unique_ptr<Dataset> Dataset::attach_or_build(const string &segment,
+                                             const vector<string> &source_files,
+                                             const FeatureParserFactory &make_parser,
+                                             int num_threads, bool compress){
+    if(FeatureStore::is_container(source_files[0]))
+        return load(source_files[0]);
+    uint64_t fingerprint = FeatureStore::fingerprint(source_files);
+    if(!segment.empty()){
+        auto store = FeatureStore::attach(segment, fingerprint, compress);
+        if(store != nullptr){
+            cerr<<"Attached to segment "<<segment<<endl;
+            return make_unique<Dataset>(move(store));
+        }
+        cerr<<"Building segment "<<segment<<endl;
+    }
+    return build(make_parser().get(), segment, fingerprint, num_threads, compress);
+}
+
+SfSparseVector Dataset::get_sf_sparse_vector(size_t index) const {
+    size_t num_features = doc_offsets[index + 1] - doc_offsets[index];
+    if(compressed_features != nullptr){
+        vector<FeatureValuePair> decoded(num_features);
+        feature_codec::decode(compressed_features + compressed_offsets[index], num_features, decoded.data());
+        return SfSparseVector(move(decoded), squared_norms[index]);
+    }
+    return SfSparseVector(features + doc_offsets[index], num_features, squared_norms[index]);
 }
 
 float Dataset::inner_product(size_t index, const vector<float> &weights) const {
-    auto &features = get_sf_sparse_vector(index).features_;
+    if(compressed_features != nullptr)
+        return feature_codec::inner_product(compressed_features + compressed_offsets[index],
+                                            doc_offsets[index + 1] - doc_offsets[index], weights.data());
     float score = 0;
-    for(auto &feature: features){
-        score += weights[feature.id_] * feature.value_;
+    for(uint64_t i = doc_offsets[index]; i < doc_offsets[index + 1]; i++){
+        score += weights[features[i].id_] * features[i].value_;
     }
     return score;
 }
 
+// Pushes the buffered {-score, index} candidates into the shared top_docs heap
+static void merge_top_docs(const pair<float, int> *buffer, int buffer_size,
+                           priority_queue<pair<float, int>> &top_docs,
+                           mutex &top_docs_mutex,
+                           int num_top_docs) {
+    lock_guard<mutex> lock(top_docs_mutex);
+    for(int j = 0;j < buffer_size; j++){
+        if(top_docs.size() < num_top_docs)
+            top_docs.push(buffer[j]);
+        else if(-buffer[j].first > -top_docs.top().first){
+            top_docs.pop();
+            top_docs.push(buffer[j]);
+        }
+    }
+}
+
+// Returns the indices in top_docs, in increasing order of their score
+static vector<int> drain_top_docs(priority_queue<pair<float, int>> &top_docs) {
+    vector<int> top_docs_list(top_docs.size());
+    int idx = 0;
+    while(!top_docs.empty()){
+        top_docs_list[idx++] = (top_docs.top().second);
+        top_docs.pop();
+    }
+    return top_docs_list;
+}
+
 void Dataset::score_docs_priority_queue(const vector<float> &weights,
                                        int st, int end,
                                        priority_queue<pair<float, int>> &top_docs,
                                        mutex &top_docs_mutex,
                                        int num_top_docs,
-                                       const map<int, int> &judgments) {
-    auto iterator = judgments.lower_bound(translate_index(st));
+                                       const AtomicBitset &judged) {
     pair<float, int> buffer[1000];
     int buffer_idx = 0;
     for(int i = st;i<end; i++){
-        while(iterator != judgments.end() && iterator->first < translate_index(i))
-            iterator++;
-        if(!(iterator != judgments.end() && iterator->first == translate_index(i))){
+        // Skip a whole word of judged documents at once
+        if((i & 63) == 0 && judged.word(i >> 6) == AtomicBitset::FULL_WORD){
+            i += 63;
+            continue;
+        }
+
+        if(!judged.test(i)){
             float score = this->inner_product(i, weights);
             buffer[buffer_idx++] = {-score, i};
         }
 
-        if(buffer_idx == 1000 || i == end - 1){
-            lock_guard<mutex> lock(top_docs_mutex);
-            for(int j = 0;j < buffer_idx; j++){
-                if(top_docs.size() < num_top_docs)
-                    top_docs.push(buffer[j]);
-                else if(-buffer[j].first > -top_docs.top().first){
-                    top_docs.pop();
-                    top_docs.push(buffer[j]);
-                }
-            }
+        if(buffer_idx == 1000){
+            merge_top_docs(buffer, buffer_idx, top_docs, top_docs_mutex, num_top_docs);
             buffer_idx = 0;
         }
     }
+    merge_top_docs(buffer, buffer_idx, top_docs, top_docs_mutex, num_top_docs);
 }
 
 void ParagraphDataset::score_docs_priority_queue(const vector<float> &weights,
@@ -92,115 +237,658 @@ void ParagraphDataset::score_docs_priority_queue(const vector<float> &weights,
                                                 priority_queue<pair<float, int>> &top_docs,
                                                 mutex &top_docs_mutex,
                                                 int num_top_docs,
-                                                const map<int, int> &judgments) {
-    auto iterator = judgments.lower_bound(translate_index(st));
+                                                const AtomicBitset &judged) {
     pair<float, int> buffer[1000];
     int buffer_idx = 0;
-    for(int i = st;i<end; i++){
-        while(iterator != judgments.end() && iterator->first < translate_index(i))
-            iterator++;
-        if(!(iterator != judgments.end() && iterator->first == translate_index(i))){
-            float score = this->inner_product(i, weights);
+    for(int doc = st; doc < end; doc++){
+        // Skip the paragraphs of a whole word of judged documents at once
+        if((doc & 63) == 0 && judged.word(doc >> 6) == AtomicBitset::FULL_WORD){
+            doc += 63;
+            continue;
+        }
 
-            if(i == st || translate_index(i) != translate_index(i-1))
-                buffer[buffer_idx] = {-score, i};
-            else
-                buffer[buffer_idx] = min(buffer[buffer_idx], {-score, i});
-            
-            if(i == end - 1 || translate_index(i) != translate_index(i+1))
-                buffer_idx++;
-        }
-
-        if(buffer_idx == 1000 || i == end - 1){
-            lock_guard<mutex> lock(top_docs_mutex);
-            for(int j = 0;j < buffer_idx; j++){
-                if(top_docs.size() < num_top_docs)
-                    top_docs.push(buffer[j]);
-                else if(-buffer[j].first > -top_docs.top().first){
-                    top_docs.pop();
-                    top_docs.push(buffer[j]);
-                }
-            }
+        if(paragraph_offsets[doc] == paragraph_offsets[doc + 1] || judged.test(doc))
+            continue;
+
+        buffer[buffer_idx++] = score_best_paragraph(doc, weights);
+
+        if(buffer_idx == 1000){
+            merge_top_docs(buffer, buffer_idx, top_docs, top_docs_mutex, num_top_docs);
             buffer_idx = 0;
         }
     }
+    merge_top_docs(buffer, buffer_idx, top_docs, top_docs_mutex, num_top_docs);
 }
 
-vector<int> Dataset::rescore(const vector<float> &weights, int num_threads, int num_top_docs, const map<int, int> &judgments) {
+void Dataset::score_docs_array(const vector<float> &weights,
+                               size_t st, size_t end,
+                               float *scores, int *results,
+                               const AtomicBitset &judged) {
+    for(size_t i = st; i < end; i++){
+        results[i] = i;
+        scores[i] = judged.test(i) ? -INFINITY : this->inner_product(i, weights);
+    }
+}
+
+void ParagraphDataset::score_docs_array(const vector<float> &weights,
+                                        size_t st, size_t end,
+                                        float *scores, int *results,
+                                        const AtomicBitset &judged) {
+    for(size_t doc = st; doc < end; doc++){
+        if(paragraph_offsets[doc] == paragraph_offsets[doc + 1] || judged.test(doc)){
+            scores[doc] = -INFINITY;
+            continue;
+        }
+        pair<float, int> best = score_best_paragraph(doc, weights);
+        scores[doc] = -best.first;
+        results[doc] = best.second;
+    }
+}
+
+// Each document is represented by its best paragraph. The paragraphs of a document are
+// contiguous in `features`, so the block is scored in one pass without a virtual call per
+// paragraph, and the best is kept with conditional moves instead of a branch per paragraph
+pair<float, int> ParagraphDataset::score_best_paragraph(size_t doc_idx, const vector<float> &weights) const {
+    const float *w = weights.data();
+    uint32_t para_st = paragraph_offsets[doc_idx], para_end = paragraph_offsets[doc_idx + 1];
+    float best_score = -INFINITY;
+    uint32_t best = para_st;
+    uint64_t k = doc_offsets[para_st];
+    for(uint32_t para = para_st; para < para_end; para++){
+        // Summed in the same order as inner_product()
+        float score = 0;
+        if(compressed_features != nullptr)
+            score = feature_codec::inner_product(compressed_features + compressed_offsets[para],
+                                                 doc_offsets[para + 1] - doc_offsets[para], w);
+        else
+            for(uint64_t end = doc_offsets[para + 1]; k < end; k++)
+                score += w[features[k].id_] * features[k].value_;
+
+        // Ties go to the first paragraph, like min() over {-score, index}
+        bool better = score > best_score;
+        best_score = better ? score : best_score;
+        best = better ? para : best;
+    }
+    return {-best_score, (int)best};
+}
+
+void ParagraphDataset::score_candidates_priority_queue(const vector<float> &weights,
+                                                      const vector<int> &candidates,
+                                                      int st, int end,
+                                                      priority_queue<pair<float, int>> &top_docs,
+                                                      mutex &top_docs_mutex,
+                                                      int num_top_docs,
+                                                      const tracing::Context &context) {
+    tracing::ScopedContext scoped_context(context);
+    tracing::Span span("scan");
+    pair<float, int> buffer[1000];
+    int buffer_idx = 0;
+    uint64_t num_scanned = 0;
+    for(int i = st; i < end; i++){
+        int doc = candidates[i];
+        if(paragraph_offsets[doc] == paragraph_offsets[doc + 1])
+            continue;
+        num_scanned += paragraph_offsets[doc + 1] - paragraph_offsets[doc];
+
+        buffer[buffer_idx++] = score_best_paragraph(doc, weights);
+
+        if(buffer_idx == 1000){
+            merge_top_docs(buffer, buffer_idx, top_docs, top_docs_mutex, num_top_docs);
+            buffer_idx = 0;
+        }
+    }
+    merge_top_docs(buffer, buffer_idx, top_docs, top_docs_mutex, num_top_docs);
+    documents_scanned.add(num_scanned);
+}
+
+size_t Dataset::find_scan_unit(uint64_t offset) const {
+    size_t lo = 0, hi = num_scan_units();
+    while(lo < hi){
+        size_t mid = lo + (hi - lo) / 2;
+        if(get_scan_unit_offset(mid) < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void Dataset::place_on_nodes() {
+    int num_nodes = numa::num_nodes();
+    size_t num_units = num_scan_units();
+    uint64_t num_features = get_scan_unit_offset(num_units);
+
+    // Balance the partitions by the number of features
+    node_boundaries = {0};
+    for(int k = 1; k < num_nodes; k++)
+        node_boundaries.push_back(find_scan_unit(k * num_features / num_nodes));
+    node_boundaries.push_back(num_units);
+
+    // Everything but the features is shared by all the nodes
+    const MemoryRegion &region = store->get_region();
+    bool placed = numa::interleave(region.data(), region.size());
+    for(int k = 0; k < num_nodes; k++){
+        size_t first = get_scan_unit_document(node_boundaries[k]), last = get_scan_unit_document(node_boundaries[k + 1]);
+        if(compressed_features != nullptr)
+            placed &= numa::bind(compressed_features + compressed_offsets[first],
+                                 compressed_offsets[last] - compressed_offsets[first], k);
+        else
+            placed &= numa::bind(features + doc_offsets[first], (doc_offsets[last] - doc_offsets[first]) * sizeof(FeatureValuePair), k);
+    }
+    if(!placed)
+        cerr<<"Failed to place some of the features on their NUMA node"<<endl;
+    cerr<<"Partitioned features across "<<num_nodes<<" NUMA nodes"<<endl;
+}
+
+// Copies of `weights` whose pages are first touched, and so allocated, on each node
+static vector<vector<float>> replicate_weights(const vector<float> &weights, int num_nodes) {
+    vector<vector<float>> replicas(num_nodes);
+    vector<thread> t;
+    for(int k = 0; k < num_nodes; k++){
+        t.push_back(thread([&replicas, &weights, k](){
+            numa::run_on_node(k);
+            replicas[k] = weights;
+        }));
+    }
+    for(thread &x: t) x.join();
+    return replicas;
+}
+
+void Dataset::parallel_scan(const vector<float> &weights, int num_threads, const ScanFunction &scan) {
     vector<thread> t;
+    const tracing::Context &context = tracing::get_context();
+    if(node_boundaries.empty()){
+        for(int i = 0; i < num_threads; i++){
+            size_t st = split_scan_units(i, num_threads), end = split_scan_units(i + 1, num_threads);
+            t.push_back(thread([&weights, &scan, &context, st, end](){
+                tracing::ScopedContext scoped_context(context);
+                tracing::Span span("scan");
+                scan(weights, st, end);
+            }));
+        }
+        for(thread &x: t) x.join();
+        return;
+    }
+
+    int num_nodes = node_boundaries.size() - 1;
+    num_threads = max(num_threads, num_nodes);
+    vector<vector<float>> replicas = replicate_weights(weights, num_nodes);
+
+    for(int i = 0; i < num_threads; i++){
+        // Threads [first, last) work on `node`, splitting its scan units by the number of features
+        int node = i * num_nodes / num_threads;
+        int first = (node * num_threads + num_nodes - 1) / num_nodes;
+        int last = ((node + 1) * num_threads + num_nodes - 1) / num_nodes;
+        uint64_t node_st = get_scan_unit_offset(node_boundaries[node]);
+        uint64_t node_features = get_scan_unit_offset(node_boundaries[node + 1]) - node_st;
+        size_t st = i == first ? node_boundaries[node] :
+            find_scan_unit(node_st + (i - first) * node_features / (last - first));
+        size_t end = i == last - 1 ? node_boundaries[node + 1] :
+            find_scan_unit(node_st + (i - first + 1) * node_features / (last - first));
+
+        t.push_back(thread([&replicas, &scan, &context, node, st, end](){
+            tracing::ScopedContext scoped_context(context);
+            tracing::Span span("scan");
+            numa::run_on_node(node);
+            scan(replicas[node], st, end);
+        }));
+    }
+    for(thread &x: t) x.join();
+}
+
+size_t ParagraphDataset::split_scan_units(int part, int num_parts) const {
+    if(part == num_parts)
+        return parent_dataset.size();
+    return lower_bound(paragraph_offsets, paragraph_offsets + parent_dataset.size(),
+                       (uint32_t)(part * this->size()/num_parts)) - paragraph_offsets;
+}
+
+vector<int> Dataset::rescore(const vector<float> &weights, int num_threads, int num_top_docs, const AtomicBitset &judged) {
+    documents_scanned.add(size());
+
+    // Large lists are selected from all the scores at once, which costs about as much as
+    // scoring itself, instead of being pushed through the heap
+    if(num_top_docs >= SELECT_MIN_TOP_DOCS){
+        vector<float> scores(num_scan_units());
+        vector<int> results(num_scan_units());
+        parallel_scan(weights, num_threads, [&](const vector<float> &w, size_t st, size_t end){
+            score_docs_array(w, st, end, scores.data(), results.data(), judged);
+        });
+
+        vector<int> top_docs = select_top_k(scores.data(), scores.size(), num_top_docs, num_threads);
+        for(int &idx: top_docs)
+            idx = results[idx];
+        return top_docs;
+    }
+
     mutex top_docs_mutex;
     priority_queue<pair<float, int>> top_docs;
+    parallel_scan(weights, num_threads, [&](const vector<float> &w, size_t st, size_t end){
+        score_docs_priority_queue(w, st, end, top_docs, top_docs_mutex, num_top_docs, judged);
+    });
 
-    for(int i = 0; i< num_threads;i++){
-        t.push_back(
-            thread(
-                &Dataset::score_docs_priority_queue,
-                this,
-                cref(weights),
-                i * this->size()/num_threads,
-                (i == num_threads - 1)?this->size():(i+1) * this->size()/num_threads,
-                ref(top_docs),
-                ref(top_docs_mutex),
-                num_top_docs,
-                ref(judgments)
-            )
-        );
-    }
+    return drain_top_docs(top_docs);
+}
 
+// Runs fn(st, end) on num_threads contiguous chunks of [0, n)
+template<typename F>
+static void parallel_for(size_t n, int num_threads, F fn){
+    vector<thread> t;
+    for(int i = 0; i < num_threads; i++)
+        t.push_back(thread(fn, i * n / num_threads, (i + 1) * n / num_threads));
     for(thread &x: t) x.join();
+}
 
-    vector<int> top_docs_list(top_docs.size());
-    int idx = 0;
-    while(!top_docs.empty()){
-        top_docs_list[idx++] = (top_docs.top().second);
-        top_docs.pop();
+float Dataset::get_score_change_bound(size_t index, double distance, double norms) const {
+    size_t num_features = doc_offsets[index + 1] - doc_offsets[index];
+    double norm = sqrt(squared_norms[index]);
+    // Every compressed value is within 2^-15 of the largest one, and so of the norm
+    if(compressed_features != nullptr)
+        norm *= 1 + sqrt((double)num_features) / 32767;
+    // Summing the products rounds each of the two scores by at most about n 2^-24 of
+    // |weights| |features|, doubled to cover the rounding of everything else
+    return norm * (distance + (num_features + 2) * FLT_EPSILON * norms) * (1 + FLT_EPSILON * 16);
+}
+
+float ParagraphDataset::get_scan_unit_change_bound(size_t unit, double distance, double norms) const {
+    float bound = 0;
+    for(uint32_t para = paragraph_offsets[unit]; para < paragraph_offsets[unit + 1]; para++)
+        bound = max(bound, get_score_change_bound(para, distance, norms));
+    return bound;
+}
+
+void Dataset::score_units(const vector<float> &weights, int num_threads, const vector<int> &units,
+                          size_t first, vector<float> &scores, vector<int> &results) {
+    scores.resize(units.size());
+    results.resize(units.size());
+    parallel_for(units.size() - first, num_threads, [&](size_t st, size_t end){
+        uint64_t num_scanned = 0;
+        for(size_t i = first + st; i < first + end; i++){
+            tie(scores[i], results[i]) = score_scan_unit(units[i], weights);
+            num_scanned += get_scan_unit_document(units[i] + 1) - get_scan_unit_document(units[i]);
+        }
+        documents_scanned.add(num_scanned);
+    });
+}
+
+vector<int> Dataset::rescore_units(const vector<float> &weights, int num_threads, int num_top_docs,
+                                   const vector<int> &units) {
+    vector<float> scores;
+    vector<int> results;
+    score_units(weights, num_threads, units, 0, scores, results);
+
+    // Units are in increasing order, so ties are broken as in rescore()
+    vector<int> top_docs = select_top_k(scores.data(), scores.size(), num_top_docs, num_threads);
+    for(int &idx: top_docs)
+        idx = results[idx];
+    return top_docs;
+}
+
+vector<int> Dataset::rescore_cached(const vector<float> &weights, int num_threads, int num_top_docs,
+                                    const AtomicBitset &judged, ScoreCache &cache) {
+    size_t num_units = num_scan_units();
+    auto norm = [](const vector<float> &v) -> double {
+        double sum = 0;
+        for(float x: v)
+            sum += (double)x * x;
+        return sqrt(sum);
+    };
+
+    if(cache.dataset == this && cache.weights.size() == weights.size() && cache.scores.size() == num_units){
+        double distance = 0;
+        for(size_t i = 0; i < weights.size(); i++)
+            distance += ((double)weights[i] - cache.weights[i]) * ((double)weights[i] - cache.weights[i]);
+        distance = sqrt(distance);
+        double norms = norm(weights) + cache.weights_norm;
+
+        // No unit whose score may now be at most that of num_top_docs others can be among them
+        vector<float> lower(num_units), upper(num_units);
+        parallel_for(num_units, num_threads, [&](size_t st, size_t end){
+            for(size_t unit = st; unit < end; unit++){
+                if(cache.scores[unit] == -INFINITY || judged.test(unit)){
+                    lower[unit] = upper[unit] = -INFINITY;
+                    continue;
+                }
+                float bound = get_scan_unit_change_bound(unit, distance, norms);
+                lower[unit] = cache.scores[unit] - bound;
+                upper[unit] = cache.scores[unit] + bound;
+            }
+        });
+        vector<int> lowest = select_top_k(lower.data(), num_units, num_top_docs, num_threads);
+        float threshold = (int)lowest.size() == num_top_docs && num_top_docs > 0 ? lower[lowest[0]] : -INFINITY;
+
+        vector<int> candidates;
+        for(size_t unit = 0; unit < num_units; unit++)
+            if(upper[unit] != -INFINITY && upper[unit] >= threshold)
+                candidates.push_back(unit);
+
+        if(candidates.size() <= CACHED_RESCORE_MAX_FRACTION * num_units){
+            cached_rescores.add();
+            return rescore_units(weights, num_threads, num_top_docs, candidates);
+        }
     }
-    return top_docs_list;
+
+    // Scores every unit, which rescore() does for large lists anyway
+    documents_scanned.add(size());
+    cache.dataset = this;
+    cache.weights = weights;
+    cache.weights_norm = norm(weights);
+    cache.scores.assign(num_units, 0);
+    cache.results.assign(num_units, 0);
+    parallel_scan(weights, num_threads, [&](const vector<float> &w, size_t st, size_t end){
+        score_docs_array(w, st, end, cache.scores.data(), cache.results.data(), judged);
+    });
+    vector<int> top_docs = select_top_k(cache.scores.data(), num_units, num_top_docs, num_threads);
+    for(int &idx: top_docs)
+        idx = cache.results[idx];
+    return top_docs;
+}
+
+void Dataset::build_term_index(size_t num_terms, int num_threads){
+    term_index = make_unique<TermIndex>(*this, num_terms, num_threads);
+}
+
+vector<int> Dataset::rescore_retrieved(const vector<float> &weights, int num_threads, int num_top_docs,
+                                       const AtomicBitset &judged, const TermIndex &index, size_t num_candidates) {
+    size_t num_units = num_scan_units();
+    vector<float> estimates = index.estimate(weights, judged, num_threads);
+
+    // Candidates in the order they were found, each batch from the highest estimate down.
+    // Units are taken out of `estimates` once they are candidates.
+    vector<int> candidates;
+    vector<float> scores;
+    vector<int> results;
+    size_t num_wanted = max(num_candidates, (size_t)num_top_docs);
+    while(num_wanted <= RETRIEVED_RESCORE_MAX_FRACTION * num_units){
+        size_t first = candidates.size();
+        vector<int> batch = select_top_k(estimates.data(), num_units, num_wanted - first, num_threads);
+        candidates.insert(candidates.end(), batch.rbegin(), batch.rend());
+        for(int unit: batch)
+            estimates[unit] = -INFINITY;
+        score_units(weights, num_threads, candidates, first, scores, results);
+
+        // Every unjudged unit was scored, or the top ones were found well above the last candidates.
+        // Judging by more than a few top ones keeps estimates which only rank a few units well
+        // from being trusted.
+        vector<int> checked = select_top_k(scores.data(), scores.size(),
+                                           max(num_top_docs, RETRIEVED_RESCORE_MIN_CHECKED), num_threads);
+        int deepest = checked.empty() ? 0 : *max_element(checked.begin(), checked.end());
+        if(candidates.size() < num_wanted || (size_t)deepest < num_wanted / 2){
+            retrieved_rescores.add();
+            // Select from the candidates in increasing order of their unit, so ties are broken as in rescore()
+            vector<int> order(candidates.size());
+            for(size_t i = 0; i < order.size(); i++)
+                order[i] = i;
+            sort(order.begin(), order.end(), [&](int a, int b){ return candidates[a] < candidates[b]; });
+            vector<float> ordered_scores(order.size());
+            for(size_t i = 0; i < order.size(); i++)
+                ordered_scores[i] = scores[order[i]];
+            vector<int> top_docs = select_top_k(ordered_scores.data(), ordered_scores.size(), num_top_docs, num_threads);
+            for(int &idx: top_docs)
+                idx = results[order[idx]];
+            return top_docs;
+        }
+        num_wanted *= 2;
+    }
+
+    // Scores the units which are not candidates yet, and selects from every unit as rescore() does
+    size_t first = candidates.size();
+    for(size_t unit = 0; unit < num_units; unit++)
+        if(estimates[unit] != -INFINITY)
+            candidates.push_back(unit);
+    score_units(weights, num_threads, candidates, first, scores, results);
+    vector<float> unit_scores(num_units, -INFINITY);
+    vector<int> unit_results(num_units, 0);
+    for(size_t i = 0; i < candidates.size(); i++){
+        unit_scores[candidates[i]] = scores[i];
+        unit_results[candidates[i]] = results[i];
+    }
+    vector<int> top_docs = select_top_k(unit_scores.data(), num_units, num_top_docs, num_threads);
+    for(int &idx: top_docs)
+        idx = unit_results[idx];
+    return top_docs;
 }
 
-vector<int> ParagraphDataset::rescore(const vector<float> &weights, int num_threads, int num_top_docs, const map<int, int> &judgments) {
+vector<int> ParagraphDataset::rescore_candidates(const vector<float> &weights, int num_threads, int num_top_docs, const vector<int> &candidates) {
     vector<thread> t;
     mutex top_docs_mutex;
     priority_queue<pair<float, int>> top_docs;
 
-    uint32_t prev_end;
     for(int i = 0; i < num_threads;i++){
-        int start = i * this->size()/num_threads;
-        
-        if(i != 0) start = prev_end;
-        prev_end = (i == num_threads - 1)?this->size():(i+1) * this->size()/num_threads;
-        while(prev_end > 0 && prev_end < this->size() && translate_index(prev_end) == translate_index(prev_end - 1))
-            prev_end++;
-
         t.push_back(
             thread(
-                &ParagraphDataset::score_docs_priority_queue,
+                &ParagraphDataset::score_candidates_priority_queue,
                 this,
                 cref(weights),
-                start, prev_end,
+                cref(candidates),
+                i * candidates.size()/num_threads,
+                (i == num_threads - 1)?candidates.size():(i+1) * candidates.size()/num_threads,
                 ref(top_docs),
                 ref(top_docs_mutex),
                 num_top_docs,
-                ref(judgments)
+                cref(tracing::get_context())
             )
         );
     }
 
     for(thread &x: t) x.join();
 
-    vector<int> top_docs_list(top_docs.size());
-    int idx = 0;
-    while(!top_docs.empty()){
-        top_docs_list[idx++] = (top_docs.top().second);
-        top_docs.pop();
+    return drain_top_docs(top_docs);
+}
+
+ParagraphDataset::ParagraphDataset(const Dataset &_parent_dataset, unique_ptr<FeatureStore> _store):
+            Dataset(move(_store)),
+            parent_dataset(_parent_dataset),
+            parent_documents(store->get_parent_documents()),
+            paragraph_offsets(store->get_paragraph_offsets()){
+    if(store->num_parents() != _parent_dataset.size())
+        fail("Paragraph features do not belong to the document features", -1);
+}
+
+unique_ptr<ParagraphDataset> ParagraphDataset::build(FeatureParser *feature_parser, const Dataset &parent_dataset,
+                                                     const string &segment, uint64_t fingerprint,
+                                                     int num_threads, bool compress){
+    ParsedFeatures parsed = feature_parser->parse_all(num_threads);
+    vector<int> parent_documents = generate_parent_documents(parent_dataset, parsed.doc_ids);
+    vector<uint32_t> paragraph_offsets = generate_paragraph_offsets(parent_dataset, parent_documents);
+
+    FeatureStore::Contents contents;
+    contents.parsed = &parsed;
+    contents.dictionary = &feature_parser->get_dictionary();
+    contents.parent_documents = &parent_documents;
+    contents.paragraph_offsets = &paragraph_offsets;
+    contents.parent_checksum = parent_dataset.get_store().get_checksum();
+    contents.compress = compress;
+    return make_unique<ParagraphDataset>(parent_dataset, FeatureStore::build(contents, fingerprint, segment));
+}
+
+unique_ptr<ParagraphDataset> ParagraphDataset::append(const ParsedFeatures &delta,
+                                                      const vector<pair<string, TermInfo>> &dictionary,
+                                                      const Dataset &parent_dataset) const {
+    vector<int> parent_documents(this->parent_documents, this->parent_documents + size());
+    vector<int> delta_parents = generate_parent_documents(parent_dataset, delta.doc_ids);
+    if(!delta_parents.empty() && delta_parents.front() < (int)this->parent_dataset.size())
+        fail("Appended paragraphs must belong to appended documents", -1);
+    parent_documents.insert(parent_documents.end(), delta_parents.begin(), delta_parents.end());
+    vector<uint32_t> paragraph_offsets = generate_paragraph_offsets(parent_dataset, parent_documents);
+
+    ParsedFeatures parsed = concatenate(*store, delta);
+    FeatureStore::Contents contents;
+    contents.parsed = &parsed;
+    contents.dictionary = &dictionary;
+    contents.parent_documents = &parent_documents;
+    contents.paragraph_offsets = &paragraph_offsets;
+    contents.parent_checksum = parent_dataset.get_store().get_checksum();
+    contents.compress = store->is_compressed();
+    return make_unique<ParagraphDataset>(parent_dataset, FeatureStore::build(contents, 0));
+}
+
+unique_ptr<ParagraphDataset> ParagraphDataset::load(const string &path, const Dataset &parent_dataset){
+    auto store = FeatureStore::load(path);
+    if(store == nullptr)
+        return nullptr;
+    if(store->get_parent_checksum() != parent_dataset.get_store().get_checksum()){
+        cerr<<"Container "<<path<<" was not packed with the document features"<<endl;
+        return nullptr;
     }
-    return top_docs_list;
+    return make_unique<ParagraphDataset>(parent_dataset, move(store));
+}
+
+unique_ptr<ParagraphDataset> ParagraphDataset::attach_or_build(const string &segment,
+                                                               const vector<string> &source_files,
+                                                               const FeatureParserFactory &make_parser,
+                                                               const Dataset &parent_dataset,
+                                                               int num_threads, bool compress){
+    if(FeatureStore::is_container(source_files[0]))
+        return load(source_files[0], parent_dataset);
+    uint64_t fingerprint = FeatureStore::fingerprint(source_files, parent_dataset.get_store().get_fingerprint());
+    if(!segment.empty()){
+        auto store = FeatureStore::attach(segment, fingerprint, compress);
+        if(store != nullptr){
+            cerr<<"Attached to segment "<<segment<<endl;
+            return make_unique<ParagraphDataset>(parent_dataset, move(store));
+        }
+        cerr<<"Building segment "<<segment<<endl;
+    }
+    return build(make_parser().get(), parent_dataset, segment, fingerprint, num_threads, compress);
+}
+
+metrics::Counter &StreamedDataset::bytes_streamed = metrics::counter("cal_feature_bytes_streamed_total",
+        "Number of bytes of features read by streamed datasets");
+metrics::Histogram &StreamedDataset::read_wait = metrics::histogram("cal_feature_stream_wait_seconds",
+        "Time rescoring a streamed dataset waited for a block of features to be read");
+
+StreamedDataset::StreamedDataset(unique_ptr<FeatureStore> _store, int _fd, size_t block_size):
+    Dataset(move(_store)), fd(_fd)
+{
+    features_offset = (const char *)store->get_features() - store->get_region().data();
+
+    // Blocks end at the first document reaching block_size, a larger document is a block of its own
+    uint64_t block_features = max(block_size / sizeof(FeatureValuePair), (size_t)1);
+    block_boundaries = {0};
+    for(size_t i = 1; i <= size(); i++)
+        if(i == size() || doc_offsets[i] - doc_offsets[block_boundaries.back()] >= block_features)
+            block_boundaries.push_back(i);
+}
+
+StreamedDataset::~StreamedDataset(){
+    close(fd);
 }
 
-ParagraphDataset::ParagraphDataset(const Dataset &_parent_dataset,
-        SparseVectors sparse_vectors,
-        std::unordered_map<std::string, TermInfo> _dictionary):
-            Dataset(move(sparse_vectors), _dictionary),
-            parent_dataset(_parent_dataset){
-    parent_documents = generate_parent_documents(_parent_dataset, doc_features);
+unique_ptr<StreamedDataset> StreamedDataset::open(const string &path, size_t block_size){
+    auto store = FeatureStore::load(path, false);
+    if(store == nullptr)
+        return nullptr;
+    if(store->is_compressed()){
+        cerr<<"Container "<<path<<" is compressed, which streaming does not support"<<endl;
+        return nullptr;
+    }
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        cerr<<"Failed to open "<<path<<": "<<strerror(errno)<<endl;
+        return nullptr;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return make_unique<StreamedDataset>(move(store), fd, block_size);
+}
+
+void StreamedDataset::read_block(size_t block, vector<FeatureValuePair> &buffer) const {
+    uint64_t st = doc_offsets[block_boundaries[block]], end = doc_offsets[block_boundaries[block + 1]];
+    buffer.resize(end - st);
+    char *dest = (char *)buffer.data();
+    size_t remaining = (end - st) * sizeof(FeatureValuePair);
+    off_t offset = features_offset + st * sizeof(FeatureValuePair);
+    while(remaining > 0){
+        ssize_t n = pread(fd, dest, remaining, offset);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            fail(string("Failed to read streamed features: ") + (n < 0 ? strerror(errno) : "unexpected end of file"), -1);
+        dest += n;
+        remaining -= n;
+        offset += n;
+    }
+    bytes_streamed.add((end - st) * sizeof(FeatureValuePair));
+}
+
+vector<int> StreamedDataset::rescore(const vector<float> &weights, int num_threads, int num_top_docs, const AtomicBitset &judged) {
+    documents_scanned.add(size());
+    bool select = num_top_docs >= SELECT_MIN_TOP_DOCS;
+    vector<float> scores(select ? size() : 0);
+    mutex top_docs_mutex;
+    priority_queue<pair<float, int>> top_docs;
+    const tracing::Context &context = tracing::get_context();
+
+    // Scores the documents [st, end) of the block in `buffer`, which begins with the features
+    // of document `first`, into `scores` or `top_docs`. Summed in the same order as inner_product()
+    auto score_block = [&](const vector<FeatureValuePair> &buffer, size_t first, size_t st, size_t end){
+        tracing::ScopedContext scoped_context(context);
+        tracing::Span span("scan");
+        const float *w = weights.data();
+        uint64_t base = doc_offsets[first];
+        pair<float, int> candidates[1000];
+        int num_candidates = 0;
+        for(size_t i = st; i < end; i++){
+            if(judged.test(i)){
+                if(select)
+                    scores[i] = -INFINITY;
+                continue;
+            }
+            float score = 0;
+            for(uint64_t k = doc_offsets[i] - base, k_end = doc_offsets[i + 1] - base; k < k_end; k++)
+                score += w[buffer[k].id_] * buffer[k].value_;
+
+            if(select){
+                scores[i] = score;
+                continue;
+            }
+            candidates[num_candidates++] = {-score, (int)i};
+            if(num_candidates == 1000){
+                merge_top_docs(candidates, num_candidates, top_docs, top_docs_mutex, num_top_docs);
+                num_candidates = 0;
+            }
+        }
+        merge_top_docs(candidates, num_candidates, top_docs, top_docs_mutex, num_top_docs);
+    };
+
+    if(num_blocks() == 0)
+        return {};
+    vector<FeatureValuePair> buffers[2];
+    {
+        auto start = chrono::steady_clock::now();
+        read_block(0, buffers[0]);
+        read_wait.observe_since(start);
+    }
+    for(size_t block = 0; block < num_blocks(); block++){
+        thread reader;
+        if(block + 1 < num_blocks()){
+            reader = thread([this, &buffers, &context, block](){
+                tracing::ScopedContext scoped_context(context);
+                tracing::Span span("read_block");
+                read_block(block + 1, buffers[(block + 1) & 1]);
+            });
+        }
+
+        size_t first = block_boundaries[block], last = block_boundaries[block + 1];
+        vector<thread> t;
+        for(int i = 0; i < num_threads; i++){
+            t.push_back(thread(score_block, cref(buffers[block & 1]), first,
+                               first + i * (last - first) / num_threads,
+                               first + (i + 1) * (last - first) / num_threads));
+        }
+        for(thread &x: t) x.join();
+
+        uint64_t st = doc_offsets[first], end = doc_offsets[last];
+        posix_fadvise(fd, features_offset + st * sizeof(FeatureValuePair), (end - st) * sizeof(FeatureValuePair),
+                      POSIX_FADV_DONTNEED);
+        if(reader.joinable()){
+            auto start = chrono::steady_clock::now();
+            reader.join();
+            read_wait.observe_since(start);
+        }
+    }
+
+    if(select)
+        return select_top_k(scores.data(), scores.size(), num_top_docs, num_threads);
+    return drain_top_docs(top_docs);
 }
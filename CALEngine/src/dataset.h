@@ -1,6 +1,7 @@
 #ifndef DATASET_H
 #define DATASET_H
 
+#include <functional>
 #include <memory>
 #include <unordered_map>
 #include <map>
@@ -9,48 +10,177 @@
 #include "sofiaml/sf-sparse-vector.h"
 #include "utils/features.h"
 #include "utils/feature_parser.h"
+#include "utils/doc_id_index.h"
+#include "utils/dictionary.h"
+#include "utils/atomic_bitset.h"
+#include "utils/numa.h"
+#include "utils/metrics.h"
+#include "utils/tracing.h"
+#include "feature_store.h"
+#include "term_index.h"
+
+typedef std::function<std::unique_ptr<FeatureParser>()> FeatureParserFactory;
+
+class Dataset;
+
+// Scores of every scan unit of a dataset under the weights of its last full
+// rescore, kept by a session between rescorings (see Dataset::rescore_cached())
+struct ScoreCache {
+    const Dataset *dataset = nullptr;
+    std::vector<float> weights;
+    double weights_norm = 0;
+    // -infinity for the units judged at the time
+    std::vector<float> scores;
+    // Index returned for every unit
+    std::vector<int> results;
+
+    void clear() {
+        dataset = nullptr;
+        weights.clear();
+        scores.clear();
+        results.clear();
+    }
+
+    size_t memory_usage() const {
+        return (weights.capacity() + scores.capacity()) * sizeof(float) + results.capacity() * sizeof(int);
+    }
+};
 
-typedef std::unordered_map<std::string, TermInfo> Dictionary;
 class Dataset {
     protected:
-    std::unique_ptr<std::vector<std::unique_ptr<SfSparseVector>>> doc_features;
-    Dictionary dictionary;
+    // All the data below are views into the store
+    std::unique_ptr<FeatureStore> store;
+    const uint64_t *doc_offsets;
+    const FeatureValuePair *features;
+    // Set instead of `features` when the store is compressed: the features of document `i`
+    // are encoded at compressed_features + compressed_offsets[i] (see feature_codec.h)
+    const uint8_t *compressed_features;
+    const uint64_t *compressed_offsets;
+    const float *squared_norms;
+    const Dictionary dictionary;
     const uint32_t dimensionality;
-    const std::unordered_map<std::string, size_t> doc_ids_inv_map; // Inverted map of all document ids to their indices
+    const DocIdIndex doc_ids; // Interned document ids, indexed by document index
+
+    // Set by place_on_nodes(), the scan units [node_boundaries[k], node_boundaries[k+1])
+    // are stored on and scored by NUMA node k
+    std::vector<size_t> node_boundaries;
+
+    // Set by build_term_index()
+    std::unique_ptr<TermIndex> term_index;
+
+    // Units scanned by score_docs_priority_queue(), the first document of each, and the
+    // position in `features` where each begins
+    virtual size_t num_scan_units() const { return size(); }
+    virtual size_t get_scan_unit_document(size_t unit) const { return unit; }
+    uint64_t get_scan_unit_offset(size_t unit) const { return doc_offsets[get_scan_unit_document(unit)]; }
+
+    // Returns the first scan unit beginning at or after feature position `offset`
+    size_t find_scan_unit(uint64_t offset) const;
+
+    // Boundary between the parts when splitting the scan units into `num_parts` for as many threads
+    virtual size_t split_scan_units(int part, int num_parts) const { return part * size() / num_parts; }
+
+    // Score of the scan unit `unit` and the index to return for it
+    virtual std::pair<float, int> score_scan_unit(size_t unit, const std::vector<float> &weights) const {
+        return {inner_product(unit, weights), (int)unit};
+    }
+
+    // Upper bound on how far the score of document `index` may move between two weight vectors
+    // `distance` apart whose norms sum to `norms`, rounding and quantization included
+    float get_score_change_bound(size_t index, double distance, double norms) const;
+
+    // Same for every document of the scan unit `unit`
+    virtual float get_scan_unit_change_bound(size_t unit, double distance, double norms) const {
+        return get_score_change_bound(unit, distance, norms);
+    }
+
+    // Scores the scan units units[i] for i in [first, units.size()) into scores[i] and results[i]
+    void score_units(const std::vector<float> &weights, int num_threads, const std::vector<int> &units,
+                     size_t first, std::vector<float> &scores, std::vector<int> &results);
+
+    // Same as rescore(), scoring only the scan units `units`, in increasing order and unjudged
+    std::vector<int> rescore_units(const std::vector<float> &weights, int num_threads, int num_top_docs,
+                                   const std::vector<int> &units);
+
+    // Calls `scan(weights, st, end)` on num_threads threads over the scan units. When placed on
+    // nodes, threads are pinned to the node holding their units and read a local copy of `weights`.
+    typedef std::function<void(const std::vector<float> &, size_t, size_t)> ScanFunction;
+    void parallel_scan(const std::vector<float> &weights, int num_threads, const ScanFunction &scan);
+
+    // Writes the score of every scan unit in [st, end) and the index to return for it,
+    // -infinity for judged units
+    virtual void score_docs_array(const std::vector<float> &weights,
+                                  size_t st, size_t end,
+                                  float *scores, int *results,
+                                  const AtomicBitset &judged);
 
     virtual void score_docs_priority_queue(const std::vector<float> &weights,
                                    int st, int end,
                                    std::priority_queue<std::pair<float, int>> &top_docs,
                                    std::mutex &top_docs_mutex,
                                    int num_top_docs,
-                                   const std::map<int, int> &judgments);
+                                   const AtomicBitset &judged);
 
     public:
     uint32_t NPOS;
-    Dataset(std::unique_ptr<std::vector<std::unique_ptr<SfSparseVector>>>, Dictionary);
-    Dataset():doc_features(nullptr), dimensionality(0), NPOS(0){};
+
+    // Documents and paragraphs scored by every dataset of the process
+    static metrics::Counter &documents_scanned;
+    // Rescores served by rescore_cached() without scanning every document
+    static metrics::Counter &cached_rescores;
+    // Rescores served by rescore_retrieved() without scanning every document
+    static metrics::Counter &retrieved_rescores;
+
+    Dataset(std::unique_ptr<FeatureStore> _store);
     virtual float inner_product(size_t index, const std::vector<float> &weights) const;
     virtual std::vector<int> rescore(const vector<float> &weights,
                             int num_threads, int num_top_docs,
-                            const std::map<int, int> &judgments);
+                            const AtomicBitset &judged);
+
+    // Same as rescore(), from the scores of the last full rescore kept in `cache`. The score
+    // of every unit moved by at most the distance between the weights times the norm of its
+    // features, so only the units which may now be among the top ones are rescored. Rescores
+    // everything, and refreshes `cache`, when it belongs to another dataset or more than a
+    // quarter of the units would be rescored. Units judged since must still be in `judged`.
+    virtual std::vector<int> rescore_cached(const vector<float> &weights,
+                                            int num_threads, int num_top_docs,
+                                            const AtomicBitset &judged, ScoreCache &cache);
+
+    // Approximately rescore(): `index` estimates the score of every document of the scan units,
+    // the parent documents for paragraphs, and only the units of the `num_candidates` documents
+    // estimated highest are scored. As long as the top documents found include one from the lower
+    // half of those scored, twice as many are scored, and past a quarter of the units every unit is.
+    std::vector<int> rescore_retrieved(const vector<float> &weights,
+                                       int num_threads, int num_top_docs,
+                                       const AtomicBitset &judged,
+                                       const TermIndex &index, size_t num_candidates);
 
     // Returns the index given the document id. return Dataset::NPOS if not found
+    size_t get_index(const char *id, size_t len) const {
+        size_t result = doc_ids.find(id, len);
+        if ( result == DocIdIndex::NPOS ) return NPOS;
+        return result;
+    }
+
     size_t get_index(const std::string &id) const {
-        auto result = doc_ids_inv_map.find(id);
-        if ( result == doc_ids_inv_map.end() ) return NPOS;
-        return result->second;
+        return get_index(id.data(), id.size());
     }
 
-    const std::string &get_id(size_t idx){
-        return doc_features->at(idx)->doc_id;
+    // Document ids are only materialized at the API boundary
+    std::string get_id(size_t idx) const {
+        return doc_ids.get(idx);
     }
 
-    virtual const SfSparseVector& get_sf_sparse_vector(size_t index) const {
-        return *(doc_features->at(index));
+    const DocIdIndex &get_doc_ids() const {
+        return doc_ids;
     }
 
+    // Returns a view of the features of the document, valid as long as the dataset,
+    // or a copy of them decoded when the dataset is compressed
+    virtual SfSparseVector get_sf_sparse_vector(size_t index) const;
+
     virtual size_t size() const {
-        return doc_features->size();
+        return store->size();
     }
 
     size_t get_dimensionality() const {
@@ -61,69 +191,199 @@ class Dataset {
         return dictionary;
     }
 
-    virtual int translate_index(int id) const {return id;}
+    // Inverse document frequency of the term `term_id`, precomputed in the store
+    float get_idf(uint32_t term_id) const {
+        return store->get_idf()[term_id];
+    }
+
+    const FeatureStore &get_store() const {
+        return *store;
+    }
+
+    bool is_compressed() const {
+        return compressed_features != nullptr;
+    }
 
-    static std::unique_ptr<Dataset> build(FeatureParser *feature_parser){
-        auto sparse_feature_vectors = std::make_unique<vector<std::unique_ptr<SfSparseVector>>>();
-        std::unique_ptr<SfSparseVector> spv;
-        while((spv = feature_parser->next()) != nullptr)
-            sparse_feature_vectors->push_back(std::move(spv));
-        return std::make_unique<Dataset>(move(sparse_feature_vectors), feature_parser->get_dictionary());
+    // Partitions the features across the NUMA nodes and makes rescore() score every
+    // partition on its own node
+    void place_on_nodes();
+
+    // Indexes the features of every document for rescore_retrieved() on num_threads threads,
+    // estimating scores from `num_terms` terms. Datasets appended to this one are indexed alike.
+    void build_term_index(size_t num_terms, int num_threads = 1);
+
+    const TermIndex *get_term_index() const {
+        return term_index.get();
     }
+
+    virtual int translate_index(int id) const {return id;}
+
+    // Builds the dataset in private memory, or in the shared memory `segment` when it is not empty.
+    // Formats which allow it are parsed on `num_threads` threads. With `compress`, the
+    // features are held compressed (see FeatureStore).
+    static std::unique_ptr<Dataset> build(FeatureParser *feature_parser,
+                                          const std::string &segment = "", uint64_t fingerprint = 0,
+                                          int num_threads = 1, bool compress = false);
+
+    // Loads the dataset from the container file `path`. Returns nullptr if it is not a valid container.
+    static std::unique_ptr<Dataset> load(const std::string &path);
+
+    // Builds a dataset in private memory of these documents followed by those in `delta`, with
+    // `dictionary` in place of this one's. Documents keep their indices, and the dataset is
+    // compressed and indexed if this one is.
+    std::unique_ptr<Dataset> append(const ParsedFeatures &delta,
+                                    const std::vector<std::pair<std::string, TermInfo>> &dictionary) const;
+
+    // Attaches to the dataset in `segment`, and builds it there if it is missing or
+    // was built from anything but `source_files`. Behaves like build() if `segment` is empty.
+    // If the first source file is a container, it is loaded instead, returning nullptr if it is not valid,
+    // and is compressed only if it was packed so.
+    static std::unique_ptr<Dataset> attach_or_build(const std::string &segment,
+                                                    const std::vector<std::string> &source_files,
+                                                    const FeatureParserFactory &make_parser,
+                                                    int num_threads = 1, bool compress = false);
 };
 
 class ParagraphDataset:public Dataset {
     const Dataset &parent_dataset;
-    vector<int> parent_documents;
+
+    // Paragraph to parent document index, and the CSR inverse of it: the
+    // paragraphs of document `d` are [paragraph_offsets[d], paragraph_offsets[d+1])
+    const int *parent_documents;
+    const uint32_t *paragraph_offsets;
+
+    // Returns {-score, index} of the best scoring paragraph of `doc_idx`
+    std::pair<float, int> score_best_paragraph(size_t doc_idx, const std::vector<float> &weights) const;
+
+    void score_candidates_priority_queue(const std::vector<float> &weights,
+                                         const std::vector<int> &candidates,
+                                         int st, int end,
+                                         std::priority_queue<std::pair<float, int>> &top_docs,
+                                         std::mutex &top_docs_mutex,
+                                         int num_top_docs,
+                                         const tracing::Context &context);
 
     protected:
+    size_t num_scan_units() const { return parent_dataset.size(); }
+    size_t get_scan_unit_document(size_t unit) const { return paragraph_offsets[unit]; }
+
+    // Splits the parent documents such that every part has a similar number of paragraphs
+    size_t split_scan_units(int part, int num_parts) const;
+
+    std::pair<float, int> score_scan_unit(size_t unit, const std::vector<float> &weights) const {
+        std::pair<float, int> best = score_best_paragraph(unit, weights);
+        return {-best.first, best.second};
+    }
+
+    float get_scan_unit_change_bound(size_t unit, double distance, double norms) const;
+
+    void score_docs_array(const std::vector<float> &weights,
+                          size_t st, size_t end,
+                          float *scores, int *results,
+                          const AtomicBitset &judged);
+
+    // Scores the paragraphs of the parent documents [st, end)
     void score_docs_priority_queue(const std::vector<float> &weights,
                                    int st, int end,
                                    std::priority_queue<std::pair<float, int>> &top_docs,
                                    std::mutex &top_docs_mutex,
                                    int num_top_docs,
-                                   const std::map<int, int> &judgments);
+                                   const AtomicBitset &judged);
 
     public:
-    ParagraphDataset(const Dataset &_parent_dataset,
-                    std::unique_ptr<std::vector<std::unique_ptr<SfSparseVector>>>,
-                    Dictionary);
+    ParagraphDataset(const Dataset &_parent_dataset, std::unique_ptr<FeatureStore> _store);
     virtual int translate_index(int id) const {return parent_documents[id];}
-    std::vector<int> rescore(const vector<float> &weights,
-                            int num_threads, int num_top_docs,
-                            const std::map<int, int> &judgments);
 
-    static std::unique_ptr<ParagraphDataset> build(FeatureParser *feature_parser, const Dataset &parent_dataset){
-        auto sparse_feature_vectors = std::make_unique<vector<std::unique_ptr<SfSparseVector>>>();
-        std::unique_ptr<SfSparseVector> spv;
-        while((spv = feature_parser->next()) != nullptr)
-            sparse_feature_vectors->push_back(std::move(spv));
-        return std::make_unique<ParagraphDataset>(parent_dataset, move(sparse_feature_vectors), feature_parser->get_dictionary());
+    // Paragraphs of the parent document `doc_idx` are [first, second)
+    std::pair<uint32_t, uint32_t> get_paragraph_range(size_t doc_idx) const {
+        return {paragraph_offsets[doc_idx], paragraph_offsets[doc_idx + 1]};
     }
+
+    // Same as rescore(), but only scores the paragraphs of the parent documents in `candidates`
+    std::vector<int> rescore_candidates(const vector<float> &weights,
+                            int num_threads, int num_top_docs,
+                            const std::vector<int> &candidates);
+
+    static std::unique_ptr<ParagraphDataset> build(FeatureParser *feature_parser, const Dataset &parent_dataset,
+                                                   const std::string &segment = "", uint64_t fingerprint = 0,
+                                                   int num_threads = 1, bool compress = false);
+
+    // Same as Dataset::append() for paragraphs, whose parents are in `parent_dataset`: these
+    // paragraphs' parents followed by the documents appended to them
+    std::unique_ptr<ParagraphDataset> append(const ParsedFeatures &delta,
+                                             const std::vector<std::pair<std::string, TermInfo>> &dictionary,
+                                             const Dataset &parent_dataset) const;
+
+    // Loads the paragraphs from the container file `path`, which must have been packed
+    // together with the container of `parent_dataset`. Returns nullptr otherwise.
+    static std::unique_ptr<ParagraphDataset> load(const std::string &path, const Dataset &parent_dataset);
+
+    // The fingerprint of the segment also covers the parent dataset
+    static std::unique_ptr<ParagraphDataset> attach_or_build(const std::string &segment,
+                                                             const std::vector<std::string> &source_files,
+                                                             const FeatureParserFactory &make_parser,
+                                                             const Dataset &parent_dataset,
+                                                             int num_threads = 1, bool compress = false);
 };
 
-class Dataset_subset:public Dataset {
-    Dataset *d;
-    std::vector<int> indices;
-public:
-    Dataset_subset(Dataset &_d, std::vector<int> _indices): d(&_d),indices(_indices) {
-        NPOS = indices.size();
-    }
+/*
+ * Documents whose features are streamed from a container file by rescore()
+ * instead of being held in memory, for corpora larger than RAM.
+ *
+ * rescore() reads the features in sequential blocks of about `block_size`
+ * bytes with pread(), reading the next block on its own thread while the
+ * current one is scored on `num_threads` threads, and keeps the top documents
+ * across blocks. Scored blocks are dropped from the page cache. Everything but
+ * the features, and the features of the single documents read through
+ * get_sf_sparse_vector() and inner_product(), are read through a mapping of
+ * the file and paged in on demand. Scores and rankings are the same as those
+ * of the dataset loaded into memory.
+ */
+class StreamedDataset: public Dataset {
+    int fd;
+    // Position of the features in the file
+    uint64_t features_offset;
+    // Block k holds the documents [block_boundaries[k], block_boundaries[k + 1])
+    std::vector<size_t> block_boundaries;
 
-    // Returns the inner product of `weights` with the sparse vector at `index`
-    float inner_product(size_t index, const std::vector<float> &weights) const override {
-        return d->inner_product(indices[index], weights);
-    }
+    static metrics::Counter &bytes_streamed;
+    static metrics::Histogram &read_wait;
 
-    const SfSparseVector& get_sf_sparse_vector(size_t index) const override {
-        return d->get_sf_sparse_vector(indices[index]);
-    }
+    // Reads the features of `block` into `buffer`
+    void read_block(size_t block, std::vector<FeatureValuePair> &buffer) const;
+
+    public:
+    StreamedDataset(std::unique_ptr<FeatureStore> store, int fd, size_t block_size);
+    ~StreamedDataset();
+
+    std::vector<int> rescore(const vector<float> &weights,
+                             int num_threads, int num_top_docs,
+                             const AtomicBitset &judged);
 
-    size_t size() const override {
-        return indices.size();
+    // The full rescores refreshing the cache would read the features through the mapping
+    // instead of streaming them, so nothing is cached
+    std::vector<int> rescore_cached(const vector<float> &weights,
+                                    int num_threads, int num_top_docs,
+                                    const AtomicBitset &judged, ScoreCache &cache) {
+        return rescore(weights, num_threads, num_top_docs, judged);
     }
 
-    int translate_index(int id) const override {return indices[id];}
+    size_t num_blocks() const { return block_boundaries.size() - 1; }
+
+    // Opens the container file `path` without verifying its checksum, which would read every
+    // feature. Returns nullptr if it is not a valid container, or is compressed.
+    static std::unique_ptr<StreamedDataset> open(const std::string &path, size_t block_size);
+};
+
+// The documents and paragraphs served together, shared by the sessions using
+// them and unloaded once none does
+struct Corpus {
+    std::shared_ptr<Dataset> documents;
+    // nullptr when only documents are served
+    std::shared_ptr<ParagraphDataset> paragraphs;
+    // Corpora of the same generation extend one another with more documents
+    // (see CorpusUpdater), a reloaded corpus starts a new generation
+    uint64_t generation = 0;
 };
 
 #endif // DATASET_H
@@ -0,0 +1,60 @@
+#include <iostream>
+
+#include "dataset.h"
+#include "utils/feature_parser.h"
+#include "utils/utils.h"
+#include "utils/simple-cmd-line-helper.h"
+
+using namespace std;
+
+// Packs bin feature files into containers, which bmi_fcgi and bmi_cli load
+// in place of the feature files without parsing them
+int main(int argc, char **argv){
+    AddFlag("--doc-features", "Path of the document feature file", string(""));
+    AddFlag("--df", "Path of the file with list of terms and their document frequencies", string(""));
+    AddFlag("--para-features", "Path of the paragraph feature file", string(""));
+    AddFlag("--out", "Output document container", string(""));
+    AddFlag("--para-out", "Output paragraph container", string(""));
+    AddFlag("--threads", "Number of threads used to parse the feature files", int(1));
+    AddFlag("--compress", "Compress the features, with their values quantized to 16 bits", bool(false));
+    AddFlag("--help", "Show Help", bool(false));
+
+    ParseFlags(argc, argv);
+
+    if(CMD_LINE_BOOLS["--help"]){
+        ShowHelp();
+        return 0;
+    }
+
+    if(CMD_LINE_STRINGS["--doc-features"].length() == 0 || CMD_LINE_STRINGS["--out"].length() == 0)
+        fail("--doc-features or --out missing", 1);
+    if((CMD_LINE_STRINGS["--para-features"].length() == 0) != (CMD_LINE_STRINGS["--para-out"].length() == 0))
+        fail("--para-features and --para-out go together", 1);
+
+    unique_ptr<Dataset> documents;
+    {
+        unique_ptr<FeatureParser> parser;
+        if(CMD_LINE_STRINGS["--df"].size() > 0)
+            parser = make_unique<BinFeatureParser>(CMD_LINE_STRINGS["--doc-features"], CMD_LINE_STRINGS["--df"]);
+        else
+            parser = make_unique<BinFeatureParser>(CMD_LINE_STRINGS["--doc-features"]);
+        documents = Dataset::build(parser.get(), "", 0, CMD_LINE_INTS["--threads"], CMD_LINE_BOOLS["--compress"]);
+    }
+    documents->get_store().save(CMD_LINE_STRINGS["--out"]);
+    cerr<<"Packed "<<documents->size()<<" documents with "<<(documents->get_store().features_size() >> 20)
+        <<" MB of features into "<<CMD_LINE_STRINGS["--out"]<<endl;
+
+    if(CMD_LINE_STRINGS["--para-features"].length() > 0){
+        const string &para_features_path = CMD_LINE_STRINGS["--para-features"];
+        unique_ptr<FeatureParser> parser;
+        if(CMD_LINE_STRINGS["--df"].size() > 0)
+            parser = make_unique<BinFeatureParser>(para_features_path, "");
+        else
+            parser = make_unique<BinFeatureParser>(para_features_path);
+        auto paragraphs = ParagraphDataset::build(parser.get(), *documents, "", 0, CMD_LINE_INTS["--threads"],
+                                                  CMD_LINE_BOOLS["--compress"]);
+        paragraphs->get_store().save(CMD_LINE_STRINGS["--para-out"]);
+        cerr<<"Packed "<<paragraphs->size()<<" paragraphs with "<<(paragraphs->get_store().features_size() >> 20)
+            <<" MB of features into "<<CMD_LINE_STRINGS["--para-out"]<<endl;
+    }
+}
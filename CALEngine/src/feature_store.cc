@@ -0,0 +1,364 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "feature_store.h"
+#include "utils/feature_codec.h"
+#include "utils/utils.h"
+
+using namespace std;
+
+static const char MAGIC[8] = {'C', 'A', 'L', 'S', 'T', 'O', 'R', 'E'};
+static const size_t SECTION_ALIGNMENT = 64;
+
+const uint32_t FeatureStore::VERSION;
+
+static size_t align(size_t offset){
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t len){
+    for(size_t i = 0; i < len; i++){
+        h ^= ((const unsigned char *)data)[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// FNV-1a over 8 byte words, which verifies gigabytes in well under a second
+static uint64_t checksum_bytes(const char *data, size_t len){
+    uint64_t h = 14695981039346656037ULL;
+    size_t i = 0;
+    for(; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)){
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        h = (h ^ word) * 1099511628211ULL;
+    }
+    for(; i < len; i++)
+        h = (h ^ (unsigned char)data[i]) * 1099511628211ULL;
+    return h;
+}
+
+// Everything past the header, padding included
+static uint64_t checksum_image(const char *base, uint64_t total_size){
+    size_t st = align(sizeof(FeatureStore::Header));
+    return checksum_bytes(base + st, total_size - st);
+}
+
+uint64_t FeatureStore::fingerprint(const vector<string> &files, uint64_t seed){
+    uint64_t h = hash_bytes(14695981039346656037ULL, &seed, sizeof(seed));
+    for(const string &file: files){
+        struct stat st;
+        if(stat(file.c_str(), &st) != 0)
+            fail("Failed to stat " + file, -1);
+        int64_t size = st.st_size, mtime_sec = st.st_mtim.tv_sec, mtime_nsec = st.st_mtim.tv_nsec;
+        h = hash_bytes(h, file.data(), file.size() + 1);
+        h = hash_bytes(h, &size, sizeof(size));
+        h = hash_bytes(h, &mtime_sec, sizeof(mtime_sec));
+        h = hash_bytes(h, &mtime_nsec, sizeof(mtime_nsec));
+    }
+    return h;
+}
+
+unique_ptr<FeatureStore> FeatureStore::build(const Contents &contents, uint64_t fingerprint, const string &segment){
+    const ParsedFeatures &parsed = *contents.parsed;
+    const DocIdIndex::View &ids = parsed.doc_ids.get_view();
+    size_t num_docs = parsed.squared_norms.size();
+    uint64_t num_features = parsed.features.size();
+    uint32_t dimensionality = parsed.dimensionality;
+
+    // Terms are sorted by their first 16 bytes, compared as integers, before comparing them whole.
+    // A term listed twice keeps its last id, as it used to in a map.
+    const vector<pair<string, TermInfo>> &dictionary = *contents.dictionary;
+    struct TermKey {
+        uint64_t prefix[2];
+        uint32_t index;
+    };
+    vector<TermKey> keys(dictionary.size());
+    for(size_t i = 0; i < dictionary.size(); i++){
+        unsigned char prefix[sizeof(TermKey::prefix)] = {0};
+        memcpy(prefix, dictionary[i].first.data(), min(dictionary[i].first.size(), sizeof(prefix)));
+        keys[i].prefix[0] = keys[i].prefix[1] = 0;
+        for(size_t j = 0; j < sizeof(prefix); j++)
+            keys[i].prefix[j / 8] = keys[i].prefix[j / 8] << 8 | prefix[j];
+        keys[i].index = i;
+    }
+    sort(keys.begin(), keys.end(), [&dictionary](const TermKey &a, const TermKey &b) -> bool {
+        if(a.prefix[0] != b.prefix[0])
+            return a.prefix[0] < b.prefix[0];
+        if(a.prefix[1] != b.prefix[1])
+            return a.prefix[1] < b.prefix[1];
+        int cmp = dictionary[a.index].first.compare(dictionary[b.index].first);
+        return cmp != 0 ? cmp < 0 : a.index < b.index;
+    });
+    vector<pair<const string *, TermInfo>> terms;
+    terms.reserve(keys.size());
+    for(size_t i = 0; i < keys.size(); i++){
+        const pair<string, TermInfo> &term = dictionary[keys[i].index];
+        if(i + 1 < keys.size() && term.first == dictionary[keys[i + 1].index].first)
+            continue;
+        terms.push_back({&term.first, term.second});
+    }
+    uint64_t term_bytes = 0;
+    for(auto &term: terms)
+        term_bytes += term.first->size();
+
+    // Computed as features::get_features() used to for every query term
+    vector<float> idf;
+    for(auto &term: terms){
+        if((size_t)term.second.id >= idf.size())
+            idf.resize(term.second.id + 1, 0);
+        idf[term.second.id] = log(num_docs / (float)term.second.df);
+    }
+
+    // Encoded one document after another, the last followed by the padding the codec reads past it
+    vector<uint8_t> compressed_features;
+    vector<uint64_t> compressed_offsets;
+    if(contents.compress){
+        compressed_offsets.reserve(num_docs + 1);
+        compressed_offsets.push_back(0);
+        for(size_t i = 0; i < num_docs; i++){
+            feature_codec::encode(parsed.features.data() + parsed.doc_offsets[i],
+                                  parsed.doc_offsets[i + 1] - parsed.doc_offsets[i], compressed_features);
+            compressed_offsets.push_back(compressed_features.size());
+        }
+        compressed_features.resize(compressed_features.size() + feature_codec::PADDING, 0);
+    }
+
+    // Lay out the sections
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.dimensionality = dimensionality;
+    header.compressed = contents.compress;
+    header.fingerprint = fingerprint;
+    header.parent_checksum = contents.parent_checksum;
+
+    header.section_sizes[DOC_OFFSETS] = (num_docs + 1) * sizeof(uint64_t);
+    header.section_sizes[FEATURES] = contents.compress ? compressed_features.size() : num_features * sizeof(FeatureValuePair);
+    header.section_sizes[SQUARED_NORMS] = num_docs * sizeof(float);
+    header.section_sizes[ID_ARENA] = ids.offsets[ids.num_ids];
+    header.section_sizes[ID_OFFSETS] = (ids.num_ids + 1) * sizeof(uint64_t);
+    header.section_sizes[ID_DISPLACEMENTS] = ids.num_buckets * sizeof(uint32_t);
+    header.section_sizes[ID_SLOTS] = ids.num_slots * sizeof(uint32_t);
+    header.section_sizes[TERM_ARENA] = term_bytes;
+    header.section_sizes[TERM_OFFSETS] = (terms.size() + 1) * sizeof(uint64_t);
+    header.section_sizes[TERM_INFO] = terms.size() * sizeof(TermInfo);
+    if(contents.parent_documents != nullptr){
+        header.section_sizes[PARENT_DOCUMENTS] = contents.parent_documents->size() * sizeof(int);
+        header.section_sizes[PARAGRAPH_OFFSETS] = contents.paragraph_offsets->size() * sizeof(uint32_t);
+    }
+    header.section_sizes[IDF] = idf.size() * sizeof(float);
+    header.section_sizes[COMPRESSED_OFFSETS] = compressed_offsets.size() * sizeof(uint64_t);
+
+    size_t offset = align(sizeof(Header));
+    for(int s = 0; s < NUM_SECTIONS; s++){
+        header.section_offsets[s] = offset;
+        offset = align(offset + header.section_sizes[s]);
+    }
+    header.total_size = offset;
+
+    unique_ptr<MemoryRegion> region = segment.empty() ?
+        MemoryRegion::allocate(header.total_size) : MemoryRegion::create(segment, header.total_size);
+    char *base = region->data();
+    auto copy_section = [&](Section s, const void *data){
+        if(header.section_sizes[s] > 0)
+            memcpy(base + header.section_offsets[s], data, header.section_sizes[s]);
+    };
+
+    // Features
+    copy_section(DOC_OFFSETS, parsed.doc_offsets.data());
+    copy_section(FEATURES, contents.compress ? (const void *)compressed_features.data() : parsed.features.data());
+    copy_section(SQUARED_NORMS, parsed.squared_norms.data());
+
+    // Document ids
+    copy_section(ID_ARENA, ids.arena);
+    copy_section(ID_OFFSETS, ids.offsets);
+    copy_section(ID_DISPLACEMENTS, ids.displacements);
+    copy_section(ID_SLOTS, ids.slots);
+
+    // Dictionary
+    char *term_arena = base + header.section_offsets[TERM_ARENA];
+    uint64_t *term_offsets = (uint64_t *)(base + header.section_offsets[TERM_OFFSETS]);
+    TermInfo *term_info = (TermInfo *)(base + header.section_offsets[TERM_INFO]);
+    term_offsets[0] = 0;
+    for(size_t i = 0; i < terms.size(); i++){
+        memcpy(term_arena + term_offsets[i], terms[i].first->data(), terms[i].first->size());
+        term_offsets[i + 1] = term_offsets[i] + terms[i].first->size();
+        term_info[i] = terms[i].second;
+    }
+
+    // Paragraphs
+    if(contents.parent_documents != nullptr){
+        copy_section(PARENT_DOCUMENTS, contents.parent_documents->data());
+        copy_section(PARAGRAPH_OFFSETS, contents.paragraph_offsets->data());
+    }
+    copy_section(IDF, idf.data());
+    copy_section(COMPRESSED_OFFSETS, compressed_offsets.data());
+
+    header.checksum = checksum_image(base, header.total_size);
+    memcpy(base, &header, sizeof(header));
+    region->protect();
+    if(!segment.empty())
+        region->publish(segment);
+    return unique_ptr<FeatureStore>(new FeatureStore(move(region)));
+}
+
+bool FeatureStore::validate(const MemoryRegion &region, const string &name){
+    const Header *header = (const Header *)region.data();
+    if(region.size() < sizeof(Header) || memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0){
+        cerr<<name<<" is not a feature store"<<endl;
+        return false;
+    }
+    if(header->version != VERSION){
+        cerr<<name<<" has version "<<header->version<<", expected "<<VERSION<<endl;
+        return false;
+    }
+    return true;
+}
+
+// True if the `count` offsets at `offsets` never decrease and end within `limit`
+template<typename T>
+static bool offsets_within(const T *offsets, size_t count, uint64_t limit){
+    for(size_t i = 1; i < count; i++)
+        if(offsets[i] < offsets[i - 1])
+            return false;
+    return count == 0 || offsets[count - 1] <= limit;
+}
+
+string FeatureStore::layout_error(const MemoryRegion &region){
+    const Header *header = (const Header *)region.data();
+    if(header->total_size > region.size())
+        return "it is truncated to " + to_string(region.size()) + " of " + to_string(header->total_size) + " bytes";
+    for(int s = 0; s < NUM_SECTIONS; s++){
+        if(header->section_offsets[s] % SECTION_ALIGNMENT != 0 || header->section_offsets[s] < sizeof(Header) ||
+           header->section_offsets[s] > header->total_size ||
+           header->section_sizes[s] > header->total_size - header->section_offsets[s])
+            return "section " + to_string(s) + " lies outside of it";
+    }
+
+    // Every offset into another section lies within that section
+    auto section = [&](Section s){ return region.data() + header->section_offsets[s]; };
+    auto size = [&](Section s){ return header->section_sizes[s]; };
+    size_t num_docs = size(SQUARED_NORMS) / sizeof(float);
+    if(size(DOC_OFFSETS) != (num_docs + 1) * sizeof(uint64_t))
+        return "it has " + to_string(size(DOC_OFFSETS) / sizeof(uint64_t)) + " document offsets for " +
+               to_string(num_docs) + " documents";
+    if(header->compressed == 0 &&
+       !offsets_within((const uint64_t *)section(DOC_OFFSETS), num_docs + 1, size(FEATURES) / sizeof(FeatureValuePair)))
+        return "its document offsets lie outside its features";
+    if(header->compressed != 0 &&
+       (size(COMPRESSED_OFFSETS) != size(DOC_OFFSETS) || size(FEATURES) < feature_codec::PADDING ||
+        !offsets_within((const uint64_t *)section(COMPRESSED_OFFSETS), num_docs + 1, size(FEATURES) - feature_codec::PADDING)))
+        return "its compressed offsets lie outside its features";
+
+    size_t num_ids = size(ID_OFFSETS) / sizeof(uint64_t);
+    if(num_ids == 0 || !offsets_within((const uint64_t *)section(ID_OFFSETS), num_ids, size(ID_ARENA)))
+        return "its document id offsets lie outside its ids";
+    const uint32_t *slots = (const uint32_t *)section(ID_SLOTS);
+    if(size(ID_SLOTS) > 0 && size(ID_DISPLACEMENTS) == 0)
+        return "its document id index has no buckets";
+    for(size_t i = 0; i < size(ID_SLOTS) / sizeof(uint32_t); i++)
+        if(slots[i] >= num_ids - 1 && slots[i] != UINT32_MAX)
+            return "its document id index refers past its ids";
+
+    size_t num_terms = size(TERM_INFO) / sizeof(TermInfo);
+    if(size(TERM_OFFSETS) != (num_terms + 1) * sizeof(uint64_t) ||
+       !offsets_within((const uint64_t *)section(TERM_OFFSETS), num_terms + 1, size(TERM_ARENA)))
+        return "its term offsets lie outside its terms";
+
+    if(size(PARENT_DOCUMENTS) > 0 &&
+       (size(PARENT_DOCUMENTS) != num_docs * sizeof(int) ||
+        !offsets_within((const uint32_t *)section(PARAGRAPH_OFFSETS), size(PARAGRAPH_OFFSETS) / sizeof(uint32_t), num_docs)))
+        return "its paragraph offsets lie outside its paragraphs";
+    return "";
+}
+
+unique_ptr<FeatureStore> FeatureStore::attach(const string &segment, uint64_t fingerprint, bool compressed){
+    unique_ptr<MemoryRegion> region = MemoryRegion::open(segment);
+    if(region == nullptr)
+        return nullptr;
+    if(!validate(*region, "Segment " + segment))
+        return nullptr;
+
+    const Header *header = (const Header *)region->data();
+    if(header->fingerprint != fingerprint){
+        cerr<<"Segment "<<segment<<" was built from different feature files"<<endl;
+        return nullptr;
+    }
+    if((header->compressed != 0) != compressed){
+        cerr<<"Segment "<<segment<<" holds features "<<(compressed ? "not " : "")<<"compressed"<<endl;
+        return nullptr;
+    }
+    string error = layout_error(*region);
+    if(!error.empty())
+        fail("Segment " + segment + " is corrupt, " + error, -1);
+    return unique_ptr<FeatureStore>(new FeatureStore(move(region)));
+}
+
+void FeatureStore::save(const string &path) const {
+    string temp_path = path + ".tmp";
+    FILE *fp = fopen(temp_path.c_str(), "wb");
+    if(fp == nullptr)
+        fail("Failed to create " + temp_path + ": " + strerror(errno), -1);
+    bool ok = fwrite(region->data(), 1, header->total_size, fp) == header->total_size;
+    ok = (fclose(fp) == 0) && ok;
+    if(!ok || rename(temp_path.c_str(), path.c_str()) != 0){
+        unlink(temp_path.c_str());
+        fail("Failed to write " + path, -1);
+    }
+}
+
+unique_ptr<FeatureStore> FeatureStore::load(const string &path, bool verify_checksum){
+    unique_ptr<MemoryRegion> region = MemoryRegion::open(path);
+    if(region == nullptr){
+        cerr<<"Container "<<path<<" not found"<<endl;
+        return nullptr;
+    }
+    if(!validate(*region, "Container " + path))
+        return nullptr;
+    string error = layout_error(*region);
+    if(!error.empty()){
+        cerr<<"Container "<<path<<" is corrupt, "<<error<<endl;
+        return nullptr;
+    }
+
+    const Header *header = (const Header *)region->data();
+    if(verify_checksum && checksum_image(region->data(), header->total_size) != header->checksum){
+        cerr<<"Container "<<path<<" is corrupt, its checksum does not match"<<endl;
+        return nullptr;
+    }
+    return unique_ptr<FeatureStore>(new FeatureStore(move(region)));
+}
+
+bool FeatureStore::is_container(const string &path){
+    char magic[sizeof(MAGIC)];
+    FILE *fp = fopen(path.c_str(), "rb");
+    if(fp == nullptr)
+        return false;
+    bool is_container = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+    fclose(fp);
+    return is_container;
+}
+
+DocIdIndex FeatureStore::get_doc_ids() const {
+    DocIdIndex::View view;
+    view.arena = section<char>(ID_ARENA);
+    view.offsets = section<uint64_t>(ID_OFFSETS);
+    view.num_ids = count<uint64_t>(ID_OFFSETS) - 1;
+    view.displacements = section<uint32_t>(ID_DISPLACEMENTS);
+    view.num_buckets = count<uint32_t>(ID_DISPLACEMENTS);
+    view.slots = section<uint32_t>(ID_SLOTS);
+    view.num_slots = count<uint32_t>(ID_SLOTS);
+    return DocIdIndex(view);
+}
+
+Dictionary FeatureStore::get_dictionary() const {
+    return Dictionary(section<char>(TERM_ARENA), section<uint64_t>(TERM_OFFSETS),
+                      section<TermInfo>(TERM_INFO), count<TermInfo>(TERM_INFO));
+}
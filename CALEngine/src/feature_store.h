@@ -0,0 +1,148 @@
+#ifndef FEATURE_STORE_H
+#define FEATURE_STORE_H
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include "sofiaml/sf-sparse-vector.h"
+#include "utils/features.h"
+#include "utils/doc_id_index.h"
+#include "utils/dictionary.h"
+#include "utils/memory_region.h"
+#include "utils/feature_parser.h"
+
+/*
+ * Flat, position independent image of a dataset: the features in CSR form,
+ * the squared norms, the document id index, the dictionary with the idf of
+ * every term and, for paragraphs, the parent document mapping.
+ *
+ * The image lives either in private memory or in a named segment
+ * (see MemoryRegion) which is built once and then attached read-only by any
+ * number of processes. Segments record the format version and a fingerprint
+ * of the files they were built from, so stale segments are rebuilt.
+ *
+ * The same image saved to a file is the container format for features: it
+ * is loaded by mapping it and verifying its checksum, without any parsing.
+ * Paragraph images record the checksum of their parent documents' image.
+ *
+ * Compressed images hold the features of every document in the encoding of
+ * feature_codec.h instead of as FeatureValuePairs, with their values
+ * quantized, and are scored by decoding them on the fly.
+ */
+class FeatureStore {
+    public:
+    static const uint32_t VERSION = 3;
+
+    enum Section {
+        DOC_OFFSETS,        // uint64_t[num_docs + 1], into FEATURES
+        FEATURES,           // FeatureValuePair[], including the bias term, or their encodings if compressed
+        SQUARED_NORMS,      // float[num_docs]
+        ID_ARENA,           // DocIdIndex::View
+        ID_OFFSETS,
+        ID_DISPLACEMENTS,
+        ID_SLOTS,
+        TERM_ARENA,         // Dictionary, sorted by term
+        TERM_OFFSETS,
+        TERM_INFO,
+        PARENT_DOCUMENTS,   // int[num_docs], paragraphs only
+        PARAGRAPH_OFFSETS,  // uint32_t[num_parents + 1], paragraphs only
+        IDF,                // float[], indexed by term id
+        COMPRESSED_OFFSETS, // uint64_t[num_docs + 1], byte offsets into FEATURES, compressed only
+        NUM_SECTIONS
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t dimensionality;
+        uint32_t compressed;
+        uint64_t fingerprint;
+        uint64_t total_size;
+        uint64_t checksum;          // Of everything past the header
+        uint64_t parent_checksum;   // Checksum of the parent documents, paragraphs only
+        uint64_t section_offsets[NUM_SECTIONS];
+        uint64_t section_sizes[NUM_SECTIONS];
+    };
+
+    // Everything parsed from the feature files, which goes into the image
+    struct Contents {
+        const ParsedFeatures *parsed;
+        const std::vector<std::pair<std::string, TermInfo>> *dictionary;
+        const std::vector<int> *parent_documents = nullptr;
+        const std::vector<uint32_t> *paragraph_offsets = nullptr;
+        uint64_t parent_checksum = 0;
+        bool compress = false;
+    };
+
+    // Builds the image in private memory, or in `segment` when it is not empty
+    static std::unique_ptr<FeatureStore> build(const Contents &contents, uint64_t fingerprint,
+                                               const std::string &segment = "");
+
+    // Attaches to `segment`. Returns nullptr if the segment is missing, stale or not compressed as asked,
+    // and fails if it is corrupt.
+    static std::unique_ptr<FeatureStore> attach(const std::string &segment, uint64_t fingerprint,
+                                                bool compressed = false);
+
+    // Writes the image to the container file `path`
+    void save(const std::string &path) const;
+
+    // Loads the container file `path`. Returns nullptr if it is not a valid container.
+    // Verifying the checksum reads the whole file, which streamed datasets skip.
+    static std::unique_ptr<FeatureStore> load(const std::string &path, bool verify_checksum = true);
+
+    // True if `path` begins like a container file
+    static bool is_container(const std::string &path);
+
+    // Hash of the path, size and modification time of `files`
+    static uint64_t fingerprint(const std::vector<std::string> &files, uint64_t seed = 0);
+
+    uint64_t get_fingerprint() const { return header->fingerprint; }
+    uint64_t get_checksum() const { return header->checksum; }
+    uint64_t get_parent_checksum() const { return header->parent_checksum; }
+    uint32_t get_dimensionality() const { return header->dimensionality; }
+    size_t size() const { return count<float>(SQUARED_NORMS); }
+    bool is_compressed() const { return header->compressed != 0; }
+    // Bytes taken by the features, compressed or not
+    size_t features_size() const { return header->section_sizes[FEATURES]; }
+
+    const uint64_t *get_doc_offsets() const { return section<uint64_t>(DOC_OFFSETS); }
+    const FeatureValuePair *get_features() const { return section<FeatureValuePair>(FEATURES); }
+    const uint8_t *get_compressed_features() const { return section<uint8_t>(FEATURES); }
+    const uint64_t *get_compressed_offsets() const { return section<uint64_t>(COMPRESSED_OFFSETS); }
+    const float *get_squared_norms() const { return section<float>(SQUARED_NORMS); }
+    DocIdIndex get_doc_ids() const;
+    Dictionary get_dictionary() const;
+    const int *get_parent_documents() const { return section<int>(PARENT_DOCUMENTS); }
+    const uint32_t *get_paragraph_offsets() const { return section<uint32_t>(PARAGRAPH_OFFSETS); }
+    const float *get_idf() const { return section<float>(IDF); }
+    size_t num_idf() const { return count<float>(IDF); }
+    const MemoryRegion &get_region() const { return *region; }
+    size_t num_parents() const { return std::max(count<uint32_t>(PARAGRAPH_OFFSETS), (size_t)1) - 1; }
+
+    private:
+    std::unique_ptr<MemoryRegion> region;
+    const Header *header;
+
+    FeatureStore(std::unique_ptr<MemoryRegion> _region):
+        region(std::move(_region)), header((const Header *)region->data()) {}
+
+    // Checks the magic and version of the image in `region`, naming it `name` in errors
+    static bool validate(const MemoryRegion &region, const std::string &name);
+
+    // Describes how a section of the valid image in `region`, or an offset into one, lies outside
+    // the image, or returns an empty string if none does
+    static std::string layout_error(const MemoryRegion &region);
+
+    template<typename T>
+    const T *section(Section s) const {
+        return (const T *)(region->data() + header->section_offsets[s]);
+    }
+
+    template<typename T>
+    size_t count(Section s) const {
+        return header->section_sizes[s] / sizeof(T);
+    }
+};
+
+#endif // FEATURE_STORE_H
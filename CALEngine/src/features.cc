@@ -26,12 +26,11 @@ SfSparseVector features::get_features(const string &text, const Dataset &dataset
     double sum = 0;
     auto &dictionary = dataset.get_dictionary();
     for(pair<string, int> term: get_tf(BMITokenizer().tokenize(text))){
-        auto it = dictionary.find(term.first);
-        if(it != dictionary.end()){
-            int id = it->second.id;
-            int df = it->second.df;
+        const TermInfo *term_info = dictionary.find(term.first);
+        if(term_info != nullptr){
+            int id = term_info->id;
             int tf = term.second;
-            tmp_features.push_back({id, ((1+log(tf)) * log(dataset.size()/(float)df))});
+            tmp_features.push_back({id, ((1+log(tf)) * dataset.get_idf(id))});
             sum += tmp_features.back().second * tmp_features.back().second;
         }
     }
@@ -0,0 +1,272 @@
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "session_manager.h"
+#include "utils/utils.h"
+
+using namespace std;
+
+namespace {
+    const string SPILL_SUFFIX = ".session";
+
+    metrics::Gauge &sessions_active = metrics::gauge("cal_sessions_active", "Number of sessions in memory");
+    metrics::Gauge &sessions_spilled = metrics::gauge("cal_sessions_spilled", "Number of sessions spilled to disk");
+    metrics::Gauge &session_memory = metrics::gauge("cal_session_memory_bytes",
+            "Approximate number of bytes held by the sessions in memory");
+    metrics::Counter &spills = metrics::counter("cal_session_spills_total", "Number of sessions spilled to disk");
+    metrics::Counter &restores = metrics::counter("cal_session_restores_total", "Number of sessions restored from disk");
+
+    // Session ids are hex encoded, so that any id makes a valid file name
+    string encode_session_id(const string &session_id){
+        static const char *HEX = "0123456789abcdef";
+        string encoded;
+        for(unsigned char ch: session_id){
+            encoded.push_back(HEX[ch >> 4]);
+            encoded.push_back(HEX[ch & 15]);
+        }
+        return encoded;
+    }
+
+    bool decode_session_id(const string &encoded, string &session_id){
+        if(encoded.size() % 2 != 0)
+            return false;
+        session_id.clear();
+        for(size_t i = 0; i < encoded.size(); i += 2){
+            int hi = isdigit(encoded[i]) ? encoded[i] - '0' : encoded[i] - 'a' + 10;
+            int lo = isdigit(encoded[i + 1]) ? encoded[i + 1] - '0' : encoded[i + 1] - 'a' + 10;
+            if(hi < 0 || hi > 15 || lo < 0 || lo > 15)
+                return false;
+            session_id.push_back((char)(hi << 4 | lo));
+        }
+        return true;
+    }
+}
+
+SessionManager::SessionManager(Factory _factory, size_t _memory_budget, const string &_spill_dir)
+    :factory(_factory), memory_budget(_memory_budget), spill_dir(_spill_dir)
+{
+    if(spill_dir.empty())
+        return;
+    if(mkdir(spill_dir.c_str(), 0755) != 0 && errno != EEXIST)
+        fail("Failed to create the session spill directory " + spill_dir, -1);
+
+    DIR *dir = opendir(spill_dir.c_str());
+    if(dir == nullptr)
+        fail("Failed to open the session spill directory " + spill_dir, -1);
+    while(dirent *entry = readdir(dir)){
+        string name = entry->d_name, session_id;
+        if(name.size() <= SPILL_SUFFIX.size() || name.compare(name.size() - SPILL_SUFFIX.size(), string::npos, SPILL_SUFFIX) != 0)
+            continue;
+        if(decode_session_id(name.substr(0, name.size() - SPILL_SUFFIX.size()), session_id))
+            sessions[session_id];
+    }
+    closedir(dir);
+    if(sessions.size() > 0)
+        logging::info("Found " + to_string(sessions.size()) + " spilled sessions in " + spill_dir);
+    sessions_spilled.set(sessions.size());
+}
+
+string SessionManager::get_spill_path(const string &session_id) const {
+    return spill_dir + "/" + encode_session_id(session_id) + SPILL_SUFFIX;
+}
+
+void SessionManager::touch(Session &session){
+    lru.splice(lru.begin(), lru, session.lru_position);
+}
+
+bool SessionManager::spill(const string &session_id, Session &session){
+    string path = get_spill_path(session_id), tmp_path = path + ".tmp";
+    FILE *fp = fopen(tmp_path.c_str(), "wb");
+    if(fp == nullptr){
+        logging::warning("Failed to spill session " + session_id + " to " + path);
+        return false;
+    }
+    uint32_t params_length = session.params.size();
+    fwrite(&params_length, sizeof(params_length), 1, fp);
+    fwrite(session.params.data(), 1, params_length, fp);
+    session.bmi->write_state(fp);
+    bool ok = !ferror(fp);
+    ok = (fclose(fp) == 0) && ok;
+    if(!ok || rename(tmp_path.c_str(), path.c_str()) != 0){
+        unlink(tmp_path.c_str());
+        logging::warning("Failed to spill session " + session_id + " to " + path);
+        return false;
+    }
+
+    memory_usage -= session.memory_usage;
+    session.memory_usage = 0;
+    session.corpus = session.bmi->get_corpus();
+    session.bmi = nullptr;
+    lru.erase(session.lru_position);
+    session.lru_position = lru.end();
+    spills.add();
+    logging::info("Spilled session " + session_id);
+    return true;
+}
+
+bool SessionManager::restore(const string &session_id, Session &session){
+    string path = get_spill_path(session_id);
+    FILE *fp = fopen(path.c_str(), "rb");
+    if(fp == nullptr){
+        logging::error("Failed to open spilled session " + session_id + " at " + path);
+        return false;
+    }
+
+    TIMER_BEGIN(session_restore);
+    uint32_t params_length;
+    string params;
+    unique_ptr<BMI> bmi;
+    if(fread(&params_length, sizeof(params_length), 1, fp) == 1){
+        params.resize(params_length);
+        if(fread(&params[0], 1, params_length, fp) == params_length)
+            bmi = factory(params, session.corpus);
+    }
+    bool ok = bmi != nullptr && bmi->read_state(fp);
+    fclose(fp);
+    if(!ok){
+        logging::error("Failed to restore session " + session_id + " from " + path);
+        return false;
+    }
+    unlink(path.c_str());
+    TIMER_END(session_restore);
+
+    session.params = params;
+    session.bmi = move(bmi);
+    session.corpus = Corpus();
+    session.memory_usage = session.bmi->memory_usage();
+    memory_usage += session.memory_usage;
+    lru.push_front(session_id);
+    session.lru_position = lru.begin();
+    restores.add();
+    return true;
+}
+
+void SessionManager::enforce_budget(const string &session_id){
+    if(memory_budget > 0){
+        // Only idle sessions are measured, no other thread can be using them
+        vector<string> candidates;
+        for(const string &id: lru){
+            Session &session = sessions[id];
+            if(id == session_id || session.bmi.use_count() > 1 || !session.bmi->is_idle())
+                continue;
+            memory_usage -= session.memory_usage;
+            session.memory_usage = session.bmi->memory_usage();
+            memory_usage += session.memory_usage;
+            candidates.push_back(id);
+        }
+
+        while(memory_usage > memory_budget && !candidates.empty()){
+            spill(candidates.back(), sessions[candidates.back()]);
+            candidates.pop_back();
+        }
+    }
+
+    sessions_active.set(lru.size());
+    sessions_spilled.set(sessions.size() - lru.size());
+    session_memory.set(memory_usage);
+}
+
+bool SessionManager::add(const string &session_id, const string &params, unique_ptr<BMI> bmi){
+    lock_guard<mutex> lock(sessions_mutex);
+    if(sessions.find(session_id) != sessions.end())
+        return false;
+
+    Session &session = sessions[session_id];
+    session.params = params;
+    session.bmi = move(bmi);
+    session.memory_usage = session.bmi->memory_usage();
+    memory_usage += session.memory_usage;
+    lru.push_front(session_id);
+    session.lru_position = lru.begin();
+    enforce_budget(session_id);
+    return true;
+}
+
+shared_ptr<BMI> SessionManager::get(const string &session_id){
+    lock_guard<mutex> lock(sessions_mutex);
+    auto it = sessions.find(session_id);
+    if(it == sessions.end())
+        return nullptr;
+
+    Session &session = it->second;
+    if(session.bmi == nullptr && !restore(session_id, session))
+        return nullptr;
+    touch(session);
+    enforce_budget(session_id);
+    return session.bmi;
+}
+
+bool SessionManager::contains(const string &session_id){
+    lock_guard<mutex> lock(sessions_mutex);
+    return sessions.find(session_id) != sessions.end();
+}
+
+vector<shared_ptr<BMI>> SessionManager::get_resident(){
+    lock_guard<mutex> lock(sessions_mutex);
+    vector<shared_ptr<BMI>> resident;
+    for(const string &id: lru)
+        resident.push_back(sessions[id].bmi);
+    return resident;
+}
+
+bool SessionManager::remove(const string &session_id){
+    lock_guard<mutex> lock(sessions_mutex);
+    auto it = sessions.find(session_id);
+    if(it == sessions.end())
+        return false;
+
+    Session &session = it->second;
+    if(session.bmi != nullptr){
+        memory_usage -= session.memory_usage;
+        lru.erase(session.lru_position);
+    }else{
+        unlink(get_spill_path(session_id).c_str());
+    }
+    sessions.erase(it);
+    enforce_budget("");
+    return true;
+}
+
+vector<string> SessionManager::get_ids(){
+    lock_guard<mutex> lock(sessions_mutex);
+    vector<string> ids;
+    for(auto &session: sessions)
+        ids.push_back(session.first);
+    return ids;
+}
+
+string SessionManager::get_params(const string &session_id){
+    lock_guard<mutex> lock(sessions_mutex);
+    auto it = sessions.find(session_id);
+    return it != sessions.end() ? it->second.params : "";
+}
+
+bool SessionManager::replace(const string &session_id, const shared_ptr<BMI> &current, unique_ptr<BMI> bmi){
+    lock_guard<mutex> lock(sessions_mutex);
+    auto it = sessions.find(session_id);
+    if(it == sessions.end() || it->second.bmi == nullptr || it->second.bmi != current)
+        return false;
+
+    Session &session = it->second;
+    session.bmi = move(bmi);
+    memory_usage -= session.memory_usage;
+    session.memory_usage = session.bmi->memory_usage();
+    memory_usage += session.memory_usage;
+    touch(session);
+    enforce_budget(session_id);
+    return true;
+}
+
+size_t SessionManager::size(){
+    lock_guard<mutex> lock(sessions_mutex);
+    return sessions.size();
+}
+
+size_t SessionManager::num_resident(){
+    lock_guard<mutex> lock(sessions_mutex);
+    return lru.size();
+}
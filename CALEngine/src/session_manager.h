@@ -0,0 +1,95 @@
+#ifndef SESSION_MANAGER_H
+#define SESSION_MANAGER_H
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "bmi.h"
+
+/*
+ * Sessions by id, kept in memory within a budget of bytes.
+ *
+ * When the sessions in memory exceed the budget, the least recently used idle
+ * ones are spilled to a file in the spill directory, holding the parameters
+ * the session was begun with and its judgments and state. A spilled session
+ * is rebuilt from its parameters and restored from the file on its next
+ * access. Spilled sessions found in the spill directory on construction can
+ * be resumed as well.
+ *
+ * A spilled session's state refers to documents by index, so the corpus it
+ * was using stays held until it is restored onto that same corpus.
+ */
+class SessionManager {
+    public:
+    // Builds a session on `corpus` from the parameters it was begun with, without
+    // performing an iteration. `corpus` is empty for sessions spilled by an earlier
+    // process. Returns nullptr for invalid parameters
+    typedef std::function<std::unique_ptr<BMI>(const std::string &params, const Corpus &corpus)> Factory;
+
+    private:
+    struct Session {
+        std::string params;
+        // nullptr while spilled
+        std::shared_ptr<BMI> bmi;
+        // The corpus held by the session while spilled
+        Corpus corpus;
+        size_t memory_usage = 0;
+        // Position in `lru`, only valid while in memory
+        std::list<std::string>::iterator lru_position;
+    };
+
+    Factory factory;
+    size_t memory_budget;
+    std::string spill_dir;
+
+    std::mutex sessions_mutex;
+    std::unordered_map<std::string, Session> sessions;
+    // Ids of the sessions in memory, most recently used first
+    std::list<std::string> lru;
+    size_t memory_usage = 0;
+
+    std::string get_spill_path(const std::string &session_id) const;
+    void touch(Session &session);
+    bool spill(const std::string &session_id, Session &session);
+    bool restore(const std::string &session_id, Session &session);
+    // Spills idle sessions, other than `session_id`, until within the budget
+    void enforce_budget(const std::string &session_id);
+
+    public:
+    // A `memory_budget` of 0 keeps every session in memory
+    SessionManager(Factory factory, size_t memory_budget, const std::string &spill_dir);
+
+    // Returns false if a session with the same id exists
+    bool add(const std::string &session_id, const std::string &params, std::unique_ptr<BMI> bmi);
+
+    // Returns the session, restoring it if spilled, or nullptr if not found.
+    // The session stays in memory as long as the returned pointer is held
+    std::shared_ptr<BMI> get(const std::string &session_id);
+
+    bool contains(const std::string &session_id);
+
+    // Returns the sessions in memory, which stay there as long as the returned pointers are held
+    std::vector<std::shared_ptr<BMI>> get_resident();
+
+    // Returns false if the session is not found
+    bool remove(const std::string &session_id);
+
+    // Ids of every session, in memory or spilled
+    std::vector<std::string> get_ids();
+
+    // The parameters the session was begun with, empty if it is not found
+    std::string get_params(const std::string &session_id);
+
+    // Replaces the session with `bmi`, keeping its parameters, if the session still is
+    // `current`. Returns false otherwise. Requests holding `current` keep using it.
+    bool replace(const std::string &session_id, const std::shared_ptr<BMI> &current, std::unique_ptr<BMI> bmi);
+
+    size_t size();
+    size_t num_resident();
+};
+
+#endif // SESSION_MANAGER_H
@@ -43,6 +43,18 @@ SfSparseVector::SfSparseVector(string doc_id, const vector<FeatureValuePair> &fe
         PushPair(feature_value_pair.id_, feature_value_pair.value_);
 }
 
+SfSparseVector::SfSparseVector(const FeatureValuePair* features,
+                               size_t num_features, float squared_norm)
+  : features_(features, num_features), squared_norm_(squared_norm)
+{
+}
+
+SfSparseVector::SfSparseVector(vector<FeatureValuePair> features,
+                               float squared_norm)
+  : features_(std::move(features)), squared_norm_(squared_norm)
+{
+}
+
 void SfSparseVector::PushPair(uint32_t id, float value) {
   if (id > 0 && NumFeatures() > 0 && id <= FeatureAt(NumFeatures() - 1) ) {
     std::cerr << id << " vs. " << FeatureAt(NumFeatures() - 1) << std::endl;
@@ -58,6 +58,58 @@ struct FeatureValuePair {
   float value_;
 };
 
+// A run of FeatureValuePairs. The pairs are either owned by the array, or
+// the array is a read-only view into memory managed elsewhere (such as a
+// FeatureStore), in which case push_back must not be used.
+class FeatureArray {
+ public:
+  FeatureArray() {}
+  FeatureArray(const FeatureValuePair* data, size_t size)
+    : data_(data), size_(size) {}
+  explicit FeatureArray(vector<FeatureValuePair> storage)
+    : storage_(std::move(storage)), data_(storage_.data()), size_(storage_.size()) {}
+  FeatureArray(const FeatureArray& other) { *this = other; }
+  FeatureArray(FeatureArray&& other) { *this = std::move(other); }
+
+  FeatureArray& operator=(const FeatureArray& other) {
+    storage_ = other.storage_;
+    data_ = other.IsView() ? other.data_ : storage_.data();
+    size_ = other.size_;
+    return *this;
+  }
+
+  FeatureArray& operator=(FeatureArray&& other) {
+    bool is_view = other.IsView();
+    storage_ = std::move(other.storage_);
+    data_ = is_view ? other.data_ : storage_.data();
+    size_ = other.size_;
+    other.storage_.clear();
+    other.data_ = nullptr;
+    other.size_ = 0;
+    return *this;
+  }
+
+  void push_back(const FeatureValuePair& feature_value_pair) {
+    storage_.push_back(feature_value_pair);
+    data_ = storage_.data();
+    size_ = storage_.size();
+  }
+
+  inline size_t size() const { return size_; }
+  inline bool empty() const { return size_ == 0; }
+  inline const FeatureValuePair& operator[](size_t i) const { return data_[i]; }
+  inline const FeatureValuePair& back() const { return data_[size_ - 1]; }
+  inline const FeatureValuePair* begin() const { return data_; }
+  inline const FeatureValuePair* end() const { return data_ + size_; }
+
+ private:
+  bool IsView() const { return data_ != storage_.data(); }
+
+  vector<FeatureValuePair> storage_;
+  const FeatureValuePair* data_ = nullptr;
+  size_t size_ = 0;
+};
+
 class SfSparseVector {
  public:
   // Construct a new vector from a string.  Input format is svm-light format:
@@ -66,6 +118,15 @@ class SfSparseVector {
   SfSparseVector(const vector<FeatureValuePair> &feature_vector);
   SfSparseVector(string doc_id, const vector<FeatureValuePair> &feature_vector);
 
+  // Constructs a view of `num_features` pairs at `features`, which must
+  // already include the bias term. The pairs are not copied and must
+  // outlive the vector.
+  SfSparseVector(const FeatureValuePair* features, size_t num_features,
+                 float squared_norm);
+
+  // Takes the pairs `features`, which must already include the bias term.
+  SfSparseVector(vector<FeatureValuePair> features, float squared_norm);
+
   float GetSquaredNorm() const { return squared_norm_; }
 
   // Methods for interacting with features
@@ -82,7 +143,7 @@ class SfSparseVector {
   // Typically, only non-zero valued features are stored.  This vector is assumed
   // to hold feature id, feature value pairs in order sorted by feature id.  The
   // special feature id 0 is always set to 1, encoding bias.
-  vector<FeatureValuePair> features_;
+  FeatureArray features_;
 
  private:
 
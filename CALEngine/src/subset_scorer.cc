@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <thread>
+#include "subset_scorer.h"
+
+using namespace std;
+
+SubsetScorer::SubsetScorer(const Dataset &dataset, vector<int> _indices): indices(move(_indices)) {
+    sort(indices.begin(), indices.end());
+
+    size_t num_features = 0;
+    for(int idx: indices)
+        num_features += dataset.get_sf_sparse_vector(idx).NumFeatures();
+
+    offsets.reserve(indices.size() + 1);
+    features.reserve(num_features);
+    offsets.push_back(0);
+    for(int idx: indices){
+        SfSparseVector spv = dataset.get_sf_sparse_vector(idx);
+        features.insert(features.end(), spv.features_.begin(), spv.features_.end());
+        offsets.push_back(features.size());
+    }
+}
+
+void SubsetScorer::score_members(const vector<float> &weights,
+                                 size_t st, size_t end,
+                                 size_t num_top_docs,
+                                 const AtomicBitset &judged,
+                                 vector<pair<float, int>> &top_docs,
+                                 const tracing::Context &context) const {
+    tracing::ScopedContext scoped_context(context);
+    tracing::Span span("scan");
+    top_docs.reserve(num_top_docs + 1);
+    for(size_t i = st; i < end; i++){
+        if(judged.test(indices[i]))
+            continue;
+
+        float score = 0;
+        for(uint32_t j = offsets[i]; j < offsets[i + 1]; j++)
+            score += weights[features[j].id_] * features[j].value_;
+
+        pair<float, int> doc = {-score, indices[i]};
+        if(top_docs.size() < num_top_docs){
+            top_docs.push_back(doc);
+            push_heap(top_docs.begin(), top_docs.end());
+        } else if(doc < top_docs.front()){
+            pop_heap(top_docs.begin(), top_docs.end());
+            top_docs.back() = doc;
+            push_heap(top_docs.begin(), top_docs.end());
+        }
+    }
+}
+
+vector<int> SubsetScorer::rescore(const vector<float> &weights, int num_threads, int num_top_docs, const AtomicBitset &judged) const {
+    if(num_top_docs <= 0)
+        return {};
+    Dataset::documents_scanned.add(indices.size());
+
+    vector<vector<pair<float, int>>> thread_top_docs(num_threads);
+    vector<thread> t;
+    for(int i = 0; i < num_threads; i++){
+        t.push_back(
+            thread(
+                &SubsetScorer::score_members,
+                this,
+                cref(weights),
+                i * indices.size() / num_threads,
+                (i + 1) * indices.size() / num_threads,
+                (size_t)num_top_docs,
+                cref(judged),
+                ref(thread_top_docs[i]),
+                cref(tracing::get_context())
+            )
+        );
+    }
+    for(thread &x: t) x.join();
+
+    vector<pair<float, int>> top_docs;
+    for(auto &docs: thread_top_docs)
+        top_docs.insert(top_docs.end(), docs.begin(), docs.end());
+    if(top_docs.size() > (size_t)num_top_docs){
+        nth_element(top_docs.begin(), top_docs.begin() + num_top_docs, top_docs.end());
+        top_docs.resize(num_top_docs);
+    }
+
+    // Increasing order of score
+    sort(top_docs.begin(), top_docs.end(), greater<pair<float, int>>());
+    vector<int> results;
+    for(auto &doc: top_docs)
+        results.push_back(doc.second);
+    return results;
+}
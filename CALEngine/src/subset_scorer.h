@@ -0,0 +1,37 @@
+#ifndef SUBSET_SCORER_H
+#define SUBSET_SCORER_H
+
+#include <vector>
+#include "dataset.h"
+
+/*
+ * Compact copy of a subset of the documents of a dataset, for strategies
+ * which repeatedly rescore the same few documents. The features of the
+ * subset are packed in CSR form in document order, so a rescore streams
+ * through memory small enough to stay in cache.
+ */
+class SubsetScorer {
+    std::vector<int> indices;             // Document index of every member, ascending
+    std::vector<uint32_t> offsets;        // Features of member i are [offsets[i], offsets[i+1])
+    std::vector<FeatureValuePair> features;
+
+    // Keeps the best {-score, document index} pairs of the members [st, end) in `top_docs`, a max-heap
+    void score_members(const std::vector<float> &weights,
+                       size_t st, size_t end,
+                       size_t num_top_docs,
+                       const AtomicBitset &judged,
+                       std::vector<std::pair<float, int>> &top_docs,
+                       const tracing::Context &context) const;
+
+    public:
+    SubsetScorer(const Dataset &dataset, std::vector<int> indices);
+
+    // Same as Dataset::rescore(), restricted to the subset
+    std::vector<int> rescore(const std::vector<float> &weights,
+                             int num_threads, int num_top_docs,
+                             const AtomicBitset &judged) const;
+
+    size_t size() const { return indices.size(); }
+};
+
+#endif // SUBSET_SCORER_H
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include "term_index.h"
+#include "dataset.h"
+#include "utils/select.h"
+
+using namespace std;
+
+// Runs fn(i, st, end) on num_threads contiguous chunks of [0, n), chunk i on thread i
+template<typename F>
+static void parallel_for(size_t n, int num_threads, F fn){
+    vector<thread> t;
+    for(int i = 0; i < num_threads; i++)
+        t.push_back(thread(fn, i, i * n / num_threads, (i + 1) * n / num_threads));
+    for(thread &x: t) x.join();
+}
+
+TermIndex::TermIndex(const Dataset &dataset, size_t _num_terms, int num_threads):
+    num_terms(_num_terms), term_offsets(dataset.get_dimensionality() + 1, 0),
+    max_values(dataset.get_dimensionality(), 0), masses(dataset.get_dimensionality(), 0), norms(dataset.size(), 0)
+{
+    size_t num_docs = dataset.size(), dimensionality = dataset.get_dimensionality();
+
+    // Every thread counts the postings of its documents, so it can write them in document
+    // order from where the postings of the threads before it end
+    vector<vector<uint64_t>> positions(num_threads, vector<uint64_t>(dimensionality, 0));
+    parallel_for(num_docs, num_threads, [&](int part, size_t st, size_t end){
+        for(size_t i = st; i < end; i++){
+            SfSparseVector spv = dataset.get_sf_sparse_vector(i);
+            for(int j = 0; j < spv.NumFeatures(); j++){
+                uint32_t id = spv.FeatureAt(j);
+                if(id != 0 && id < dimensionality)
+                    positions[part][id]++;
+            }
+        }
+    });
+    uint64_t num_postings = 0;
+    for(size_t t = 0; t < dimensionality; t++){
+        term_offsets[t] = num_postings;
+        for(int part = 0; part < num_threads; part++){
+            uint64_t count = positions[part][t];
+            positions[part][t] = num_postings;
+            num_postings += count;
+        }
+    }
+    term_offsets[dimensionality] = num_postings;
+
+    posting_docs.resize(num_postings);
+    posting_values.resize(num_postings);
+    parallel_for(num_docs, num_threads, [&](int part, size_t st, size_t end){
+        for(size_t i = st; i < end; i++){
+            SfSparseVector spv = dataset.get_sf_sparse_vector(i);
+            for(int j = 0; j < spv.NumFeatures(); j++){
+                uint32_t id = spv.FeatureAt(j);
+                if(id == 0 || id >= dimensionality)
+                    continue;
+                uint64_t position = positions[part][id]++;
+                posting_docs[position] = i;
+                posting_values[position] = spv.ValueAt(j);
+                norms[i] += fabs(spv.ValueAt(j));
+            }
+        }
+    });
+
+    parallel_for(dimensionality, num_threads, [&](int part, size_t st, size_t end){
+        for(size_t t = st; t < end; t++){
+            for(uint64_t p = term_offsets[t]; p < term_offsets[t + 1]; p++){
+                max_values[t] = max(max_values[t], fabs(posting_values[p]));
+                masses[t] += fabs(posting_values[p]);
+            }
+        }
+    });
+}
+
+vector<float> TermIndex::estimate(const vector<float> &weights, const AtomicBitset &judged, int num_threads) const {
+    size_t dimensionality = min(weights.size(), max_values.size());
+    vector<float> bounds(dimensionality);
+    for(size_t t = 0; t < dimensionality; t++)
+        bounds[t] = fabs(weights[t]) * max_values[t];
+    vector<int> heavy_terms;
+    for(int t: select_top_k(bounds.data(), dimensionality, num_terms, num_threads))
+        if(bounds[t] > 0)
+            heavy_terms.push_back(t);
+
+    // Mean weight of the other terms
+    double rest_weight = 0, rest_mass = 0;
+    for(size_t t = 0; t < dimensionality; t++){
+        rest_weight += (double)weights[t] * masses[t];
+        rest_mass += masses[t];
+    }
+    for(int t: heavy_terms){
+        rest_weight -= (double)weights[t] * masses[t];
+        rest_mass -= masses[t];
+    }
+    float mean_weight = rest_mass > 0 ? rest_weight / rest_mass : 0;
+
+    vector<float> estimates(size(), 0);
+    parallel_for(size(), num_threads, [&](int part, size_t st, size_t end){
+        // Postings of every term are in document order, so each thread reads only those of its documents
+        vector<float> heavy_norms(end - st, 0);
+        for(int t: heavy_terms){
+            float weight = weights[t];
+            const uint32_t *last = posting_docs.data() + term_offsets[t + 1];
+            for(const uint32_t *doc = lower_bound(posting_docs.data() + term_offsets[t], last, (uint32_t)st);
+                doc < last && *doc < end; doc++){
+                float value = posting_values[doc - posting_docs.data()];
+                estimates[*doc] += weight * value;
+                heavy_norms[*doc - st] += fabs(value);
+            }
+        }
+        for(size_t i = st; i < end; i++)
+            estimates[i] = judged.test(i) ? -INFINITY : estimates[i] + mean_weight * (norms[i] - heavy_norms[i - st]);
+    });
+    return estimates;
+}
@@ -0,0 +1,44 @@
+#ifndef TERM_INDEX_H
+#define TERM_INDEX_H
+
+#include <cstdint>
+#include <vector>
+#include "utils/atomic_bitset.h"
+
+class Dataset;
+
+/*
+ * Inverted index of the features of a dataset, from which the documents
+ * likely to score highest under some weights are found by reading the
+ * postings of only a few terms.
+ *
+ * The estimate of a document is its exact partial score over the
+ * `num_terms` terms whose weight times largest value is highest, the terms
+ * which can move a score the most, plus the rest of its L1 norm times the
+ * mean weight of every other term, weighted by how much of the corpus the
+ * term makes up. The bias term adds the same to every score, so it is not
+ * indexed.
+ */
+class TermIndex {
+    size_t num_terms;
+    std::vector<uint64_t> term_offsets;     // Postings of term t are [term_offsets[t], term_offsets[t+1])
+    std::vector<uint32_t> posting_docs;     // In increasing order within every term
+    std::vector<float> posting_values;
+    std::vector<float> max_values;          // Largest value of every term
+    std::vector<float> masses;              // Sum of the values of every term
+    std::vector<float> norms;               // L1 norm of every document
+
+    public:
+    // Indexes every document of `dataset` on num_threads threads
+    TermIndex(const Dataset &dataset, size_t num_terms, int num_threads = 1);
+
+    // Estimated score of every document under `weights`, -infinity for the documents in `judged`
+    std::vector<float> estimate(const std::vector<float> &weights, const AtomicBitset &judged,
+                                int num_threads) const;
+
+    size_t size() const { return norms.size(); }
+    size_t get_num_terms() const { return num_terms; }
+    size_t num_postings() const { return posting_docs.size(); }
+};
+
+#endif // TERM_INDEX_H
@@ -0,0 +1,55 @@
+#ifndef ATOMIC_BITSET_H
+#define ATOMIC_BITSET_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// Fixed size bitset which can be updated while other threads are reading it.
+// Out of range bits read as unset.
+class AtomicBitset {
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+    size_t num_bits;
+
+    public:
+    static const uint64_t FULL_WORD = ~0ULL;
+
+    AtomicBitset(size_t _num_bits = 0): words(new std::atomic<uint64_t>[(_num_bits + 63) / 64]), num_bits(_num_bits) {
+        for(size_t i = 0; i < num_words(); i++)
+            words[i].store(0, std::memory_order_relaxed);
+    }
+
+    // Grows or shrinks the bitset keeping the bits in range. Not safe while
+    // other threads use the bitset
+    void resize(size_t _num_bits) {
+        AtomicBitset resized(_num_bits);
+        for(size_t i = 0; i < std::min(num_words(), resized.num_words()); i++)
+            resized.words[i].store(words[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        if(_num_bits % 64 != 0 && resized.num_words() > 0)
+            resized.words[resized.num_words() - 1].fetch_and((1ULL << (_num_bits % 64)) - 1, std::memory_order_relaxed);
+        *this = std::move(resized);
+    }
+
+    void set(size_t idx) {
+        words[idx >> 6].fetch_or(1ULL << (idx & 63), std::memory_order_relaxed);
+    }
+
+    void reset(size_t idx) {
+        words[idx >> 6].fetch_and(~(1ULL << (idx & 63)), std::memory_order_relaxed);
+    }
+
+    bool test(size_t idx) const {
+        return idx < num_bits && ((words[idx >> 6].load(std::memory_order_relaxed) >> (idx & 63)) & 1);
+    }
+
+    // Returns the 64 bits starting at bit `64 * idx`
+    uint64_t word(size_t idx) const {
+        return idx < num_words() ? words[idx].load(std::memory_order_relaxed) : 0;
+    }
+
+    size_t size() const { return num_bits; }
+    size_t num_words() const { return (num_bits + 63) / 64; }
+};
+
+#endif // ATOMIC_BITSET_H
@@ -0,0 +1,49 @@
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "features.h"
+
+// Read-only view of a vocabulary sorted by term. Terms are stored back to
+// back in `arena`, the i-th term spans [offsets[i], offsets[i+1]).
+class Dictionary {
+    const char *arena = nullptr;
+    const uint64_t *offsets = nullptr;
+    const TermInfo *term_info = nullptr;
+    size_t num_terms = 0;
+
+    int compare(size_t idx, const char *term, size_t len) const {
+        size_t term_len = offsets[idx + 1] - offsets[idx];
+        int cmp = memcmp(arena + offsets[idx], term, std::min(term_len, len));
+        if(cmp != 0) return cmp;
+        return term_len < len ? -1 : (term_len > len ? 1 : 0);
+    }
+
+    public:
+    Dictionary() {}
+    Dictionary(const char *_arena, const uint64_t *_offsets, const TermInfo *_term_info, size_t _num_terms):
+        arena(_arena), offsets(_offsets), term_info(_term_info), num_terms(_num_terms) {}
+
+    // Returns the TermInfo of `term`, nullptr if not found
+    const TermInfo *find(const std::string &term) const {
+        size_t lo = 0, hi = num_terms;
+        while(lo < hi){
+            size_t mid = lo + (hi - lo) / 2;
+            int cmp = compare(mid, term.data(), term.size());
+            if(cmp == 0) return term_info + mid;
+            if(cmp < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        return nullptr;
+    }
+
+    // The i-th term in sorted order, and its TermInfo
+    std::string get_term(size_t i) const { return std::string(arena + offsets[i], offsets[i + 1] - offsets[i]); }
+    const TermInfo &get_term_info(size_t i) const { return term_info[i]; }
+
+    size_t size() const { return num_terms; }
+};
+
+#endif // DICTIONARY_H
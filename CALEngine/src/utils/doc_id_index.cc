@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cstring>
+#include "doc_id_index.h"
+#include "utils.h"
+
+using namespace std;
+
+const uint32_t DocIdIndex::EMPTY_SLOT;
+const size_t DocIdIndex::NPOS;
+
+// FNV-1a
+uint64_t DocIdIndex::hash(const char *str, size_t len){
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i = 0; i < len; i++){
+        h ^= (unsigned char)str[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+uint64_t DocIdIndex::get_bucket(uint64_t h) const {
+    return (h >> 32) % view.num_buckets;
+}
+
+// splitmix64 finalizer over the id hash and the bucket displacement
+uint64_t DocIdIndex::get_slot(uint64_t h, uint32_t displacement) const {
+    uint64_t x = h + (displacement + 1) * 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x = x ^ (x >> 31);
+    return x % view.num_slots;
+}
+
+void DocIdIndex::update_view(){
+    view.arena = arena.data();
+    view.offsets = offsets.data();
+    view.num_ids = offsets.size() - 1;
+    view.displacements = displacements.data();
+    view.num_buckets = displacements.size();
+    view.slots = slots.data();
+    view.num_slots = slots.size();
+}
+
+void DocIdIndex::reserve(size_t num_ids, size_t num_bytes){
+    offsets.reserve(num_ids + 1);
+    arena.reserve(num_bytes);
+}
+
+size_t DocIdIndex::push_back(const char *str, size_t len){
+    arena.insert(arena.end(), str, str + len);
+    offsets.push_back(arena.size());
+    update_view();
+    return size() - 1;
+}
+
+void DocIdIndex::build(){
+    size_t n = size();
+    if(n >= EMPTY_SLOT)
+        fail("Too many document ids to index", -1);
+
+    displacements.assign(n / 4 + 1, 0);
+    slots.assign(n + n / 4 + 1, EMPTY_SLOT);
+    update_view();
+
+    vector<uint64_t> hashes(n);
+    for(size_t i = 0; i < n; i++)
+        hashes[i] = hash(data(i), length(i));
+
+    // Group the handles by bucket, preserving their order within a bucket
+    size_t num_buckets = displacements.size();
+    vector<uint32_t> bucket_start(num_buckets + 1, 0);
+    for(size_t i = 0; i < n; i++)
+        bucket_start[get_bucket(hashes[i]) + 1]++;
+    for(size_t b = 0; b < num_buckets; b++)
+        bucket_start[b + 1] += bucket_start[b];
+
+    vector<uint32_t> bucket_members(n);
+    {
+        vector<uint32_t> cursor(bucket_start.begin(), bucket_start.end() - 1);
+        for(size_t i = 0; i < n; i++)
+            bucket_members[cursor[get_bucket(hashes[i])]++] = i;
+    }
+
+    // Place the largest buckets first, while the table is still mostly empty
+    vector<uint32_t> order(num_buckets);
+    for(size_t b = 0; b < num_buckets; b++)
+        order[b] = b;
+    stable_sort(order.begin(), order.end(), [&bucket_start](uint32_t a, uint32_t b) -> bool {
+        return bucket_start[a + 1] - bucket_start[a] > bucket_start[b + 1] - bucket_start[b];
+    });
+
+    vector<uint32_t> members;
+    vector<uint64_t> candidate_slots;
+    for(uint32_t b: order){
+        if(bucket_start[b + 1] == bucket_start[b])
+            break;
+
+        members.clear();
+        for(uint32_t i = bucket_start[b]; i < bucket_start[b + 1]; i++){
+            uint32_t handle = bucket_members[i];
+            bool duplicate = false;
+            for(uint32_t &member: members){
+                if(hashes[member] != hashes[handle])
+                    continue;
+                if(length(member) != length(handle) || memcmp(data(member), data(handle), length(handle)) != 0)
+                    fail("Hash collision between document ids " + get(member) + " and " + get(handle), -1);
+                member = handle;
+                duplicate = true;
+            }
+            if(!duplicate)
+                members.push_back(handle);
+        }
+
+        for(uint32_t displacement = 0;; displacement++){
+            if(displacement == UINT32_MAX)
+                fail("Failed to build document id index", -1);
+
+            candidate_slots.clear();
+            for(uint32_t member: members){
+                uint64_t slot = get_slot(hashes[member], displacement);
+                if(slots[slot] != EMPTY_SLOT ||
+                   std::find(candidate_slots.begin(), candidate_slots.end(), slot) != candidate_slots.end())
+                    break;
+                candidate_slots.push_back(slot);
+            }
+
+            if(candidate_slots.size() == members.size()){
+                for(size_t i = 0; i < members.size(); i++)
+                    slots[candidate_slots[i]] = members[i];
+                displacements[b] = displacement;
+                break;
+            }
+        }
+    }
+}
+
+size_t DocIdIndex::find(const char *str, size_t len) const {
+    if(view.num_slots == 0)
+        return NPOS;
+    uint64_t h = hash(str, len);
+    uint32_t handle = view.slots[get_slot(h, view.displacements[get_bucket(h)])];
+    if(handle == EMPTY_SLOT || length(handle) != len || memcmp(data(handle), str, len) != 0)
+        return NPOS;
+    return handle;
+}
@@ -0,0 +1,86 @@
+#ifndef DOC_ID_INDEX_H
+#define DOC_ID_INDEX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Interned document ids.
+ *
+ * Ids are stored back to back in a single character arena and are looked up
+ * through a perfect hash (hash and displace) built once after all ids are
+ * added. Every lookup costs one hash, one table probe and one string compare.
+ * Everything past the API boundary refers to documents by their handle, which
+ * is the position at which the id was added.
+ *
+ * An index can also be a read-only view of the arrays of another index, such
+ * as a copy placed in a FeatureStore.
+ */
+class DocIdIndex {
+    public:
+    // Raw arrays backing an index
+    struct View {
+        const char *arena = nullptr;
+        const uint64_t *offsets = nullptr;
+        size_t num_ids = 0;
+        const uint32_t *displacements = nullptr;
+        size_t num_buckets = 0;
+        const uint32_t *slots = nullptr;
+        size_t num_slots = 0;
+    };
+
+    private:
+    std::vector<char> arena;
+    std::vector<uint64_t> offsets = {0};
+
+    // Displacement per bucket and handle per slot of the perfect hash
+    std::vector<uint32_t> displacements;
+    std::vector<uint32_t> slots;
+
+    // All lookups go through the view, which points either into the vectors above or elsewhere
+    View view;
+
+    static const uint32_t EMPTY_SLOT = UINT32_MAX;
+
+    void update_view();
+
+    uint64_t get_slot(uint64_t h, uint32_t displacement) const;
+    uint64_t get_bucket(uint64_t h) const;
+
+    public:
+    static const size_t NPOS = SIZE_MAX;
+
+    // FNV-1a, also stored in the index of bin feature files so it must not change
+    static uint64_t hash(const char *str, size_t len);
+
+    DocIdIndex() { update_view(); }
+    explicit DocIdIndex(const View &_view): view(_view) {}
+    DocIdIndex(DocIdIndex &&) = default;
+    DocIdIndex &operator=(DocIdIndex &&) = default;
+    DocIdIndex(const DocIdIndex &) = delete;
+    DocIdIndex &operator=(const DocIdIndex &) = delete;
+
+    void reserve(size_t num_ids, size_t num_bytes);
+
+    // Appends `id` to the arena and returns its handle. Lookups only see ids
+    // added before the last call to build().
+    size_t push_back(const char *str, size_t len);
+    size_t push_back(const std::string &id) { return push_back(id.data(), id.size()); }
+
+    // Builds the lookup table. In case of duplicate ids, the last one wins.
+    void build();
+
+    // Returns the handle of the given id, DocIdIndex::NPOS if not found
+    size_t find(const char *str, size_t len) const;
+    size_t find(const std::string &id) const { return find(id.data(), id.size()); }
+
+    const char *data(size_t handle) const { return view.arena + view.offsets[handle]; }
+    size_t length(size_t handle) const { return view.offsets[handle + 1] - view.offsets[handle]; }
+    std::string get(size_t handle) const { return std::string(data(handle), length(handle)); }
+
+    size_t size() const { return view.num_ids; }
+    const View &get_view() const { return view; }
+};
+
+#endif // DOC_ID_INDEX_H
@@ -0,0 +1,71 @@
+#include <cmath>
+#include "feature_codec.h"
+
+using namespace std;
+
+namespace feature_codec {
+    static const float MAX_VALUE = 32767;
+
+    static constexpr GroupLayouts make_group_layouts() {
+        GroupLayouts layouts{};
+        for(int control = 0; control < 256; control++){
+            uint8_t offset = 0;
+            for(int k = 0; k < 4; k++){
+                layouts.of[control].offsets[k] = offset;
+                offset += (control >> (2 * k) & 3) + 1;
+            }
+            layouts.of[control].length = offset;
+        }
+        return layouts;
+    }
+
+    const GroupLayouts GROUP_LAYOUTS = make_group_layouts();
+    const uint32_t GAP_MASKS[4] = {0xff, 0xffff, 0xffffff, 0xffffffff};
+
+    void encode(const FeatureValuePair *features, size_t n, vector<uint8_t> &out) {
+        float max_value = 0;
+        for(size_t i = 0; i < n; i++)
+            max_value = max(max_value, fabs(features[i].value_));
+        int exponent = 0;
+        if(max_value > 0)
+            frexp(max_value / MAX_VALUE, &exponent);
+        float scale = ldexp(1.0f, exponent);
+
+        size_t st = out.size();
+        out.resize(st + sizeof(float) + n * sizeof(int16_t) + (n + 3) / 4, 0);
+        memcpy(&out[st], &scale, sizeof(scale));
+        size_t values = st + sizeof(float), controls = values + n * sizeof(int16_t);
+        uint32_t prev_id = 0;
+        for(size_t i = 0; i < n; i++){
+            int16_t value = (int16_t)lrint(features[i].value_ / scale);
+            memcpy(&out[values + i * sizeof(int16_t)], &value, sizeof(value));
+
+            // Ids out of order wrap around, and decode all the same
+            uint32_t gap = features[i].id_ - prev_id;
+            prev_id = features[i].id_;
+            int length = gap < (1u << 8) ? 1 : gap < (1u << 16) ? 2 : gap < (1u << 24) ? 3 : 4;
+            out[controls + i / 4] |= (length - 1) << (2 * (i % 4));
+            for(int k = 0; k < length; k++)
+                out.push_back(gap >> (8 * k) & 0xff);
+        }
+    }
+
+    void decode(const uint8_t *in, size_t n, FeatureValuePair *out) {
+        float scale;
+        memcpy(&scale, in, sizeof(scale));
+        const uint8_t *values = in + sizeof(float);
+        const uint8_t *controls = values + n * sizeof(int16_t);
+        const uint8_t *gaps = controls + (n + 3) / 4;
+        uint32_t id = 0;
+        for(size_t i = 0; i < n; i++){
+            uint32_t length = (controls[i / 4] >> (2 * (i % 4)) & 3) + 1, gap = 0;
+            for(uint32_t k = 0; k < length; k++)
+                gap |= (uint32_t)gaps[k] << (8 * k);
+            gaps += length;
+            id += gap;
+            int16_t value;
+            memcpy(&value, values + i * sizeof(int16_t), sizeof(value));
+            out[i] = {id, value * scale};
+        }
+    }
+}
@@ -1,25 +1,53 @@
 #include "feature_parser.h"
+#include "utils.h"
+#include <algorithm>
 #include <cstring>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
+// Pairs are stored in bin files exactly as they are laid out in memory
+static_assert(sizeof(FeatureValuePair) == 2 * sizeof(uint32_t), "FeatureValuePair must be packed");
+
+ParsedFeatures FeatureParser::parse_all(int num_threads){
+    ParsedFeatures parsed;
+    unique_ptr<SfSparseVector> spv;
+    while((spv = next()) != nullptr){
+        for(auto &feature: spv->features_)
+            parsed.dimensionality = max(parsed.dimensionality, feature.id_ + 1);
+        parsed.features.insert(parsed.features.end(), spv->features_.begin(), spv->features_.end());
+        parsed.doc_offsets.push_back(parsed.features.size());
+        parsed.squared_norms.push_back(spv->GetSquaredNorm());
+        parsed.doc_ids.push_back(spv->doc_id);
+    }
+    parsed.doc_ids.build();
+    return parsed;
+}
+
 BinFeatureParser::BinFeatureParser(const string &file_name): FeatureParser(file_name){
-    uint32_t dict_end_offset;
+    uint32_t dict_end_offset = sizeof(uint32_t);
     fread(&dict_end_offset, sizeof(uint32_t), 1, fp);
-    char buffer[MAX_TERM_LEN];
-    uint32_t df;
+
+    // The terms are read in one go, and split where they end
+    vector<char> block(max(dict_end_offset, (uint32_t)sizeof(uint32_t)) - sizeof(uint32_t));
+    if(fread(block.data(), 1, block.size(), fp) != block.size())
+        fail("Truncated dictionary in the bin feature file", -1);
+    const char *pos = block.data(), *end = block.data() + block.size();
     int idx = 0;
-    while(ftello(fp) != dict_end_offset){
-        char ch; int buf_idx = 0;
-        do{
-            ch = fgetc(fp);
-            buffer[buf_idx++] = ch;
-        } while(ch);
-
-        fread(&df, sizeof(uint32_t), 1, fp);
-        dictionary[buffer] = { ++idx, (int)df};
+    while(pos < end){
+        const char *term_end = (const char *)memchr(pos, 0, end - pos);
+        if(term_end == nullptr || term_end + 1 + sizeof(uint32_t) > end)
+            fail("Truncated dictionary in the bin feature file", -1);
+        uint32_t df;
+        memcpy(&df, term_end + 1, sizeof(uint32_t));
+        dictionary.push_back({string(pos, term_end), {++idx, (int)df}});
+        pos = term_end + 1 + sizeof(uint32_t);
     }
     fread(&num_records, sizeof(num_records), 1, fp);
+    read_index_trailer();
 }
 
 BinFeatureParser::BinFeatureParser(const string &file_name, const string &df_file_name): FeatureParser(file_name){
@@ -28,12 +56,13 @@ BinFeatureParser::BinFeatureParser(const string &file_name, const string &df_fil
         FILE *df_fp = fopen(df_file_name.c_str(), "rb");
         int df, idx = 0;
         while(fscanf(df_fp, "%d %s\n", &df, buffer) != EOF){
-            dictionary[buffer] = { ++idx, df};
+            dictionary.push_back({buffer, {++idx, df}});
         }
         fclose(df_fp);
     }
 
     fread(&num_records, sizeof(num_records), 1, fp);
+    read_index_trailer();
 }
 
 SVMlightFeatureParser::SVMlightFeatureParser(const string &file_name, const string &df_file_name): FeatureParser(file_name){
@@ -44,7 +73,7 @@ SVMlightFeatureParser::SVMlightFeatureParser(const string &file_name, const stri
         FILE *df_fp = fopen(df_file_name.c_str(), "rb");
         int df, idx = 0;
         while(fscanf(df_fp, "%d %s\n", &df, buffer) != EOF){
-            dictionary[buffer] = { ++idx, df};
+            dictionary.push_back({buffer, {++idx, df}});
         }
         fclose(df_fp);
     }
@@ -53,6 +82,8 @@ SVMlightFeatureParser::SVMlightFeatureParser(const string &file_name, const stri
 // Bad things will happen if the file is corrupted
 // Todo: move things to heap
 std::unique_ptr<SfSparseVector> BinFeatureParser::next(){
+    if(has_index && (uint64_t)ftello(fp) >= index_trailer.records_end)
+        return NULL;
     string doc_id;
     char c = fgetc(fp);
     if(c == EOF)
@@ -75,6 +106,149 @@ std::unique_ptr<SfSparseVector> BinFeatureParser::next(){
     return std::make_unique<SfSparseVector>(doc_id, features);
 }
 
+ParsedFeatures BinFeatureParser::parse_all(int num_threads){
+    ParsedFeatures parsed;
+    struct stat st;
+    if(fstat(fileno(fp), &st) != 0)
+        fail("Failed to stat the bin feature file", -1);
+    size_t records_st = ftello(fp), file_size = st.st_size;
+    size_t records_end = has_index ? index_trailer.records_end : file_size;
+    if(records_st >= records_end){
+        parsed.doc_ids.build();
+        return parsed;
+    }
+
+    char *data = (char *)mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if(data == MAP_FAILED)
+        fail("Failed to map the bin feature file", -1);
+    madvise(data, file_size, MADV_WILLNEED);
+    num_threads = max(num_threads, 1);
+
+    // Returns where the pairs of the record at `pos` begin and its number of pairs
+    auto read_record_header = [&](size_t pos, uint32_t &num_pairs) -> size_t {
+        const char *delim = (const char *)memchr(data + pos, DELIM_CHAR, records_end - pos);
+        if(delim == nullptr || (size_t)(delim - data) + 1 + sizeof(uint32_t) > records_end)
+            fail("Truncated record in the bin feature file", -1);
+        memcpy(&num_pairs, delim + 1, sizeof(uint32_t));
+        return delim - data + 1 + sizeof(uint32_t);
+    };
+
+    // Record boundaries, and where the pairs of every record begin
+    vector<size_t> pair_offsets;
+    if(has_index){
+        // Every record is located by the index, so the headers are read concurrently
+        const uint64_t *record_offsets = (const uint64_t *)(data + index_trailer.index_offset);
+        size_t first = lower_bound(record_offsets, record_offsets + index_trailer.num_records, records_st) - record_offsets;
+        size_t num_docs = index_trailer.num_records - first;
+        record_offsets += first;
+        pair_offsets.resize(num_docs);
+        parsed.doc_offsets.resize(num_docs + 1);
+
+        vector<thread> t;
+        for(int i = 0; i < num_threads; i++){
+            t.push_back(thread([&, i](){
+                for(size_t doc = i * num_docs / num_threads; doc < (i + 1) * num_docs / num_threads; doc++){
+                    size_t end = doc + 1 < num_docs ? record_offsets[doc + 1] : records_end;
+                    uint32_t num_pairs;
+                    pair_offsets[doc] = read_record_header(record_offsets[doc], num_pairs);
+                    if(pair_offsets[doc] + (size_t)num_pairs * sizeof(FeatureValuePair) != end)
+                        fail("Record " + to_string(first + doc) + " does not match the index of the bin feature file", -1);
+                    parsed.doc_offsets[doc + 1] = num_pairs + 1;
+                }
+            }));
+        }
+        for(thread &x: t) x.join();
+
+        for(size_t doc = 0; doc < num_docs; doc++){
+            parsed.doc_offsets[doc + 1] += parsed.doc_offsets[doc];
+            parsed.doc_ids.push_back(data + record_offsets[doc], pair_offsets[doc] - sizeof(uint32_t) - 1 - record_offsets[doc]);
+        }
+    }else{
+        size_t pos = records_st;
+        while(pos < records_end){
+            uint32_t num_pairs;
+            size_t pairs_pos = read_record_header(pos, num_pairs);
+            parsed.doc_ids.push_back(data + pos, pairs_pos - sizeof(uint32_t) - 1 - pos);
+            pair_offsets.push_back(pairs_pos);
+            pos = pairs_pos + (size_t)num_pairs * sizeof(FeatureValuePair);
+            if(pos > records_end)
+                fail("Truncated record in the bin feature file", -1);
+            parsed.doc_offsets.push_back(parsed.doc_offsets.back() + num_pairs + 1);
+        }
+    }
+    fseeko(fp, records_end, SEEK_SET);
+
+    size_t num_docs = pair_offsets.size();
+    uint64_t num_features = parsed.doc_offsets.back();
+    parsed.features.resize(num_features);
+    parsed.squared_norms.resize(num_docs);
+
+    // Every thread parses a range of records with a similar number of features
+    auto split = [&](int part) -> size_t {
+        if(part == num_threads)
+            return num_docs;
+        return lower_bound(parsed.doc_offsets.begin(), parsed.doc_offsets.end() - 1,
+                           part * num_features / num_threads) - parsed.doc_offsets.begin();
+    };
+    vector<uint32_t> max_ids(num_threads, 0);
+    vector<thread> t;
+    for(int i = 0; i < num_threads; i++){
+        t.push_back(thread([&, i](){
+            uint32_t max_id = 0;
+            for(size_t doc = split(i); doc < split(i + 1); doc++){
+                FeatureValuePair *features = parsed.features.data() + parsed.doc_offsets[doc];
+                size_t num_pairs = parsed.doc_offsets[doc + 1] - parsed.doc_offsets[doc] - 1;
+                features[0] = {0, 1};
+                memcpy(features + 1, data + pair_offsets[doc], num_pairs * sizeof(FeatureValuePair));
+
+                // Same checks and norm as building the SfSparseVector pair by pair
+                float squared_norm = 1;
+                for(size_t j = 1; j <= num_pairs; j++){
+                    if(features[j].id_ > 0 && features[j].id_ <= features[j - 1].id_)
+                        fail("Features not in ascending sorted order in record " + to_string(doc), -1);
+                    squared_norm += features[j].value_ * features[j].value_;
+                    max_id = max(max_id, features[j].id_);
+                }
+                parsed.squared_norms[doc] = squared_norm;
+            }
+            max_ids[i] = max_id;
+        }));
+    }
+    // The id lookup table is independent of the features
+    parsed.doc_ids.build();
+    for(thread &x: t) x.join();
+
+    munmap(data, file_size);
+    parsed.dimensionality = *max_element(max_ids.begin(), max_ids.end()) + 1;
+    return parsed;
+}
+
+bool read_bin_index_trailer(int fd, BinIndexTrailer &trailer){
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BinIndexTrailer))
+        return false;
+    uint64_t file_size = st.st_size;
+    if(pread(fd, &trailer, sizeof(trailer), file_size - sizeof(trailer)) != sizeof(trailer))
+        return false;
+    if(memcmp(trailer.magic, BIN_INDEX_MAGIC, sizeof(BIN_INDEX_MAGIC)) != 0)
+        return false;
+    if(trailer.version != BIN_INDEX_VERSION){
+        logging::warning("Ignoring the index of version " + to_string(trailer.version) + " of a bin feature file");
+        return false;
+    }
+    uint64_t index_size = trailer.num_records * (2 * sizeof(uint64_t) + sizeof(uint32_t));
+    if(trailer.index_offset % sizeof(uint64_t) != 0 || trailer.records_end > trailer.index_offset ||
+       trailer.index_offset + index_size + sizeof(trailer) != file_size){
+        logging::warning("Ignoring the corrupt index of a bin feature file");
+        return false;
+    }
+    return true;
+}
+
+void BinFeatureParser::read_index_trailer(){
+    has_index = read_bin_index_trailer(fileno(fp), index_trailer);
+}
+
 bool SVMlightFeatureParser::read_line(){
     if(feof(fp))
         return false;
@@ -124,3 +298,83 @@ std::unique_ptr<SfSparseVector> SVMlightFeatureParser::next(){
     }
     return std::make_unique<SfSparseVector>(doc_id, features);
 }
+
+BinFeatureReader::BinFeatureReader(const char *_data, size_t _file_size, const BinIndexTrailer &_trailer):
+    data(_data), file_size(_file_size), trailer(_trailer)
+{
+    record_offsets = (const uint64_t *)(data + trailer.index_offset);
+    id_hashes = record_offsets + trailer.num_records;
+    id_records = (const uint32_t *)(id_hashes + trailer.num_records);
+}
+
+unique_ptr<BinFeatureReader> BinFeatureReader::open(const string &file_name){
+    FILE *fp = fopen(file_name.c_str(), "rb");
+    if(fp == nullptr)
+        return nullptr;
+    BinIndexTrailer trailer;
+    struct stat st;
+    char *data = (char *)MAP_FAILED;
+    if(read_bin_index_trailer(fileno(fp), trailer) && fstat(fileno(fp), &st) == 0)
+        data = (char *)mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    fclose(fp);
+    if(data == MAP_FAILED)
+        return nullptr;
+    madvise(data, st.st_size, MADV_RANDOM);
+    return unique_ptr<BinFeatureReader>(new BinFeatureReader(data, st.st_size, trailer));
+}
+
+BinFeatureReader::~BinFeatureReader(){
+    munmap((void *)data, file_size);
+}
+
+const char *BinFeatureReader::get_record(size_t record, size_t &id_length, const char *&pairs) const {
+    const char *id = data + record_offsets[record];
+    const char *delim = (const char *)memchr(id, '\n', trailer.records_end - record_offsets[record]);
+    if(delim == nullptr)
+        fail("Truncated record " + to_string(record) + " in the bin feature file", -1);
+    id_length = delim - id;
+    pairs = delim + 1;
+    return id;
+}
+
+string BinFeatureReader::get_doc_id(size_t record) const {
+    size_t id_length;
+    const char *pairs;
+    const char *id = get_record(record, id_length, pairs);
+    return string(id, id_length);
+}
+
+size_t BinFeatureReader::find(const string &doc_id) const {
+    uint64_t h = DocIdIndex::hash(doc_id.data(), doc_id.size());
+    size_t i = lower_bound(id_hashes, id_hashes + trailer.num_records, h) - id_hashes;
+    // Collisions are resolved by comparing the ids
+    for(; i < trailer.num_records && id_hashes[i] == h; i++){
+        size_t id_length;
+        const char *pairs;
+        const char *id = get_record(id_records[i], id_length, pairs);
+        if(id_length == doc_id.size() && memcmp(id, doc_id.data(), id_length) == 0)
+            return id_records[i];
+    }
+    return NPOS;
+}
+
+unique_ptr<SfSparseVector> BinFeatureReader::get(size_t record) const {
+    size_t id_length;
+    const char *pairs;
+    const char *id = get_record(record, id_length, pairs);
+    uint32_t num_pairs;
+    memcpy(&num_pairs, pairs, sizeof(uint32_t));
+    if((size_t)(pairs - data) + sizeof(uint32_t) + (size_t)num_pairs * sizeof(FeatureValuePair) > trailer.records_end)
+        fail("Truncated record " + to_string(record) + " in the bin feature file", -1);
+
+    vector<FeatureValuePair> features(num_pairs);
+    memcpy(features.data(), pairs + sizeof(uint32_t), num_pairs * sizeof(FeatureValuePair));
+    return make_unique<SfSparseVector>(string(id, id_length), features);
+}
+
+unique_ptr<SfSparseVector> BinFeatureReader::get(const string &doc_id) const {
+    size_t record = find(doc_id);
+    if(record == NPOS)
+        return nullptr;
+    return get(record);
+}
@@ -2,30 +2,97 @@
 #define FEATURE_PARSER_H
 
 #include "features.h"
+#include "doc_id_index.h"
 #include "../sofiaml/sf-sparse-vector.h"
 #include <fstream>
 #include <memory>
-#include <unordered_map>
+#include <vector>
+
+// Documents parsed into flat arrays. The features of document `i`, including
+// the bias term, are features[doc_offsets[i], doc_offsets[i + 1])
+struct ParsedFeatures {
+    std::vector<uint64_t> doc_offsets = {0};
+    std::vector<FeatureValuePair> features;
+    std::vector<float> squared_norms;
+    DocIdIndex doc_ids;
+    // One more than the largest feature id
+    uint32_t dimensionality = 1;
+};
 
 class FeatureParser{
     protected:
         static const char DELIM_CHAR = '\n';
         FILE *fp;
-        std::unordered_map<std::string, TermInfo> dictionary;
+        // Terms in the order of their ids
+        std::vector<std::pair<std::string, TermInfo>> dictionary;
     public:
         FeatureParser(const string &fname){ fp = fopen(fname.c_str(), "rb"); setvbuf(fp, NULL, _IOFBF, 1 << 25); }
         virtual std::unique_ptr<SfSparseVector> next() = 0;
-        std::unordered_map<std::string, TermInfo> get_dictionary() { return dictionary; }
+
+        // Parses all the remaining records, on up to `num_threads` threads if the format allows
+        virtual ParsedFeatures parse_all(int num_threads);
+
+        const std::vector<std::pair<std::string, TermInfo>> &get_dictionary() const { return dictionary; }
 
         ~FeatureParser(){fclose(fp);}
 };
 
+// Reads the trailer of the index at the end of `fd`, returns false if the file has none
+bool read_bin_index_trailer(int fd, BinIndexTrailer &trailer);
+
 class BinFeatureParser:public FeatureParser {
     uint32_t num_records;
+    // Set if the file ends with an index, the records then end at its records_end
+    bool has_index;
+    BinIndexTrailer index_trailer;
+    void read_index_trailer();
     public:
         BinFeatureParser(const string &file_name);
         BinFeatureParser(const string &file_name, const string &df_file_name);
         std::unique_ptr<SfSparseVector> next() override;
+
+        // Indexes the record boundaries of the whole file, in one pass or from
+        // its index, then parses chunks of records concurrently into the arena
+        ParsedFeatures parse_all(int num_threads) override;
+};
+
+/*
+ * Random access to the records of a bin feature file through the index at
+ * its end. The file is mapped, so only the pages of the records fetched are
+ * read from disk.
+ */
+class BinFeatureReader {
+    const char *data;
+    size_t file_size;
+    BinIndexTrailer trailer;
+    const uint64_t *record_offsets;
+    const uint64_t *id_hashes;
+    const uint32_t *id_records;
+
+    BinFeatureReader(const char *_data, size_t _file_size, const BinIndexTrailer &_trailer);
+
+    // Id of `record`, and where its pairs begin
+    const char *get_record(size_t record, size_t &id_length, const char *&pairs) const;
+
+    public:
+    static const size_t NPOS = SIZE_MAX;
+
+    // Returns nullptr if the file can not be opened or has no index
+    static std::unique_ptr<BinFeatureReader> open(const std::string &file_name);
+    ~BinFeatureReader();
+
+    size_t size() const { return trailer.num_records; }
+
+    std::string get_doc_id(size_t record) const;
+
+    // Returns the record of `doc_id`, BinFeatureReader::NPOS if not found
+    size_t find(const std::string &doc_id) const;
+
+    // The features of `record` with the bias term, as BinFeatureParser::next() returns them
+    std::unique_ptr<SfSparseVector> get(size_t record) const;
+
+    // Returns nullptr if `doc_id` is not found
+    std::unique_ptr<SfSparseVector> get(const std::string &doc_id) const;
 };
 
 class SVMlightFeatureParser:public FeatureParser {
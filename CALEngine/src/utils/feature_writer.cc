@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstring>
 #include "feature_writer.h"
 using namespace std;
 
@@ -32,8 +34,11 @@ SVMlightFeatureWriter::SVMlightFeatureWriter(const string &file_name, const stri
     }
 }
 
-void BinFeatureWriter::write(const SfSparseVector &spv){
-    fwrite(spv.doc_id.c_str(), 1, spv.doc_id.length(), fp);
+void BinFeatureWriter::write(const SfSparseVector &spv, const string &doc_id){
+    record_offsets.push_back(ftello(fp));
+    id_hashes.push_back({DocIdIndex::hash(doc_id.data(), doc_id.size()), num_records});
+
+    fwrite(doc_id.c_str(), 1, doc_id.length(), fp);
     fputc(DELIM_CHAR, fp);
 
     uint32_t num_pairs = 0;
@@ -56,13 +61,31 @@ void BinFeatureWriter::write(const SfSparseVector &spv){
 }
 
 void BinFeatureWriter::finish(){
+    BinIndexTrailer trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    trailer.records_end = ftello(fp);
+    trailer.index_offset = (trailer.records_end + 7) / 8 * 8;
+    trailer.num_records = num_records;
+    trailer.version = BIN_INDEX_VERSION;
+    memcpy(trailer.magic, BIN_INDEX_MAGIC, sizeof(BIN_INDEX_MAGIC));
+
+    sort(id_hashes.begin(), id_hashes.end());
+    for(uint64_t pos = trailer.records_end; pos < trailer.index_offset; pos++)
+        fputc(0, fp);
+    fwrite(record_offsets.data(), sizeof(uint64_t), record_offsets.size(), fp);
+    for(auto &id_hash: id_hashes)
+        fwrite(&id_hash.first, sizeof(uint64_t), 1, fp);
+    for(auto &id_hash: id_hashes)
+        fwrite(&id_hash.second, sizeof(uint32_t), 1, fp);
+    fwrite(&trailer, sizeof(trailer), 1, fp);
+
     fseeko(fp, dict_end_offset, SEEK_SET);
     fwrite(&num_records, sizeof(uint32_t), 1, fp);
     fflush(fp);
 }
 
-void SVMlightFeatureWriter::write(const SfSparseVector &spv){
-    fprintf(fp, "%s", spv.doc_id.c_str());
+void SVMlightFeatureWriter::write(const SfSparseVector &spv, const string &doc_id){
+    fprintf(fp, "%s", doc_id.c_str());
     for(auto &fpv: spv.features_){
         if(fpv.id_ != 0)
             fprintf(fp, " %d:%.8f", fpv.id_, fpv.value_);
@@ -72,6 +95,6 @@ void SVMlightFeatureWriter::write(const SfSparseVector &spv){
 
 void FeatureWriter::write_dataset(const Dataset &dataset) {
     for(size_t i = 0; i < dataset.size(); i++){
-        write(dataset.get_sf_sparse_vector(i));
+        write(dataset.get_sf_sparse_vector(i), dataset.get_id(i));
     }
 }
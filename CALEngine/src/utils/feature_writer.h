@@ -13,7 +13,8 @@ class FeatureWriter{
         FILE *fp;
     public:
         FeatureWriter(const string &fname){ fp = fopen(fname.c_str(), "wb"); setvbuf(fp, nullptr, _IOFBF, 1 << 25); }
-        virtual void write(const SfSparseVector &spv) = 0;
+        virtual void write(const SfSparseVector &spv, const std::string &doc_id) = 0;
+        void write(const SfSparseVector &spv) { write(spv, spv.doc_id); }
         void write_dataset(const Dataset &dataset);
         ~FeatureWriter(){fclose(fp);}
         virtual void finish() = 0;
@@ -22,17 +23,22 @@ class FeatureWriter{
 class BinFeatureWriter:public FeatureWriter {
     uint32_t num_records = 0;
     uint32_t dict_end_offset;
+    // Offset and id hash of every record written, for the index
+    std::vector<uint64_t> record_offsets;
+    std::vector<std::pair<uint64_t, uint32_t>> id_hashes;
     public:
         BinFeatureWriter(const string &file_name, const std::vector<std::pair<std::string, uint32_t>> &dictionary);
-        void write(const SfSparseVector &spv) override;
-        // Write final headers
+        using FeatureWriter::write;
+        void write(const SfSparseVector &spv, const std::string &doc_id) override;
+        // Write the index and final headers
         void finish() override;
 };
 
 class SVMlightFeatureWriter:public FeatureWriter {
     public:
         SVMlightFeatureWriter(const string &file_name, const string &df_file_name, const std::vector<std::pair<std::string, uint32_t>> &dictionary);
-        void write(const SfSparseVector &spv) override;
+        using FeatureWriter::write;
+        void write(const SfSparseVector &spv, const std::string &doc_id) override;
         void finish() override {}
 };
 #endif // FEATURE_WRITER_H
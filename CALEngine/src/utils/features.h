@@ -1,10 +1,35 @@
 #ifndef UTILS_FEATURES_H
 #define UTILS_FEATURES_H
 
+#include <cstdint>
+
 #define MAX_TERM_LEN 64
 struct TermInfo{
     int id;
     int df;
 };
 
+/*
+ * Bin feature files end with an index of their records:
+ *
+ *   uint64_t record_offsets[num_records];  // byte offset of every record
+ *   uint64_t id_hashes[num_records];       // DocIdIndex::hash() of the ids, sorted
+ *   uint32_t id_records[num_records];      // record of every hash in id_hashes
+ *   BinIndexTrailer
+ *
+ * The index begins at an 8 byte aligned offset right after the records.
+ * Files without the trailer are still read sequentially.
+ */
+struct BinIndexTrailer {
+    uint64_t records_end;
+    uint64_t index_offset;
+    uint64_t num_records;
+    uint32_t version;
+    uint32_t reserved;
+    char magic[8];
+};
+
+static const char BIN_INDEX_MAGIC[8] = {'C', 'A', 'L', 'B', 'I', 'N', 'I', 'X'};
+static const uint32_t BIN_INDEX_VERSION = 1;
+
 #endif // UTILS_FEATURES_H
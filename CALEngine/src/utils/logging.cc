@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "logging.h"
+#include "metrics.h"
+
+using namespace std;
+
+namespace logging {
+    namespace {
+        const char *LEVEL_NAMES[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+        const size_t RING_SIZE = 256;
+
+        struct Entry {
+            uint64_t timestamp_ns;
+            uint32_t thread_idx;
+            uint32_t level;
+            uint32_t length; // Length of the message before truncation
+            char text[MAX_MESSAGE_LENGTH];
+        };
+
+        // Single producer (the owning thread), single consumer (whoever holds the drain mutex)
+        struct Ring {
+            Entry entries[RING_SIZE];
+            atomic<uint64_t> head{0}, tail{0};
+            atomic<bool> abandoned{false};
+            uint32_t thread_idx;
+        };
+
+        struct Logger {
+            atomic<int> level{INFO};
+            metrics::Counter &dropped = metrics::counter("cal_log_messages_dropped_total",
+                    "Number of log messages dropped because their thread's buffer was full");
+
+            mutex rings_mutex;
+            vector<Ring*> rings;
+            uint32_t num_threads = 0;
+
+            mutex drain_mutex;
+            vector<Entry*> pending;
+
+            Logger(){
+                atexit(flush);
+                thread([this](){
+                    while(true){
+                        this_thread::sleep_for(chrono::milliseconds(10));
+                        drain();
+                    }
+                }).detach();
+            }
+
+            Ring *add_ring(){
+                lock_guard<mutex> lock(rings_mutex);
+                Ring *ring = new Ring();
+                ring->thread_idx = num_threads++;
+                rings.push_back(ring);
+                return ring;
+            }
+
+            // Writes out all the entries in the rings, freeing the rings of exited threads
+            void drain(){
+                lock_guard<mutex> lock(drain_mutex);
+                vector<Ring*> snapshot;
+                {
+                    lock_guard<mutex> lock_rings(rings_mutex);
+                    snapshot = rings;
+                }
+
+                pending.clear();
+                vector<pair<Ring*, uint64_t>> consumed;
+                for(Ring *ring: snapshot){
+                    // Check before reading head, so that nothing logged before the exit is missed
+                    bool abandoned = ring->abandoned.load(memory_order_acquire);
+                    uint64_t tail = ring->tail.load(memory_order_relaxed);
+                    uint64_t head = ring->head.load(memory_order_acquire);
+                    for(uint64_t i = tail; i < head; i++)
+                        pending.push_back(&ring->entries[i % RING_SIZE]);
+                    consumed.push_back({ring, head});
+                    if(abandoned)
+                        consumed.back().second = UINT64_MAX;
+                }
+
+                stable_sort(pending.begin(), pending.end(), [](const Entry *a, const Entry *b) -> bool {
+                    return a->timestamp_ns < b->timestamp_ns;
+                });
+                for(const Entry *entry: pending)
+                    write(*entry);
+                if(!pending.empty())
+                    fflush(stderr);
+
+                for(auto &ring_head: consumed){
+                    Ring *ring = ring_head.first;
+                    if(ring_head.second != UINT64_MAX){
+                        ring->tail.store(ring_head.second, memory_order_release);
+                        continue;
+                    }
+                    lock_guard<mutex> lock_rings(rings_mutex);
+                    rings.erase(find(rings.begin(), rings.end(), ring));
+                    delete ring;
+                }
+            }
+
+            static void write(const Entry &entry){
+                time_t seconds = entry.timestamp_ns / 1000000000;
+                tm local_time;
+                localtime_r(&seconds, &local_time);
+                char time_str[32];
+                strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &local_time);
+
+                size_t length = min((size_t)entry.length, MAX_MESSAGE_LENGTH);
+                fprintf(stderr, "%s.%03d %s [%u] %.*s", time_str, (int)(entry.timestamp_ns / 1000000 % 1000),
+                        LEVEL_NAMES[entry.level], entry.thread_idx, (int)length, entry.text);
+                if(entry.length > length)
+                    fprintf(stderr, "... (%u bytes)", entry.length);
+                fputc('\n', stderr);
+            }
+        };
+
+        // Never destroyed, so that threads still running at exit can keep logging
+        Logger &get_logger(){
+            static Logger *logger = new Logger();
+            return *logger;
+        }
+
+        // Marks the ring of the thread as abandoned when the thread exits
+        struct RingHandle {
+            Ring *ring = nullptr;
+            ~RingHandle(){
+                if(ring != nullptr)
+                    ring->abandoned.store(true, memory_order_release);
+                ring = nullptr;
+            }
+        };
+        thread_local RingHandle ring_handle;
+    }
+
+    void set_level(Level level){
+        get_logger().level.store(level, memory_order_relaxed);
+    }
+
+    bool enabled(Level level){
+        return level >= get_logger().level.load(memory_order_relaxed);
+    }
+
+    bool parse_level(const string &name, Level &level){
+        for(int i = DEBUG; i <= ERROR; i++){
+            string level_name = LEVEL_NAMES[i];
+            transform(level_name.begin(), level_name.end(), level_name.begin(), ::tolower);
+            if(name == level_name){
+                level = (Level)i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void log(Level level, const string &message){
+        Logger &logger = get_logger();
+        if(!enabled(level))
+            return;
+
+        if(ring_handle.ring == nullptr)
+            ring_handle.ring = logger.add_ring();
+        Ring *ring = ring_handle.ring;
+
+        uint64_t head = ring->head.load(memory_order_relaxed);
+        if(head - ring->tail.load(memory_order_acquire) == RING_SIZE){
+            logger.dropped.add();
+            return;
+        }
+
+        Entry &entry = ring->entries[head % RING_SIZE];
+        entry.timestamp_ns = chrono::duration_cast<chrono::nanoseconds>(
+                chrono::system_clock::now().time_since_epoch()).count();
+        entry.thread_idx = ring->thread_idx;
+        entry.level = level;
+        entry.length = message.size();
+        memcpy(entry.text, message.data(), min(message.size(), MAX_MESSAGE_LENGTH));
+        ring->head.store(head + 1, memory_order_release);
+    }
+
+    void flush(){
+        get_logger().drain();
+    }
+}
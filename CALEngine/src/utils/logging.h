@@ -0,0 +1,38 @@
+#ifndef LOGGING_H
+#define LOGGING_H
+
+#include <string>
+
+/*
+ * Leveled logging which never blocks the caller on I/O.
+ *
+ * Every thread appends its messages to its own lock-free ring buffer of fixed
+ * size entries; a background thread drains all the rings about every 10ms and
+ * writes the messages to stderr in timestamp order. Messages longer than an
+ * entry are truncated, and messages logged while the ring is full are dropped
+ * and counted in the cal_log_messages_dropped_total metric. Everything logged
+ * before the process exits is written out.
+ */
+namespace logging {
+    enum Level {DEBUG, INFO, WARNING, ERROR};
+
+    // Longest message kept in full, longer messages are truncated
+    const size_t MAX_MESSAGE_LENGTH = 480;
+
+    void set_level(Level level);
+    bool enabled(Level level);
+
+    // Parses debug, info, warning or error into `level`
+    bool parse_level(const std::string &name, Level &level);
+
+    void log(Level level, const std::string &message);
+    inline void debug(const std::string &message) { log(DEBUG, message); }
+    inline void info(const std::string &message) { log(INFO, message); }
+    inline void warning(const std::string &message) { log(WARNING, message); }
+    inline void error(const std::string &message) { log(ERROR, message); }
+
+    // Writes out everything logged so far before returning
+    void flush();
+}
+
+#endif // LOGGING_H
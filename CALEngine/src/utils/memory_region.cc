@@ -0,0 +1,112 @@
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "memory_region.h"
+#include "utils.h"
+
+using namespace std;
+
+// Segments are rounded up to the huge page size so they can live on hugetlbfs
+static const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+// POSIX shared memory objects live in /dev/shm on Linux. Mapping the names
+// ourselves lets shared memory segments be published with rename() as well.
+static string get_path(const string &name){
+    if(name.size() > 1 && name[0] == '/' && name.find('/', 1) == string::npos)
+        return "/dev/shm" + name;
+    return name;
+}
+
+static void advise_huge_pages(char *addr, size_t length){
+#ifdef MADV_HUGEPAGE
+    madvise(addr, length, MADV_HUGEPAGE);
+#endif
+}
+
+bool MemoryRegion::explicit_huge_pages = false;
+
+static size_t round_to_huge_pages(size_t size){
+    return (max(size, (size_t)1) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+}
+
+unique_ptr<MemoryRegion> MemoryRegion::allocate(size_t size){
+    if(explicit_huge_pages){
+        size_t huge_size = round_to_huge_pages(size);
+        void *addr = mmap(nullptr, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(addr != MAP_FAILED)
+            return unique_ptr<MemoryRegion>(new MemoryRegion((char *)addr, huge_size));
+        cerr<<"Failed to allocate "<<huge_size<<" bytes of huge pages, using transparent huge pages"<<endl;
+    }
+
+    size = max(size, (size_t)1);
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED)
+        fail("Failed to allocate " + to_string(size) + " bytes: " + strerror(errno), -1);
+    advise_huge_pages((char *)addr, size);
+    return unique_ptr<MemoryRegion>(new MemoryRegion((char *)addr, size));
+}
+
+unique_ptr<MemoryRegion> MemoryRegion::create(const string &name, size_t size){
+    size = round_to_huge_pages(size);
+    string temp_path = get_path(name) + "." + to_string(getpid()) + ".tmp";
+    int fd = ::open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        fail("Failed to create segment " + temp_path + ": " + strerror(errno), -1);
+    if(ftruncate(fd, size) != 0)
+        fail("Failed to resize segment " + temp_path + ": " + strerror(errno), -1);
+
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED)
+        fail("Failed to map segment " + temp_path + ": " + strerror(errno), -1);
+    advise_huge_pages((char *)addr, size);
+
+    auto region = unique_ptr<MemoryRegion>(new MemoryRegion((char *)addr, size));
+    region->temp_path = temp_path;
+    return region;
+}
+
+unique_ptr<MemoryRegion> MemoryRegion::open(const string &name){
+    string path = get_path(name);
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        if(errno == ENOENT)
+            return nullptr;
+        fail("Failed to open segment " + path + ": " + strerror(errno), -1);
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0){
+        close(fd);
+        return nullptr;
+    }
+
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED)
+        fail("Failed to map segment " + path + ": " + strerror(errno), -1);
+    advise_huge_pages((char *)addr, st.st_size);
+    return unique_ptr<MemoryRegion>(new MemoryRegion((char *)addr, st.st_size));
+}
+
+void MemoryRegion::publish(const string &name){
+    string path = get_path(name);
+    if(rename(temp_path.c_str(), path.c_str()) != 0)
+        fail("Failed to publish segment " + path + ": " + strerror(errno), -1);
+    temp_path.clear();
+}
+
+void MemoryRegion::protect(){
+    if(mprotect(addr, length, PROT_READ) != 0)
+        fail(string("Failed to protect memory region: ") + strerror(errno), -1);
+}
+
+MemoryRegion::~MemoryRegion(){
+    munmap(addr, length);
+    if(!temp_path.empty())
+        unlink(temp_path.c_str());
+}
@@ -0,0 +1,53 @@
+#ifndef MEMORY_REGION_H
+#define MEMORY_REGION_H
+
+#include <memory>
+#include <string>
+
+/*
+ * A page aligned memory mapping.
+ *
+ * Regions are either private anonymous memory, or backed by a named segment
+ * which other processes can map. A segment name with a single leading slash
+ * (e.g. "/cal-docs") is a POSIX shared memory object, anything else is a file
+ * path, which can point into a hugetlbfs mount. Segments are published with
+ * an atomic rename, so a segment that can be opened is always complete.
+ */
+class MemoryRegion {
+    char *addr;
+    size_t length;
+    std::string temp_path; // Set until a created segment is published
+
+    static bool explicit_huge_pages;
+
+    MemoryRegion(char *_addr, size_t _length): addr(_addr), length(_length) {}
+
+    public:
+    // Back private memory with explicit 2MB pages from the hugetlb pool instead of
+    // transparent huge pages, falling back to the latter when the pool is exhausted
+    static void use_explicit_huge_pages(bool enable) { explicit_huge_pages = enable; }
+
+    // Private anonymous memory of `size` bytes
+    static std::unique_ptr<MemoryRegion> allocate(size_t size);
+
+    // Writable segment of `size` bytes, which stays invisible to open() until published
+    static std::unique_ptr<MemoryRegion> create(const std::string &name, size_t size);
+
+    // Read-only mapping of an existing segment. Returns nullptr if it does not exist.
+    static std::unique_ptr<MemoryRegion> open(const std::string &name);
+
+    // Makes a created segment visible under `name`, replacing any previous one
+    void publish(const std::string &name);
+
+    // Drops write access to the region
+    void protect();
+
+    char *data() const { return addr; }
+    size_t size() const { return length; }
+
+    MemoryRegion(const MemoryRegion &) = delete;
+    MemoryRegion &operator=(const MemoryRegion &) = delete;
+    ~MemoryRegion();
+};
+
+#endif // MEMORY_REGION_H
@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#include "metrics.h"
+
+using namespace std;
+
+namespace metrics {
+    const int Histogram::SUB_BUCKET_BITS;
+    const int Histogram::MAX_BITS;
+    const int Histogram::NUM_BUCKETS;
+
+    Histogram::Histogram(){
+        for(auto &bucket: buckets)
+            bucket.store(0, memory_order_relaxed);
+    }
+
+    int Histogram::get_bucket(uint64_t ns){
+        const uint64_t sub_buckets = 1ULL << SUB_BUCKET_BITS;
+        if(ns < sub_buckets)
+            return ns;
+        if(ns >= (1ULL << MAX_BITS))
+            return NUM_BUCKETS - 1;
+        int shift = 63 - __builtin_clzll(ns) - SUB_BUCKET_BITS;
+        return ((shift + 1) << SUB_BUCKET_BITS) + ((ns >> shift) & (sub_buckets - 1));
+    }
+
+    uint64_t Histogram::get_bucket_start(int bucket){
+        const uint64_t sub_buckets = 1ULL << SUB_BUCKET_BITS;
+        if(bucket < (int)sub_buckets)
+            return bucket;
+        int shift = (bucket >> SUB_BUCKET_BITS) - 1;
+        return (sub_buckets + (bucket & (sub_buckets - 1))) << shift;
+    }
+
+    void Histogram::observe_ns(uint64_t ns){
+        buckets[get_bucket(ns)].fetch_add(1, memory_order_relaxed);
+        sum_ns.fetch_add(ns, memory_order_relaxed);
+    }
+
+    uint64_t Histogram::count() const {
+        uint64_t total = 0;
+        for(auto &bucket: buckets)
+            total += bucket.load(memory_order_relaxed);
+        return total;
+    }
+
+    double Histogram::quantile(double q) const {
+        uint64_t counts[NUM_BUCKETS], total = 0;
+        for(int i = 0; i < NUM_BUCKETS; i++)
+            total += counts[i] = buckets[i].load(memory_order_relaxed);
+        if(total == 0)
+            return 0;
+
+        uint64_t rank = max((uint64_t)1, (uint64_t)(q * total + 0.5)), seen = 0;
+        for(int i = 0; i < NUM_BUCKETS; i++){
+            seen += counts[i];
+            if(seen >= rank){
+                // Middle of the bucket
+                uint64_t st = get_bucket_start(i);
+                uint64_t end = i + 1 < NUM_BUCKETS ? get_bucket_start(i + 1) : st + 1;
+                return (st + (end - st - 1) / 2.0) * 1e-9;
+            }
+        }
+        return get_bucket_start(NUM_BUCKETS - 1) * 1e-9;
+    }
+
+    namespace {
+        enum MetricType {COUNTER, GAUGE, HISTOGRAM};
+
+        struct Family {
+            string help;
+            MetricType type;
+            // Metrics by label string, in registration order
+            vector<pair<string, unique_ptr<Counter>>> counters;
+            vector<pair<string, unique_ptr<Gauge>>> gauges;
+            vector<pair<string, unique_ptr<Histogram>>> histograms;
+        };
+
+        struct Registry {
+            mutex registry_mutex;
+            vector<string> family_order;
+            map<string, Family> families;
+        };
+
+        // Constructed on first use, so that metrics can be registered during static initialization
+        Registry &get_registry(){
+            static Registry registry;
+            return registry;
+        }
+
+        template<class T>
+        T &find_or_add(vector<pair<string, unique_ptr<T>>> &metrics, const string &labels){
+            for(auto &metric: metrics)
+                if(metric.first == labels)
+                    return *metric.second;
+            metrics.push_back({labels, unique_ptr<T>(new T())});
+            return *metrics.back().second;
+        }
+
+        Family &get_family(const string &name, const string &help, MetricType type){
+            Registry &registry = get_registry();
+            auto it = registry.families.find(name);
+            if(it == registry.families.end()){
+                registry.family_order.push_back(name);
+                it = registry.families.emplace(name, Family()).first;
+                it->second.help = help;
+                it->second.type = type;
+            }
+            if(it->second.type != type)
+                fail("Metric " + name + " registered with different types", -1);
+            return it->second;
+        }
+
+        string with_labels(const string &name, const string &labels, const string &extra_label = ""){
+            string all_labels = labels;
+            if(!extra_label.empty())
+                all_labels += (all_labels.empty() ? "" : ",") + extra_label;
+            return all_labels.empty() ? name : name + "{" + all_labels + "}";
+        }
+    }
+
+    Counter &counter(const string &name, const string &help, const string &labels){
+        lock_guard<mutex> lock(get_registry().registry_mutex);
+        return find_or_add(get_family(name, help, COUNTER).counters, labels);
+    }
+
+    Gauge &gauge(const string &name, const string &help, const string &labels){
+        lock_guard<mutex> lock(get_registry().registry_mutex);
+        return find_or_add(get_family(name, help, GAUGE).gauges, labels);
+    }
+
+    Histogram &histogram(const string &name, const string &help, const string &labels){
+        lock_guard<mutex> lock(get_registry().registry_mutex);
+        return find_or_add(get_family(name, help, HISTOGRAM).histograms, labels);
+    }
+
+    string render(){
+        static const char *QUANTILES[] = {"0.5", "0.9", "0.99", "0.999"};
+
+        Registry &registry = get_registry();
+        lock_guard<mutex> lock(registry.registry_mutex);
+        ostringstream out;
+        for(const string &name: registry.family_order){
+            const Family &family = registry.families[name];
+            out<<"# HELP "<<name<<" "<<family.help<<"\n";
+            switch(family.type){
+                case COUNTER:
+                    out<<"# TYPE "<<name<<" counter\n";
+                    for(auto &metric: family.counters)
+                        out<<with_labels(name, metric.first)<<" "<<metric.second->get()<<"\n";
+                    break;
+                case GAUGE:
+                    out<<"# TYPE "<<name<<" gauge\n";
+                    for(auto &metric: family.gauges)
+                        out<<with_labels(name, metric.first)<<" "<<metric.second->get()<<"\n";
+                    break;
+                case HISTOGRAM:
+                    out<<"# TYPE "<<name<<" summary\n";
+                    for(auto &metric: family.histograms){
+                        for(const char *q: QUANTILES)
+                            out<<with_labels(name, metric.first, string("quantile=\"") + q + "\"")<<" "
+                               <<metric.second->quantile(stod(q))<<"\n";
+                        out<<with_labels(name + "_sum", metric.first)<<" "<<metric.second->sum()<<"\n";
+                        out<<with_labels(name + "_count", metric.first)<<" "<<metric.second->count()<<"\n";
+                    }
+                    break;
+            }
+        }
+        return out.str();
+    }
+}
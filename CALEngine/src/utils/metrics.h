@@ -0,0 +1,83 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include "utils.h"
+
+/*
+ * Process wide counters, gauges and latency histograms, rendered in the
+ * Prometheus text format.
+ *
+ * Metrics are registered by name (plus an optional label string such as
+ * `route="judge"`) and live until the process exits, so callers look them up
+ * once and keep the reference. Updates are single relaxed atomic operations.
+ */
+namespace metrics {
+    class Counter {
+        std::atomic<uint64_t> value{0};
+
+        public:
+        void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+        uint64_t get() const { return value.load(std::memory_order_relaxed); }
+    };
+
+    class Gauge {
+        std::atomic<int64_t> value{0};
+
+        public:
+        void set(int64_t v) { value.store(v, std::memory_order_relaxed); }
+        void add(int64_t n) { value.fetch_add(n, std::memory_order_relaxed); }
+        int64_t get() const { return value.load(std::memory_order_relaxed); }
+    };
+
+    // Log-linear histogram of durations in nanoseconds. Every power of two is
+    // split into 2^SUB_BUCKET_BITS buckets, so quantiles are within 1/32 of the
+    // true value, up to about 5 hours.
+    class Histogram {
+        public:
+        static const int SUB_BUCKET_BITS = 4;
+        static const int MAX_BITS = 44;
+        static const int NUM_BUCKETS = (MAX_BITS - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+        private:
+        std::atomic<uint64_t> buckets[NUM_BUCKETS];
+        std::atomic<uint64_t> sum_ns{0};
+
+        public:
+        Histogram();
+
+        static int get_bucket(uint64_t ns);
+        // Smallest value falling in `bucket`
+        static uint64_t get_bucket_start(int bucket);
+
+        void observe_ns(uint64_t ns);
+        void observe(double seconds) { observe_ns(seconds > 0 ? (uint64_t)(seconds * 1e9) : 0); }
+        void observe_since(std::chrono::steady_clock::time_point start) {
+            observe_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        uint64_t count() const;
+        double sum() const { return sum_ns.load(std::memory_order_relaxed) * 1e-9; }
+        // Value in seconds below which a fraction `q` of the observations fall
+        double quantile(double q) const;
+    };
+
+    // Returns the metric registered as `name{labels}`, registering it on first use
+    Counter &counter(const std::string &name, const std::string &help, const std::string &labels = "");
+    Gauge &gauge(const std::string &name, const std::string &help, const std::string &labels = "");
+    Histogram &histogram(const std::string &name, const std::string &help, const std::string &labels = "");
+
+    // All metrics in the Prometheus text exposition format. Histograms are
+    // rendered as summaries with the 0.5, 0.9, 0.99 and 0.999 quantiles.
+    std::string render();
+}
+
+// Same as TIMER_END, also recording the duration in `histogram`
+#define TIMER_END_OBSERVE(key, histogram) \
+    TIMER_END(key) \
+    (histogram).observe_since(start##key);
+
+#endif // METRICS_H
@@ -0,0 +1,90 @@
+#include <fstream>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "numa.h"
+
+using namespace std;
+
+// From linux/mempolicy.h
+static const int MPOL_BIND_MODE = 2;
+static const int MPOL_INTERLEAVE_MODE = 3;
+static const unsigned MPOL_MF_MOVE_FLAG = 1 << 1;
+
+static const int MAX_NODES = 64;
+
+// Parses a sysfs list such as "0-3,8,10-11"
+static vector<int> parse_list(const string &path){
+    vector<int> values;
+    ifstream file(path);
+    string list;
+    if(!(file >> list))
+        return values;
+
+    size_t pos = 0;
+    while(pos < list.size()){
+        size_t end = list.find(',', pos);
+        if(end == string::npos)
+            end = list.size();
+        string range = list.substr(pos, end - pos);
+        size_t dash = range.find('-');
+        int first = stoi(range.substr(0, dash));
+        int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+        for(int i = first; i <= last; i++)
+            values.push_back(i);
+        pos = end + 1;
+    }
+    return values;
+}
+
+static const vector<int> &get_nodes(){
+    static const vector<int> nodes = [](){
+        vector<int> nodes = parse_list("/sys/devices/system/node/has_memory");
+        if(nodes.empty() || nodes.back() >= MAX_NODES)
+            nodes = {0};
+        return nodes;
+    }();
+    return nodes;
+}
+
+static bool set_policy(const void *addr, size_t length, int mode, unsigned long nodemask){
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t st = (uintptr_t)addr / page_size * page_size;
+    uintptr_t end = (uintptr_t)addr + length;
+    if(end <= st)
+        return true;
+    return syscall(SYS_mbind, st, end - st, mode, &nodemask, MAX_NODES + 1, MPOL_MF_MOVE_FLAG) == 0;
+}
+
+int numa::num_nodes(){
+    return get_nodes().size();
+}
+
+bool numa::bind(const void *addr, size_t length, int node){
+    if(num_nodes() == 1)
+        return true;
+    return set_policy(addr, length, MPOL_BIND_MODE, 1UL << get_nodes()[node]);
+}
+
+bool numa::interleave(const void *addr, size_t length){
+    if(num_nodes() == 1)
+        return true;
+    unsigned long nodemask = 0;
+    for(int node: get_nodes())
+        nodemask |= 1UL << node;
+    return set_policy(addr, length, MPOL_INTERLEAVE_MODE, nodemask);
+}
+
+bool numa::run_on_node(int node){
+    if(num_nodes() == 1)
+        return true;
+    vector<int> cpus = parse_list("/sys/devices/system/node/node" + to_string(get_nodes()[node]) + "/cpulist");
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for(int cpu: cpus)
+        CPU_SET(cpu, &cpu_set);
+    return !cpus.empty() && pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+}
@@ -0,0 +1,22 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <cstddef>
+
+// Minimal NUMA support through the raw system calls, so that no libnuma is
+// needed. On machines without NUMA everything behaves as a single node.
+namespace numa {
+    // Number of nodes with memory, at least 1
+    int num_nodes();
+
+    // Moves the pages of [addr, addr + length) to `node` and keeps them there
+    bool bind(const void *addr, size_t length, int node);
+
+    // Spreads the pages of [addr, addr + length) over all nodes
+    bool interleave(const void *addr, size_t length);
+
+    // Restricts the calling thread to the cpus of `node`
+    bool run_on_node(int node);
+}
+
+#endif // NUMA_H
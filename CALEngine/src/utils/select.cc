@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include "select.h"
+
+using namespace std;
+
+static const int RADIX_BITS = 11;
+static const int NUM_BUCKETS = 1 << RADIX_BITS;
+
+// Maps a float to an unsigned key with the same ordering. Adding 0 turns -0 into +0.
+static inline uint32_t get_key(float score){
+    uint32_t bits;
+    score += 0.0f;
+    memcpy(&bits, &score, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+static inline uint32_t get_bucket(float score){
+    return get_key(score) >> (32 - RADIX_BITS);
+}
+
+// Runs fn(thread_idx, st, end) on num_threads contiguous chunks of [0, n)
+template<typename F>
+static void parallel_for(size_t n, int num_threads, F fn){
+    vector<thread> t;
+    for(int i = 0; i < num_threads; i++){
+        size_t st = i * n / num_threads, end = (i + 1) * n / num_threads;
+        t.push_back(thread(fn, i, st, end));
+    }
+    for(thread &x: t) x.join();
+}
+
+vector<int> select_top_k(const float *scores, size_t n, size_t k, int num_threads){
+    num_threads = max(1, min(num_threads, (int)(n / 65536) + 1));
+
+    // Pass 1: histogram of the high bits of every key
+    vector<vector<size_t>> histograms(num_threads, vector<size_t>(NUM_BUCKETS, 0));
+    parallel_for(n, num_threads, [&](int t, size_t st, size_t end){
+        size_t *histogram = histograms[t].data();
+        for(size_t i = st; i < end; i++){
+            if(scores[i] != -INFINITY)
+                histogram[get_bucket(scores[i])]++;
+        }
+    });
+
+    vector<size_t> histogram(NUM_BUCKETS, 0);
+    size_t num_valid = 0;
+    for(auto &h: histograms){
+        for(int b = 0; b < NUM_BUCKETS; b++)
+            histogram[b] += h[b];
+    }
+    for(int b = 0; b < NUM_BUCKETS; b++)
+        num_valid += histogram[b];
+    k = min(k, num_valid);
+    if(k == 0)
+        return {};
+
+    // The bucket holding the k-th largest score, and how many to take from it
+    int threshold = NUM_BUCKETS - 1;
+    size_t above = 0;
+    while(above + histogram[threshold] < k)
+        above += histogram[threshold--];
+    size_t from_threshold = k - above;
+
+    // Pass 2: gather everything above the threshold bucket and the candidates within it
+    vector<vector<int>> selected(num_threads), candidates(num_threads);
+    parallel_for(n, num_threads, [&](int t, size_t st, size_t end){
+        for(size_t i = st; i < end; i++){
+            if(scores[i] == -INFINITY)
+                continue;
+            int bucket = get_bucket(scores[i]);
+            if(bucket > threshold)
+                selected[t].push_back(i);
+            else if(bucket == threshold)
+                candidates[t].push_back(i);
+        }
+    });
+
+    vector<int> result;
+    result.reserve(k);
+    for(auto &s: selected)
+        result.insert(result.end(), s.begin(), s.end());
+
+    // Higher score first, smaller index first among ties
+    auto better = [scores](int a, int b) -> bool {
+        return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+    };
+
+    vector<int> threshold_docs;
+    for(auto &c: candidates)
+        threshold_docs.insert(threshold_docs.end(), c.begin(), c.end());
+    nth_element(threshold_docs.begin(), threshold_docs.begin() + (from_threshold - 1), threshold_docs.end(), better);
+    result.insert(result.end(), threshold_docs.begin(), threshold_docs.begin() + from_threshold);
+
+    sort(result.begin(), result.end(), [&better](int a, int b) -> bool { return better(b, a); });
+    return result;
+}
@@ -0,0 +1,22 @@
+#ifndef SELECT_H
+#define SELECT_H
+
+#include <cstddef>
+#include <vector>
+
+/*
+ * Parallel top-k selection over a contiguous array of scores.
+ *
+ * Scores are mapped to order preserving integer keys, and a radix pass over
+ * the high bits of every key finds the bucket holding the k-th largest
+ * score. Everything above that bucket is selected in a second streaming
+ * pass, and only the scores falling into the bucket itself are compared.
+ * Entries equal to -infinity are never selected.
+ *
+ * Returns the indices of the (up to) k largest scores, ordered from the
+ * lowest to the highest score. Ties are broken towards smaller indices,
+ * which appear later in the result.
+ */
+std::vector<int> select_top_k(const float *scores, size_t n, size_t k, int num_threads);
+
+#endif // SELECT_H
@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <thread>
+#include "synthetic_corpus.h"
+#include "feature_writer.h"
+
+using namespace std;
+
+// Consonants left alone by the tokenizer and the porter stemmer
+static const char TERM_CHARS[] = "bcdfghjklmnpqrtvwxz";
+
+SyntheticCorpus::SyntheticCorpus(const SyntheticCorpusOptions &_options): options(_options) {
+    term_cdf.resize(options.vocabulary_size);
+    double sum = 0;
+    for(size_t rank = 0; rank < options.vocabulary_size; rank++){
+        sum += 1 / pow(rank + 1, options.zipf_exponent);
+        term_cdf[rank] = sum;
+    }
+
+    // Topic terms are mid-frequency: frequent enough to be in every relevant
+    // document, rare enough to separate relevant documents from the rest
+    size_t lo = options.vocabulary_size / 1000, hi = max(lo + 1, options.vocabulary_size / 10);
+    mt19937_64 rand_generator(options.seed ^ 0x5851F42D4C957F2DULL);
+    uniform_int_distribution<size_t> rank_distribution(lo, hi - 1);
+    while(topic_terms.size() < min(options.num_topic_terms, hi - lo)){
+        uint32_t term = rank_distribution(rand_generator);
+        if(find(topic_terms.begin(), topic_terms.end(), term) == topic_terms.end())
+            topic_terms.push_back(term);
+    }
+    sort(topic_terms.begin(), topic_terms.end());
+}
+
+bool SyntheticCorpus::is_relevant(size_t doc_idx) const {
+    if(options.relevant_rate <= 0)
+        return false;
+    // splitmix64 of the seed and the document index
+    uint64_t x = options.seed * 0xD1B54A32D192ED03ULL + doc_idx + 1;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x = x ^ (x >> 31);
+    return (x >> 11) * (1.0 / (1ULL << 53)) < options.relevant_rate;
+}
+
+vector<vector<uint32_t>> SyntheticCorpus::generate_document(size_t doc_idx) const {
+    mt19937_64 rand_generator(options.seed * 0x9E3779B97F4A7C15ULL + doc_idx);
+
+    // Log-normal document lengths around the mean
+    const double sigma = 0.5;
+    lognormal_distribution<double> length_distribution(log(options.mean_doc_length) - sigma * sigma / 2, sigma);
+    poisson_distribution<size_t> paragraphs_distribution(max(options.mean_paragraphs, (size_t)1) - 1);
+    uniform_real_distribution<double> term_distribution(0, term_cdf.back());
+    bernoulli_distribution topic_distribution(options.topic_weight);
+    uniform_int_distribution<size_t> topic_term_distribution(0, max(topic_terms.size(), (size_t)1) - 1);
+    bool relevant = is_relevant(doc_idx) && !topic_terms.empty();
+
+    size_t length = max((size_t)1, (size_t)length_distribution(rand_generator));
+    size_t num_paragraphs = min(length, 1 + paragraphs_distribution(rand_generator));
+
+    vector<vector<uint32_t>> paragraphs(num_paragraphs);
+    for(size_t p = 0; p < num_paragraphs; p++){
+        size_t para_length = (p + 1) * length / num_paragraphs - p * length / num_paragraphs;
+        for(size_t i = 0; i < para_length; i++){
+            double u = term_distribution(rand_generator);
+            size_t rank = upper_bound(term_cdf.begin(), term_cdf.end(), u) - term_cdf.begin();
+            paragraphs[p].push_back(min(rank, term_cdf.size() - 1));
+            if(relevant && topic_distribution(rand_generator))
+                paragraphs[p].back() = topic_terms[topic_term_distribution(rand_generator)];
+        }
+    }
+    return paragraphs;
+}
+
+string SyntheticCorpus::get_term(uint32_t term_id) const {
+    const size_t num_chars = sizeof(TERM_CHARS) - 1;
+    string term = "x";
+    do {
+        term.push_back(TERM_CHARS[term_id % num_chars]);
+        term_id /= num_chars;
+    } while(term_id > 0);
+    return term;
+}
+
+string SyntheticCorpus::get_doc_id(size_t doc_idx) const {
+    return "doc" + to_string(doc_idx);
+}
+
+string SyntheticCorpus::get_paragraph_id(size_t doc_idx, size_t para_idx) const {
+    return get_doc_id(doc_idx) + "." + to_string(para_idx);
+}
+
+string SyntheticCorpus::get_text(size_t doc_idx) const {
+    string text;
+    for(auto &paragraph: generate_document(doc_idx)){
+        if(!text.empty())
+            text += "\n\n";
+        for(size_t i = 0; i < paragraph.size(); i++){
+            if(i > 0)
+                text.push_back(' ');
+            text += get_term(paragraph[i]);
+        }
+    }
+    return text;
+}
+
+// Term frequencies of `tokens`, sorted by term id
+static vector<pair<uint32_t, uint32_t>> get_tf(vector<uint32_t> tokens){
+    sort(tokens.begin(), tokens.end());
+    vector<pair<uint32_t, uint32_t>> tf;
+    for(uint32_t token: tokens){
+        if(tf.empty() || tf.back().first != token)
+            tf.push_back({token, 0});
+        tf.back().second++;
+    }
+    return tf;
+}
+
+// Calls `f(thread_idx, i)` for every i in [begin, end), split evenly over the threads
+template<class F>
+static void parallel_for(size_t begin, size_t end, int num_threads, const F &f){
+    vector<thread> workers;
+    for(int t = 0; t < num_threads; t++){
+        size_t st = begin + t * (end - begin) / num_threads;
+        size_t en = begin + (t + 1) * (end - begin) / num_threads;
+        workers.push_back(thread([&f, t, st, en]{
+            for(size_t i = st; i < en; i++)
+                f(t, i);
+        }));
+    }
+    for(auto &worker: workers)
+        worker.join();
+}
+
+void SyntheticCorpus::write_features(const string &doc_features_path, const string &para_features_path,
+                                     int num_threads) const {
+    num_threads = max(num_threads, 1);
+
+    // Pass 1: document frequencies
+    vector<vector<uint32_t>> thread_df(num_threads, vector<uint32_t>(options.vocabulary_size, 0));
+    parallel_for(0, options.num_docs, num_threads, [this, &thread_df](int t, size_t d){
+        vector<uint32_t> tokens;
+        for(auto &paragraph: generate_document(d))
+            tokens.insert(tokens.end(), paragraph.begin(), paragraph.end());
+        for(auto &tf: get_tf(tokens))
+            thread_df[t][tf.first]++;
+    });
+    vector<uint32_t> df(options.vocabulary_size, 0);
+    for(auto &counts: thread_df)
+        for(size_t term = 0; term < options.vocabulary_size; term++)
+            df[term] += counts[term];
+    thread_df.clear();
+
+    // Like corpus_parser, only terms in at least two documents get a feature id
+    vector<pair<string, uint32_t>> dictionary;
+    vector<uint32_t> feature_ids(options.vocabulary_size, 0);
+    vector<float> idf(options.vocabulary_size, 0);
+    for(uint32_t term = 0; term < options.vocabulary_size; term++){
+        if(df[term] < 2)
+            continue;
+        dictionary.push_back({get_term(term), df[term]});
+        feature_ids[term] = dictionary.size();
+        idf[term] = log(options.num_docs / (float)df[term]);
+    }
+
+    // Pass 2: features, computed in parallel a batch at a time and written in order
+    BinFeatureWriter doc_writer(doc_features_path, dictionary);
+    unique_ptr<BinFeatureWriter> para_writer;
+    if(!para_features_path.empty())
+        para_writer = make_unique<BinFeatureWriter>(para_features_path, dictionary);
+
+    const size_t batch_size = 1024 * num_threads;
+    vector<vector<FeatureValuePair>> doc_features(batch_size);
+    vector<vector<vector<FeatureValuePair>>> para_features(batch_size);
+    for(size_t batch_start = 0; batch_start < options.num_docs; batch_start += batch_size){
+        size_t batch_end = min(options.num_docs, batch_start + batch_size);
+        parallel_for(batch_start, batch_end, num_threads, [&](int t, size_t d){
+            auto paragraphs = generate_document(d);
+            vector<uint32_t> tokens;
+            for(auto &paragraph: paragraphs)
+                tokens.insert(tokens.end(), paragraph.begin(), paragraph.end());
+
+            auto &features = doc_features[d - batch_start];
+            features.clear();
+            double sum = 0;
+            for(auto &tf: get_tf(tokens)){
+                if(feature_ids[tf.first] == 0)
+                    continue;
+                features.push_back({feature_ids[tf.first], (float)((1 + log(tf.second)) * idf[tf.first])});
+                sum += features.back().value_ * features.back().value_;
+            }
+            sum = sqrt(sum);
+            for(auto &f: features)
+                f.value_ /= max(sum, 1e-9);
+
+            if(para_writer == nullptr)
+                return;
+            para_features[d - batch_start].resize(paragraphs.size());
+            for(size_t p = 0; p < paragraphs.size(); p++){
+                auto &para_vector = para_features[d - batch_start][p];
+                para_vector.clear();
+                sum = 0;
+                for(auto &tf: get_tf(paragraphs[p])){
+                    if(feature_ids[tf.first] == 0)
+                        continue;
+                    para_vector.push_back({feature_ids[tf.first], (float)(tf.second * idf[tf.first])});
+                    sum += para_vector.back().value_ * para_vector.back().value_;
+                }
+                sum = max(20.0, sqrt(sum));
+                for(auto &f: para_vector)
+                    f.value_ /= sum;
+            }
+        });
+
+        for(size_t d = batch_start; d < batch_end; d++){
+            doc_writer.write(SfSparseVector(doc_features[d - batch_start]), get_doc_id(d));
+            if(para_writer == nullptr)
+                continue;
+            auto &paragraphs = para_features[d - batch_start];
+            for(size_t p = 0; p < paragraphs.size(); p++)
+                para_writer->write(SfSparseVector(paragraphs[p]), get_paragraph_id(d, p));
+        }
+    }
+
+    doc_writer.finish();
+    if(para_writer != nullptr)
+        para_writer->finish();
+}
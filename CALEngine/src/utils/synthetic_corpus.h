@@ -0,0 +1,62 @@
+#ifndef SYNTHETIC_CORPUS_H
+#define SYNTHETIC_CORPUS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct SyntheticCorpusOptions {
+    size_t num_docs = 10000;
+    size_t vocabulary_size = 100000;
+    size_t mean_doc_length = 200;   // Tokens per document
+    size_t mean_paragraphs = 4;     // Paragraphs per document
+    double zipf_exponent = 1.0;     // Term frequencies fall off as 1 / rank^zipf_exponent
+    uint64_t seed = 0;
+
+    // Planted topic: relevant documents draw this fraction of their tokens
+    // uniformly from a small set of mid-frequency topic terms
+    double relevant_rate = 0;
+    size_t num_topic_terms = 20;
+    double topic_weight = 0.05;
+};
+
+/*
+ * Deterministic random corpus, for running benchmarks and experiments without
+ * real collections. Documents are generated independently from their index,
+ * so any document can be regenerated without storing the corpus.
+ *
+ * Terms are strings of consonants, which the BMI tokenizer leaves intact, so
+ * generated text tokenizes back to the generated terms.
+ */
+class SyntheticCorpus {
+    const SyntheticCorpusOptions options;
+    std::vector<double> term_cdf;
+    std::vector<uint32_t> topic_terms;
+
+    public:
+    explicit SyntheticCorpus(const SyntheticCorpusOptions &_options);
+
+    // Term ids of every token, for every paragraph of the document
+    std::vector<std::vector<uint32_t>> generate_document(size_t doc_idx) const;
+
+    // Whether the document belongs to the planted relevant set
+    bool is_relevant(size_t doc_idx) const;
+
+    const std::vector<uint32_t> &get_topic_terms() const { return topic_terms; }
+
+    std::string get_term(uint32_t term_id) const;
+    std::string get_doc_id(size_t doc_idx) const;
+    std::string get_paragraph_id(size_t doc_idx, size_t para_idx) const;
+
+    // Document text, with paragraphs separated by empty lines
+    std::string get_text(size_t doc_idx) const;
+
+    // Writes tf-idf features in the bin format, weighted as corpus_parser does.
+    // Paragraph features are skipped if `para_features_path` is empty.
+    void write_features(const std::string &doc_features_path, const std::string &para_features_path,
+                        int num_threads = 1) const;
+
+    const SyntheticCorpusOptions &get_options() const { return options; }
+};
+
+#endif // SYNTHETIC_CORPUS_H
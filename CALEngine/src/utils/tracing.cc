@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+#include "tracing.h"
+
+using namespace std;
+
+namespace tracing {
+    namespace {
+        const size_t THREAD_BUFFER_SIZE = 4096;
+        // Spans kept from threads which have exited
+        const size_t RETIRED_BUFFER_SIZE = 1 << 16;
+
+        struct Event {
+            char name[32];
+            char session[48];
+            int32_t iteration;
+            uint32_t thread_idx;
+            uint64_t start_ns;
+            uint64_t duration_ns;
+        };
+
+        // Written by its thread, read by the exporter; the mutex is uncontended otherwise
+        struct ThreadBuffer {
+            mutex buffer_mutex;
+            vector<Event> events;
+            size_t num_recorded = 0;
+            uint32_t thread_idx;
+
+            void add(const Event &event){
+                lock_guard<mutex> lock(buffer_mutex);
+                if(events.size() < THREAD_BUFFER_SIZE)
+                    events.push_back(event);
+                else
+                    events[num_recorded % THREAD_BUFFER_SIZE] = event;
+                num_recorded++;
+            }
+        };
+
+        struct Tracer {
+            atomic<bool> is_enabled{false};
+            const chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+
+            mutex buffers_mutex;
+            vector<ThreadBuffer*> buffers;
+            deque<Event> retired;
+            uint32_t num_threads = 0;
+
+            ThreadBuffer *add_buffer(){
+                lock_guard<mutex> lock(buffers_mutex);
+                ThreadBuffer *buffer = new ThreadBuffer();
+                buffer->thread_idx = num_threads++;
+                buffers.push_back(buffer);
+                return buffer;
+            }
+
+            void retire(ThreadBuffer *buffer){
+                lock_guard<mutex> lock(buffers_mutex);
+                buffers.erase(find(buffers.begin(), buffers.end(), buffer));
+                retired.insert(retired.end(), buffer->events.begin(), buffer->events.end());
+                while(retired.size() > RETIRED_BUFFER_SIZE)
+                    retired.pop_front();
+                delete buffer;
+            }
+        };
+
+        // Never destroyed, so that threads still running at exit can keep recording
+        Tracer &get_tracer(){
+            static Tracer *tracer = new Tracer();
+            return *tracer;
+        }
+
+        struct ThreadState {
+            Context context;
+            ThreadBuffer *buffer = nullptr;
+            ~ThreadState(){
+                if(buffer != nullptr)
+                    get_tracer().retire(buffer);
+                buffer = nullptr;
+            }
+        };
+        thread_local ThreadState thread_state;
+
+        void copy_string(char *dest, size_t size, const char *src, size_t len){
+            len = min(len, size - 1);
+            memcpy(dest, src, len);
+            dest[len] = '\0';
+        }
+
+        void write_json_string(FILE *fp, const char *str){
+            fputc('"', fp);
+            for(; *str; str++){
+                if(*str == '"' || *str == '\\')
+                    fprintf(fp, "\\%c", *str);
+                else if((unsigned char)*str < 0x20)
+                    fprintf(fp, "\\u%04x", *str);
+                else
+                    fputc(*str, fp);
+            }
+            fputc('"', fp);
+        }
+    }
+
+    void set_enabled(bool enabled){
+        get_tracer().is_enabled.store(enabled, memory_order_relaxed);
+    }
+
+    bool enabled(){
+        return get_tracer().is_enabled.load(memory_order_relaxed);
+    }
+
+    const Context &get_context(){
+        return thread_state.context;
+    }
+
+    ScopedContext::ScopedContext(const Context &context): saved(thread_state.context) {
+        thread_state.context = context;
+    }
+
+    ScopedContext::ScopedContext(const string &session): saved(thread_state.context) {
+        thread_state.context.session = session;
+    }
+
+    ScopedContext::ScopedContext(int iteration): saved(thread_state.context) {
+        thread_state.context.iteration = iteration;
+    }
+
+    ScopedContext::~ScopedContext(){
+        thread_state.context = saved;
+    }
+
+    void Span::end(){
+        if(!active)
+            return;
+        active = false;
+
+        Tracer &tracer = get_tracer();
+        auto now = chrono::steady_clock::now();
+        if(thread_state.buffer == nullptr)
+            thread_state.buffer = tracer.add_buffer();
+
+        Event event;
+        copy_string(event.name, sizeof(event.name), name, strlen(name));
+        const Context &context = thread_state.context;
+        copy_string(event.session, sizeof(event.session), context.session.data(), context.session.size());
+        event.iteration = context.iteration;
+        event.thread_idx = thread_state.buffer->thread_idx;
+        event.start_ns = chrono::duration_cast<chrono::nanoseconds>(start - tracer.epoch).count();
+        event.duration_ns = chrono::duration_cast<chrono::nanoseconds>(now - start).count();
+        thread_state.buffer->add(event);
+    }
+
+    long write_chrome_trace(const string &path){
+        Tracer &tracer = get_tracer();
+        vector<Event> events;
+        {
+            lock_guard<mutex> lock(tracer.buffers_mutex);
+            events.assign(tracer.retired.begin(), tracer.retired.end());
+            for(ThreadBuffer *buffer: tracer.buffers){
+                lock_guard<mutex> lock_buffer(buffer->buffer_mutex);
+                events.insert(events.end(), buffer->events.begin(), buffer->events.end());
+            }
+        }
+        sort(events.begin(), events.end(), [](const Event &a, const Event &b) -> bool {
+            return a.start_ns < b.start_ns;
+        });
+
+        string tmp_path = path + ".tmp";
+        FILE *fp = fopen(tmp_path.c_str(), "w");
+        if(fp == nullptr)
+            return -1;
+        fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+        for(size_t i = 0; i < events.size(); i++){
+            const Event &event = events[i];
+            fprintf(fp, "%s\n{\"name\": ", i == 0 ? "" : ",");
+            write_json_string(fp, event.name);
+            fprintf(fp, ", \"cat\": \"cal\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %u, \"args\": {\"session\": ",
+                    event.start_ns / 1e3, event.duration_ns / 1e3, (int)getpid(), event.thread_idx);
+            write_json_string(fp, event.session);
+            fprintf(fp, ", \"iteration\": %d}}", event.iteration);
+        }
+        fprintf(fp, "\n]}\n");
+        bool ok = !ferror(fp);
+        ok = (fclose(fp) == 0) && ok;
+        if(!ok || rename(tmp_path.c_str(), path.c_str()) != 0){
+            unlink(tmp_path.c_str());
+            return -1;
+        }
+        return events.size();
+    }
+
+    void clear(){
+        Tracer &tracer = get_tracer();
+        lock_guard<mutex> lock(tracer.buffers_mutex);
+        tracer.retired.clear();
+        for(ThreadBuffer *buffer: tracer.buffers){
+            lock_guard<mutex> lock_buffer(buffer->buffer_mutex);
+            buffer->events.clear();
+            buffer->num_recorded = 0;
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/*
+ * Spans of time spent in the stages of a session, exportable as Chrome
+ * trace-event JSON (chrome://tracing, Perfetto).
+ *
+ * Spans are tagged with the session and iteration of the calling thread's
+ * context and kept in a bounded buffer per thread, oldest spans being
+ * overwritten first. Nothing is recorded until tracing is enabled.
+ */
+namespace tracing {
+    // Session and iteration attached to the spans of a thread
+    struct Context {
+        std::string session;
+        int iteration = -1;
+    };
+
+    void set_enabled(bool enabled);
+    bool enabled();
+
+    const Context &get_context();
+
+    // Replaces the context of the calling thread until destroyed
+    class ScopedContext {
+        Context saved;
+
+        public:
+        explicit ScopedContext(const Context &context);
+        explicit ScopedContext(const std::string &session);
+        explicit ScopedContext(int iteration);
+        ~ScopedContext();
+    };
+
+    // Records the time from construction to end() or destruction. `name` must
+    // outlive the span.
+    class Span {
+        const char *name;
+        std::chrono::steady_clock::time_point start;
+        bool active;
+
+        public:
+        explicit Span(const char *_name): name(_name), active(enabled()) {
+            if(active)
+                start = std::chrono::steady_clock::now();
+        }
+        ~Span() { end(); }
+        void end();
+    };
+
+    // Writes all recorded spans to `path`, returns the number of spans written or -1 on failure
+    long write_chrome_trace(const std::string &path);
+
+    // Forgets all recorded spans
+    void clear();
+}
+
+#endif // TRACING_H
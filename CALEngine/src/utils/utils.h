@@ -3,12 +3,17 @@
 
 #include <string>
 #include <chrono>
+#include "logging.h"
+#include "tracing.h"
 
+// Logs the time taken between the two, which is also recorded as a tracing span
 #define TIMER_BEGIN(key) \
-    auto start##key = std::chrono::steady_clock::now();
+    auto start##key = std::chrono::steady_clock::now(); \
+    tracing::Span span##key(#key);
 
 #define TIMER_END(key) \
-    std::cerr<<"("<< #key <<"): "<<(std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now() - start##key)).count()<<"ms\n";
+    span##key.end(); \
+    logging::info("(" #key "): " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now() - start##key).count()) + "ms");
 
 void msg(const char *message);
 void fail(const char *message, int e);
@@ -0,0 +1,116 @@
+#include <iostream>
+#include <cassert>
+#include <random>
+#include <unistd.h>
+#include "../src/utils/feature_parser.h"
+#include "../src/utils/feature_writer.h"
+#include "../src/dataset.h"
+
+using namespace std;
+
+void verify_parsed(const ParsedFeatures &p1, const ParsedFeatures &p2){
+    assert(p1.doc_offsets == p2.doc_offsets);
+    assert(p1.squared_norms == p2.squared_norms);
+    assert(p1.dimensionality == p2.dimensionality);
+    assert(p1.features.size() == p2.features.size());
+    for(size_t i = 0; i < p1.features.size(); i++){
+        assert(p1.features[i].id_ == p2.features[i].id_);
+        assert(p1.features[i].value_ == p2.features[i].value_);
+    }
+    assert(p1.doc_ids.size() == p2.doc_ids.size());
+    for(size_t i = 0; i < p1.doc_ids.size(); i++){
+        assert(p1.doc_ids.get(i) == p2.doc_ids.get(i));
+        assert(p2.doc_ids.find(p1.doc_ids.get(i)) == i);
+    }
+}
+
+int main(int argc, char *argv[]){
+    string bin_file = "/tmp/test_bin_feature_parser.bin";
+    const int num_docs = 5000;
+    {
+        // Documents of very different lengths, including empty ones
+        mt19937 rand_generator(42);
+        BinFeatureWriter writer(bin_file, {{"alpha", 3}, {"beta", 5}});
+        for(int i = 0; i < num_docs; i++){
+            vector<FeatureValuePair> features;
+            int num_features = i % 10 == 0 ? rand_generator() % 2000 : rand_generator() % 20;
+            uint32_t id = 0;
+            for(int j = 0; j < num_features; j++){
+                id += 1 + rand_generator() % 5;
+                features.push_back({id, (rand_generator() % 1000) / 1000.0f});
+            }
+            writer.write(SfSparseVector("doc" + to_string(i), features));
+        }
+        writer.finish();
+    }
+
+    BinFeatureParser sequential_parser(bin_file);
+    ParsedFeatures sequential = sequential_parser.FeatureParser::parse_all(1);
+    assert(sequential.squared_norms.size() == num_docs);
+
+    for(int num_threads: {1, 3, 8}){
+        cerr<<"Testing parsing on "<<num_threads<<" threads...";
+        BinFeatureParser parser(bin_file);
+        auto &dictionary = parser.get_dictionary();
+        assert(dictionary.size() == 2);
+        assert(dictionary[0].first == "alpha" && dictionary[0].second.id == 1 && dictionary[0].second.df == 3);
+        assert(dictionary[1].first == "beta" && dictionary[1].second.id == 2 && dictionary[1].second.df == 5);
+        verify_parsed(sequential, parser.parse_all(num_threads));
+        assert(parser.next() == nullptr);
+        cerr<<"OK!"<<endl;
+    }
+
+    cerr<<"Testing random access...";
+    {
+        auto reader = BinFeatureReader::open(bin_file);
+        assert(reader != nullptr && reader->size() == num_docs);
+        for(size_t k = 0; k < num_docs; k += 7){
+            size_t i = num_docs - 1 - k;
+            string doc_id = "doc" + to_string(i);
+            assert(reader->get_doc_id(i) == doc_id);
+            assert(reader->find(doc_id) == i);
+            auto spv = reader->get(doc_id);
+            assert(spv != nullptr && spv->doc_id == doc_id);
+            assert(spv->GetSquaredNorm() == sequential.squared_norms[i]);
+            assert(spv->features_.size() == sequential.doc_offsets[i + 1] - sequential.doc_offsets[i]);
+            for(size_t j = 0; j < spv->features_.size(); j++){
+                assert(spv->features_[j].id_ == sequential.features[sequential.doc_offsets[i] + j].id_);
+                assert(spv->features_[j].value_ == sequential.features[sequential.doc_offsets[i] + j].value_);
+            }
+        }
+        assert(reader->find("doc") == BinFeatureReader::NPOS);
+        assert(reader->get("doc" + to_string(num_docs)) == nullptr);
+    }
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing a file without an index...";
+    {
+        BinIndexTrailer trailer;
+        FILE *fp = fopen(bin_file.c_str(), "rb");
+        assert(read_bin_index_trailer(fileno(fp), trailer));
+        fclose(fp);
+        assert(truncate(bin_file.c_str(), trailer.records_end) == 0);
+        assert(BinFeatureReader::open(bin_file) == nullptr);
+
+        BinFeatureParser parser(bin_file);
+        verify_parsed(sequential, parser.parse_all(3));
+        BinFeatureParser sequential_parser(bin_file);
+        verify_parsed(sequential, sequential_parser.FeatureParser::parse_all(1));
+    }
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing an empty file...";
+    {
+        BinFeatureWriter writer(bin_file, {});
+        writer.finish();
+    }
+    {
+        BinFeatureParser parser(bin_file);
+        ParsedFeatures parsed = parser.parse_all(4);
+        assert(parsed.squared_norms.empty() && parsed.doc_ids.size() == 0);
+        assert(parsed.doc_offsets.size() == 1 && parsed.dimensionality == 1);
+    }
+    cerr<<"OK!"<<endl;
+
+    unlink(bin_file.c_str());
+}
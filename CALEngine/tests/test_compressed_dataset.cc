@@ -0,0 +1,187 @@
+#include <iostream>
+#include <fstream>
+#include <cassert>
+#include <cmath>
+#include <random>
+#include <set>
+#include <unistd.h>
+#include "../src/utils/feature_parser.h"
+#include "../src/utils/feature_codec.h"
+#include "../src/dataset.h"
+
+using namespace std;
+
+// Largest difference between an encoded value and `value` in a document whose largest value is `max_value`
+static float quantization_error(float max_value){
+    int exponent;
+    frexp(max_value / 32767, &exponent);
+    return ldexp(1.0f, exponent) / 2;
+}
+
+int main(int argc, char *argv[]){
+    mt19937 rand_generator(11);
+
+    cerr<<"Testing the codec...";
+    {
+        // Gaps of 1 to 4 bytes, and every length of the last group. Ids of 4 byte gaps
+        // are too large for the weights of an inner product.
+        for(int n = 0; n < 40; n++){
+            bool wide = n % 8 >= 4;
+            vector<uint32_t> gap_limits = {1 << 8, 1 << 16, 1 << 18, wide ? 1u << 28 : 1u << 18};
+            vector<FeatureValuePair> features;
+            uint32_t id = 0;
+            float max_value = 0;
+            for(int i = 0; i < n; i++){
+                id += rand_generator() % gap_limits[rand_generator() % 4] + (i > 0);
+                features.push_back({id, ((int)(rand_generator() % 2001) - 1000) / 997.0f});
+                max_value = max(max_value, fabs(features.back().value_));
+            }
+            vector<uint8_t> encoded = {42};
+            feature_codec::encode(features.data(), n, encoded);
+            encoded.resize(encoded.size() + feature_codec::PADDING);
+
+            vector<FeatureValuePair> decoded(n);
+            feature_codec::decode(encoded.data() + 1, n, decoded.data());
+            for(int i = 0; i < n; i++){
+                assert(decoded[i].id_ == features[i].id_);
+                assert(fabs(decoded[i].value_ - features[i].value_) <= quantization_error(max_value));
+            }
+
+            if(wide)
+                continue;
+            vector<float> weights(n > 0 ? features.back().id_ + 1 : 1, 0);
+            float expected = 0, magnitude = 0;
+            for(int i = 0; i < n; i++){
+                weights[features[i].id_] = ((int)(rand_generator() % 201) - 100) / 10.0f;
+                expected += weights[features[i].id_] * decoded[i].value_;
+                magnitude += fabs(weights[features[i].id_] * decoded[i].value_);
+            }
+            assert(fabs(feature_codec::inner_product(encoded.data() + 1, n, weights.data()) - expected) <= 1e-5 * magnitude);
+        }
+
+        // The bias term and values of a unit vector are exact at their scale
+        vector<FeatureValuePair> features = {{0, 1}, {3, 0.5}, {7, -0.25}};
+        vector<uint8_t> encoded;
+        feature_codec::encode(features.data(), features.size(), encoded);
+        vector<FeatureValuePair> decoded(features.size());
+        feature_codec::decode(encoded.data(), features.size(), decoded.data());
+        for(size_t i = 0; i < features.size(); i++)
+            assert(decoded[i].id_ == features[i].id_ && decoded[i].value_ == features[i].value_);
+    }
+    cerr<<"OK!"<<endl;
+
+    string svm_file = "/tmp/test_compressed_dataset.svm", para_file = "/tmp/test_compressed_dataset.para.svm";
+    string container = "/tmp/test_compressed_dataset.cal", para_container = "/tmp/test_compressed_dataset.para.cal";
+    const int num_docs = 3000, dimensionality = 2000;
+    {
+        ofstream svm(svm_file), para(para_file);
+        for(int i = 0; i < num_docs; i++){
+            svm<<"doc"<<i;
+            for(int id = 1 + i % 5; id < dimensionality; id += 1 + rand_generator() % 40)
+                svm<<" "<<id<<":"<<(1 + rand_generator() % 1000) / 1000.0;
+            svm<<"\n";
+            for(int p = 0; p < 1 + i % 3; p++){
+                para<<"doc"<<i<<"."<<p;
+                for(int id = 1 + p; id < dimensionality; id += 1 + rand_generator() % 200)
+                    para<<" "<<id<<":"<<(1 + rand_generator() % 1000) / 1000.0;
+                para<<"\n";
+            }
+        }
+    }
+    SVMlightFeatureParser parser(svm_file, ""), compressed_parser(svm_file, "");
+    SVMlightFeatureParser para_parser(para_file, ""), compressed_para_parser(para_file, "");
+    auto loaded = Dataset::build(&parser);
+    auto compressed = Dataset::build(&compressed_parser, "", 0, 1, true);
+    auto paragraphs = ParagraphDataset::build(&para_parser, *loaded);
+    auto compressed_paragraphs = ParagraphDataset::build(&compressed_para_parser, *compressed, "", 0, 1, true);
+
+    vector<float> weights(dimensionality);
+    for(float &weight: weights)
+        weight = ((int)(rand_generator() % 2001) - 1000) / 1000.0f;
+    AtomicBitset judged(num_docs);
+    for(int i = 0; i < num_docs; i += 3)
+        judged.set(i);
+
+    cerr<<"Testing compressed documents...";
+    assert(!loaded->is_compressed() && compressed->is_compressed() && compressed_paragraphs->is_compressed());
+    assert(compressed->get_store().features_size() * 2 < loaded->get_store().features_size());
+    for(int i = 0; i < num_docs; i++){
+        SfSparseVector spv = compressed->get_sf_sparse_vector(i), expected = loaded->get_sf_sparse_vector(i);
+        assert(spv.NumFeatures() == expected.NumFeatures() && spv.GetSquaredNorm() == expected.GetSquaredNorm());
+        assert(spv.FeatureAt(0) == 0 && spv.ValueAt(0) == 1);
+        for(int j = 0; j < spv.NumFeatures(); j++)
+            assert(spv.FeatureAt(j) == expected.FeatureAt(j) && fabs(spv.ValueAt(j) - expected.ValueAt(j)) <= 1.0f / 32768);
+        assert(fabs(compressed->inner_product(i, weights) - loaded->inner_product(i, weights)) < 1e-2);
+        assert(compressed->get_id(i) == loaded->get_id(i));
+    }
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing rescoring...";
+    for(int num_threads: {1, 3}){
+        for(int num_top_docs: {100, 1500}){
+            vector<int> top_docs = compressed->rescore(weights, num_threads, num_top_docs, judged);
+            vector<int> expected = loaded->rescore(weights, num_threads, num_top_docs, judged);
+            assert(top_docs.size() == expected.size());
+            // Every top document outscores the next, as computed by inner_product()
+            for(size_t i = 1; i < top_docs.size(); i++)
+                assert(compressed->inner_product(top_docs[i - 1], weights) <= compressed->inner_product(top_docs[i], weights));
+            set<int> expected_set(expected.begin(), expected.end());
+            size_t num_found = 0;
+            for(int idx: top_docs)
+                num_found += expected_set.count(idx);
+            assert(num_found >= 0.98 * expected.size());
+        }
+
+        vector<int> top_paragraphs = compressed_paragraphs->rescore(weights, num_threads, 100, judged);
+        vector<int> expected = paragraphs->rescore(weights, num_threads, 100, judged);
+        set<int> expected_set(expected.begin(), expected.end());
+        size_t num_found = 0;
+        for(int idx: top_paragraphs)
+            num_found += expected_set.count(idx);
+        assert(top_paragraphs.size() == expected.size() && num_found >= 98);
+    }
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing containers...";
+    compressed->get_store().save(container);
+    compressed_paragraphs->get_store().save(para_container);
+    {
+        auto reloaded = Dataset::load(container);
+        assert(reloaded != nullptr && reloaded->is_compressed());
+        auto reloaded_paragraphs = ParagraphDataset::load(para_container, *reloaded);
+        assert(reloaded_paragraphs != nullptr && reloaded_paragraphs->is_compressed());
+        assert(reloaded->rescore(weights, 2, 100, judged) == compressed->rescore(weights, 2, 100, judged));
+        assert(reloaded_paragraphs->rescore(weights, 2, 100, judged) == compressed_paragraphs->rescore(weights, 2, 100, judged));
+        assert(StreamedDataset::open(container, 4096) == nullptr);
+    }
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing appending...";
+    {
+        ParsedFeatures delta;
+        SfSparseVector spv("new0", {{5, 0.25}, {70000, 0.5}});
+        delta.features.assign(spv.features_.begin(), spv.features_.end());
+        delta.doc_offsets.push_back(delta.features.size());
+        delta.squared_norms.push_back(spv.GetSquaredNorm());
+        delta.doc_ids.push_back(spv.doc_id);
+        delta.doc_ids.build();
+        delta.dimensionality = 70001;
+        auto appended = compressed->append(delta, {});
+        assert(appended->is_compressed() && appended->size() == num_docs + 1);
+        for(int i = 0; i < num_docs; i += 7){
+            SfSparseVector spv = appended->get_sf_sparse_vector(i), expected = compressed->get_sf_sparse_vector(i);
+            assert(spv.NumFeatures() == expected.NumFeatures());
+            for(int j = 0; j < spv.NumFeatures(); j++)
+                assert(spv.FeatureAt(j) == expected.FeatureAt(j) && spv.ValueAt(j) == expected.ValueAt(j));
+        }
+        SfSparseVector added = appended->get_sf_sparse_vector(num_docs);
+        assert(added.NumFeatures() == 3 && added.FeatureAt(2) == 70000 && added.ValueAt(2) == 0.5);
+        assert(appended->get_index("new0") == num_docs);
+    }
+    cerr<<"OK!"<<endl;
+
+    unlink(svm_file.c_str());
+    unlink(para_file.c_str());
+    unlink(container.c_str());
+    unlink(para_container.c_str());
+}
@@ -0,0 +1,140 @@
+#include <iostream>
+#include <fstream>
+#include <cassert>
+#include <cmath>
+#include <unistd.h>
+#include "../src/utils/feature_parser.h"
+#include "../src/corpus_updater.h"
+#include "../src/bmi_para.h"
+#include "../src/features.h"
+
+using namespace std;
+
+int main(int argc, char *argv[]){
+    string svm_file = "/tmp/test_corpus_updater.svm";
+    string df_file = "/tmp/test_corpus_updater.df";
+    string para_file = "/tmp/test_corpus_updater.para.svm";
+    const vector<string> terms = {"cat", "dog", "fish", "bird", "frog", "lion", "bear", "wolf", "duck", "goat",
+                                  "crab", "seal", "hawk", "deer", "lamb", "moth", "newt", "toad", "ant", "owl"};
+    const int num_docs = 500;
+    {
+        ofstream svm(svm_file), df(df_file), para(para_file);
+        for(int i = 0; i < num_docs; i++){
+            svm<<"doc"<<i<<" "<<i % 7 + 1<<":0.5 "<<i % 13 + 8<<":"<<i / 1000.0<<"\n";
+            para<<"doc"<<i<<".0 "<<i % 7 + 1<<":0.5\n";
+        }
+        for(size_t i = 0; i < terms.size(); i++)
+            df<<i + 1<<" "<<terms[i]<<"\n";
+    }
+    SVMlightFeatureParser parser(svm_file, df_file), para_parser(para_file, "");
+    shared_ptr<Dataset> documents = Dataset::build(&parser);
+    shared_ptr<ParagraphDataset> paragraphs = ParagraphDataset::build(&para_parser, *documents);
+
+    Seed seed = {{features::get_features("cat dog", *documents), 1}};
+    BMI_para bmi(seed, documents.get(), paragraphs.get(), 2, -1, false, 1000);
+    assert(bmi.move_to_corpus({documents, paragraphs}));
+    vector<Corpus> published;
+    CorpusUpdater updater({documents, paragraphs}, false, [&](const Corpus &corpus){
+        bmi.move_to_corpus(corpus);
+        published.push_back(corpus);
+    });
+
+    cerr<<"Testing adding documents...";
+    // "yak" is in no document of the corpus, and enters the dictionary with the second document having it
+    assert(updater.add_document("new0", "cat cat dog yak", {}));
+    assert(!updater.add_document("new0", "cat", {}));
+    assert(!updater.add_document("doc3", "cat", {}));
+    assert(!updater.add_document("new.1", "cat", {}));
+    assert(!updater.add_document("", "cat", {}));
+    assert(updater.add_document("new1", "yak fish", {"yak", "fish fish", "bird"}));
+    assert(updater.num_pending() == 2);
+    assert(updater.get_corpus().documents == documents && published.empty());
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing merging...";
+    assert(updater.merge());
+    assert(!updater.merge());
+    assert(updater.num_pending() == 0 && published.size() == 1);
+    Corpus corpus = updater.get_corpus();
+    const Dataset &merged = *corpus.documents;
+    assert(merged.size() == num_docs + 2 && corpus.paragraphs->size() == num_docs + 4);
+    for(size_t i = 0; i < num_docs; i += 37){
+        assert(merged.get_index("doc" + to_string(i)) == i);
+        SfSparseVector spv = merged.get_sf_sparse_vector(i), expected = documents->get_sf_sparse_vector(i);
+        assert(spv.NumFeatures() == expected.NumFeatures() && spv.GetSquaredNorm() == expected.GetSquaredNorm());
+        for(int j = 0; j < spv.NumFeatures(); j++)
+            assert(spv.FeatureAt(j) == expected.FeatureAt(j) && spv.ValueAt(j) == expected.ValueAt(j));
+    }
+    assert(merged.get_index("new0") == num_docs && merged.get_index("new1") == num_docs + 1);
+
+    const TermInfo *cat = merged.get_dictionary().find("cat"), *yak = merged.get_dictionary().find("yak");
+    assert(cat != nullptr && cat->id == 1 && cat->df == 2);
+    assert(yak != nullptr && yak->id == 21 && yak->df == 2);
+    assert(merged.get_idf(cat->id) == (float)log((num_docs + 2) / 2.0f));
+
+    // "yak" had a document frequency of one when "new0" was added
+    SfSparseVector new0 = merged.get_sf_sparse_vector(num_docs), new1 = merged.get_sf_sparse_vector(num_docs + 1);
+    assert(new0.NumFeatures() == 3 && new0.FeatureAt(1) == 1 && new0.FeatureAt(2) == 2);
+    assert(new0.ValueAt(1) > new0.ValueAt(2));
+    assert(abs(new0.GetSquaredNorm() - 2) < 1e-5);
+    assert(new1.NumFeatures() == 3 && new1.FeatureAt(1) == 3 && new1.FeatureAt(2) == 21);
+    assert(merged.get_dimensionality() == 22);
+
+    // A document added without paragraphs has its text as its only paragraph
+    assert(corpus.paragraphs->get_paragraph_range(num_docs) == make_pair((uint32_t)num_docs, (uint32_t)num_docs + 1));
+    assert(corpus.paragraphs->get_paragraph_range(num_docs + 1) == make_pair((uint32_t)num_docs + 1, (uint32_t)num_docs + 4));
+    assert(corpus.paragraphs->translate_index(num_docs + 3) == num_docs + 1);
+    assert(corpus.paragraphs->get_id(num_docs + 2) == "new1.1");
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing sessions on the merged corpus...";
+    assert(bmi.get_dataset() == corpus.documents.get() && bmi.get_ranking_dataset() == corpus.paragraphs.get());
+    bmi.record_judgment("new1", 1);
+    assert(bmi.is_judged(num_docs + 3));
+    bmi.record_judgment(num_docs, -1);
+    vector<int> to_judge = bmi.get_doc_to_judge(5);
+    assert(!to_judge.empty());
+    for(int id: to_judge)
+        assert(id < (int)corpus.paragraphs->size() && !bmi.is_judged(id));
+
+    // The previous corpus is released once nothing uses it
+    weak_ptr<Dataset> previous = documents;
+    documents = nullptr;
+    paragraphs = nullptr;
+    assert(updater.add_document("new2", "owl", {}));
+    assert(updater.merge());
+    published.clear();
+    assert(previous.expired());
+    assert(bmi.get_dataset()->size() == num_docs + 3);
+    bmi.record_judgment("new2", 1);
+    assert(bmi.is_judged(num_docs + 4) && !bmi.get_doc_to_judge(5).empty());
+    assert(!bmi.move_to_corpus(corpus));
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing reloading...";
+    assert(updater.add_document("new3", "owl", {}));
+    SVMlightFeatureParser reloaded_parser(svm_file, df_file), reloaded_para_parser(para_file, "");
+    Corpus reloaded;
+    reloaded.documents = Dataset::build(&reloaded_parser);
+    reloaded.paragraphs = ParagraphDataset::build(&reloaded_para_parser, *reloaded.documents);
+    weak_ptr<Dataset> merged_documents = updater.get_corpus().documents;
+    reloaded = updater.reload(reloaded);
+    assert(reloaded.generation == 1 && updater.get_corpus().documents == reloaded.documents);
+    assert(updater.num_pending() == 0 && published.empty());
+
+    // The session stays on the corpus it holds, which is unloaded with the session
+    assert(!bmi.move_to_corpus(reloaded) && !merged_documents.expired());
+    assert(bmi.get_dataset() == merged_documents.lock().get());
+    vector<pair<string, int>> judgments = bmi.get_judgments();
+    assert((judgments == vector<pair<string, int>>{{"new0", -1}, {"new1", 1}, {"new2", 1}}));
+
+    // Merges keep the generation of the corpus they extend
+    assert(updater.add_document("new3", "owl", {}) && updater.merge());
+    assert(published.back().generation == 1 && published.back().documents->size() == num_docs + 1);
+    assert(bmi.get_dataset() == merged_documents.lock().get());
+    cerr<<"OK!"<<endl;
+
+    unlink(svm_file.c_str());
+    unlink(df_file.c_str());
+    unlink(para_file.c_str());
+}
@@ -0,0 +1,28 @@
+#include <iostream>
+#include <cassert>
+#include "../src/utils/doc_id_index.h"
+
+using namespace std;
+
+int main(int argc, char *argv[]){
+    const size_t num_ids = 1000000;
+    DocIdIndex doc_ids;
+    for(size_t i = 0; i < num_ids; i++)
+        doc_ids.push_back("doc" + to_string(i));
+    // Duplicates resolve to the last handle
+    doc_ids.push_back("doc42");
+
+    doc_ids.build();
+
+    cerr<<"Testing lookups...";
+    for(size_t i = 0; i < num_ids; i++){
+        string id = "doc" + to_string(i);
+        assert(doc_ids.get(i) == id);
+        assert(doc_ids.find(id) == (i == 42 ? num_ids : i));
+    }
+    assert(doc_ids.find("doc") == DocIdIndex::NPOS);
+    assert(doc_ids.find("doc" + to_string(num_ids)) == DocIdIndex::NPOS);
+    assert(doc_ids.find("") == DocIdIndex::NPOS);
+    assert(DocIdIndex().find("doc0") == DocIdIndex::NPOS);
+    cerr<<"OK!"<<endl;
+}
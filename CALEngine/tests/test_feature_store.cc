@@ -0,0 +1,147 @@
+#include <iostream>
+#include <fstream>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../src/utils/feature_parser.h"
+#include "../src/dataset.h"
+
+using namespace std;
+
+int main(int argc, char *argv[]){
+    string svm_file = "/tmp/test_feature_store.svm";
+    string df_file = "/tmp/test_feature_store.df";
+    string para_file = "/tmp/test_feature_store.para.svm";
+    string container = "/tmp/test_feature_store.cal", para_container = "/tmp/test_feature_store.para.cal";
+    string segment = "/test-feature-store-" + to_string(getpid());
+    const int num_docs = 1000;
+    {
+        ofstream svm(svm_file), df(df_file);
+        for(int i = 0; i < num_docs; i++)
+            svm<<"doc"<<i<<" "<<i % 7 + 1<<":0.5 "<<i % 13 + 8<<":"<<i / 1000.0<<"\n";
+        for(int i = 1; i <= 20; i++)
+            df<<i<<" term"<<i<<"\n";
+    }
+
+    auto make_parser = [&]() -> unique_ptr<FeatureParser> {
+        return make_unique<SVMlightFeatureParser>(svm_file, df_file);
+    };
+    SVMlightFeatureParser parser(svm_file, df_file);
+    auto original = Dataset::build(&parser);
+    auto built = Dataset::attach_or_build(segment, {svm_file, df_file}, make_parser);
+    uint64_t fingerprint = FeatureStore::fingerprint({svm_file, df_file});
+
+    cerr<<"Testing attach...";
+    auto attached = FeatureStore::attach(segment, fingerprint);
+    assert(attached != nullptr);
+    Dataset dataset(move(attached));
+    assert(dataset.size() == num_docs);
+    assert(dataset.get_dimensionality() == original->get_dimensionality());
+    for(size_t i = 0; i < num_docs; i++){
+        SfSparseVector spv = dataset.get_sf_sparse_vector(i), expected = original->get_sf_sparse_vector(i);
+        assert(spv.NumFeatures() == expected.NumFeatures());
+        for(int j = 0; j < spv.NumFeatures(); j++){
+            assert(spv.FeatureAt(j) == expected.FeatureAt(j));
+            assert(spv.ValueAt(j) == expected.ValueAt(j));
+        }
+        assert(spv.GetSquaredNorm() == expected.GetSquaredNorm());
+        assert(dataset.get_id(i) == "doc" + to_string(i));
+        assert(dataset.get_index("doc" + to_string(i)) == i);
+    }
+    for(int i = 1; i <= 20; i++){
+        const TermInfo *term_info = dataset.get_dictionary().find("term" + to_string(i));
+        assert(term_info != nullptr && term_info->id == i && term_info->df == i);
+    }
+    assert(dataset.get_dictionary().find("term") == nullptr);
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing stale segments...";
+    assert(FeatureStore::attach(segment, fingerprint + 1) == nullptr);
+    assert(FeatureStore::attach(segment + "-missing", fingerprint) == nullptr);
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing corrupt images...";
+    {
+        // Writes the first `length` bytes of the original image, with `value` at byte `offset`
+        const MemoryRegion &region = original->get_store().get_region();
+        const FeatureStore::Header &header = *(const FeatureStore::Header *)region.data();
+        string corrupt = "/tmp/test_feature_store.corrupt";
+        auto write_corrupt = [&](size_t offset, uint64_t value, size_t length){
+            ofstream file(corrupt, ios::binary);
+            file.write(region.data(), length);
+            file.seekp(offset);
+            file.write((const char *)&value, sizeof(value));
+        };
+        size_t features_size = offsetof(FeatureStore::Header, section_sizes) + FeatureStore::FEATURES * sizeof(uint64_t);
+        size_t last_doc_offset = header.section_offsets[FeatureStore::DOC_OFFSETS] + num_docs * sizeof(uint64_t);
+
+        // Neither the section table nor truncation is caught by the checksum, and offsets are not checksummed when streaming
+        write_corrupt(features_size, header.total_size, header.total_size);
+        assert(FeatureStore::load(corrupt) == nullptr);
+        write_corrupt(0, *(const uint64_t *)region.data(), header.total_size / 2);
+        assert(FeatureStore::load(corrupt, false) == nullptr);
+        write_corrupt(last_doc_offset, header.section_sizes[FeatureStore::FEATURES], header.total_size);
+        assert(FeatureStore::load(corrupt, false) == nullptr);
+        write_corrupt(0, *(const uint64_t *)region.data(), header.total_size);
+        assert(FeatureStore::load(corrupt, false) != nullptr);
+
+        // Attaching to a corrupt segment fails rather than rebuilding it under its attached readers
+        write_corrupt(features_size, header.total_size, header.total_size);
+        pid_t pid = fork();
+        if(pid == 0)
+            _exit(FeatureStore::attach(corrupt, header.fingerprint) == nullptr ? 0 : 1);
+        int status;
+        waitpid(pid, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 255);
+        unlink(corrupt.c_str());
+    }
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing containers...";
+    {
+        {
+            ofstream para(para_file);
+            for(int i = 0; i < num_docs; i += 3)
+                para<<"doc"<<i<<".0 1:0.5\n"<<"doc"<<i<<".1 "<<i % 13 + 8<<":0.25\n";
+        }
+        SVMlightFeatureParser para_parser(para_file, "");
+        auto paragraphs = ParagraphDataset::build(&para_parser, *original);
+        original->get_store().save(container);
+        paragraphs->get_store().save(para_container);
+        assert(FeatureStore::is_container(container) && !FeatureStore::is_container(svm_file));
+
+        auto loaded = Dataset::attach_or_build("", {container}, make_parser);
+        assert(loaded->size() == num_docs);
+        assert(loaded->get_store().get_checksum() == original->get_store().get_checksum());
+        for(int i = 0; i < num_docs; i++){
+            assert(loaded->get_id(i) == "doc" + to_string(i));
+            assert(loaded->get_sf_sparse_vector(i).GetSquaredNorm() == original->get_sf_sparse_vector(i).GetSquaredNorm());
+        }
+        for(int i = 1; i <= 20; i++)
+            assert(loaded->get_idf(i) == (float)log(num_docs / (float)i));
+
+        auto loaded_paragraphs = ParagraphDataset::load(para_container, *loaded);
+        assert(loaded_paragraphs->size() == paragraphs->size());
+        assert(loaded_paragraphs->get_paragraph_range(3) == make_pair(2u, 4u));
+        assert(loaded_paragraphs->get_store().get_parent_checksum() == loaded->get_store().get_checksum());
+
+        // A flipped bit anywhere is caught by the checksum
+        {
+            fstream file(container, ios::in | ios::out | ios::binary);
+            file.seekp(loaded->get_store().get_region().size() / 2);
+            file.put(0x55);
+        }
+        assert(FeatureStore::load(container) == nullptr);
+        assert(FeatureStore::load(svm_file) == nullptr);
+    }
+    cerr<<"OK!"<<endl;
+
+    unlink(("/dev/shm" + segment).c_str());
+    unlink(svm_file.c_str());
+    unlink(para_file.c_str());
+    unlink(container.c_str());
+    unlink(para_container.c_str());
+    unlink(df_file.c_str());
+}
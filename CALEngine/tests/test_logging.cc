@@ -0,0 +1,77 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cassert>
+#include <unistd.h>
+#include "../src/utils/logging.h"
+#include "../src/utils/metrics.h"
+
+using namespace std;
+
+int count_lines(const string &text, const string &pattern){
+    int count = 0;
+    istringstream lines(text);
+    string line;
+    while(getline(lines, line))
+        count += line.find(pattern) != string::npos;
+    return count;
+}
+
+int main(int argc, char *argv[]){
+    string log_path = "/tmp/test_logging_" + to_string(getpid());
+    FILE *saved_stderr = fdopen(dup(fileno(stderr)), "w");
+    freopen(log_path.c_str(), "w", stderr);
+
+    logging::Level level;
+    assert(logging::parse_level("warning", level) && level == logging::WARNING);
+    assert(!logging::parse_level("verbose", level));
+
+    // Threads exit before their messages are written out
+    vector<thread> threads;
+    for(int t = 0; t < 8; t++){
+        threads.push_back(thread([t](){
+            for(int i = 0; i < 100; i++)
+                logging::info("thread " + to_string(t) + " message " + to_string(i));
+        }));
+    }
+    for(auto &t: threads)
+        t.join();
+
+    logging::debug("hidden debug message");
+    logging::set_level(logging::DEBUG);
+    logging::debug("visible debug message");
+    logging::error("long message " + string(10000, 'x'));
+
+    // A burst larger than the ring, some of which is dropped
+    metrics::Counter &dropped = metrics::counter("cal_log_messages_dropped_total", "");
+    for(int i = 0; i < 1000; i++)
+        logging::warning("burst " + to_string(i));
+    logging::flush();
+
+    fflush(stderr);
+    ifstream log_file(log_path);
+    string text((istreambuf_iterator<char>(log_file)), istreambuf_iterator<char>());
+    unlink(log_path.c_str());
+    fprintf(saved_stderr, "Testing logging...");
+
+    assert(count_lines(text, "INFO [") == 800);
+    for(int t = 0; t < 8; t++)
+        assert(count_lines(text, "thread " + to_string(t) + " message 99") == 1);
+    assert(count_lines(text, "hidden debug message") == 0);
+    assert(count_lines(text, "DEBUG") == 1 && count_lines(text, "visible debug message") == 1);
+    assert(count_lines(text, "ERROR") == 1 && count_lines(text, "... (10013 bytes)") == 1);
+    assert(count_lines(text, string(logging::MAX_MESSAGE_LENGTH - 13, 'x') + "...") == 1);
+    assert(count_lines(text, "WARNING [8] burst ") + dropped.get() == 1000);
+
+    // Messages of one thread keep their order
+    size_t last = 0;
+    for(int i = 0; i < 100; i++){
+        size_t pos = text.find("thread 3 message " + to_string(i) + "\n");
+        assert(pos != string::npos && pos >= last);
+        last = pos;
+    }
+    fprintf(saved_stderr, "OK!\n");
+}
@@ -0,0 +1,64 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <cmath>
+#include <cassert>
+#include "../src/utils/metrics.h"
+
+using namespace std;
+
+int main(int argc, char *argv[]){
+    cerr<<"Testing buckets...";
+    for(uint64_t ns = 0; ns < (1ULL << 20); ns++){
+        int bucket = metrics::Histogram::get_bucket(ns);
+        assert(metrics::Histogram::get_bucket_start(bucket) <= ns);
+        assert(bucket + 1 == metrics::Histogram::NUM_BUCKETS || ns < metrics::Histogram::get_bucket_start(bucket + 1));
+    }
+    assert(metrics::Histogram::get_bucket(1ULL << 50) == metrics::Histogram::NUM_BUCKETS - 1);
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing quantiles...";
+    metrics::Histogram &latency = metrics::histogram("test_latency_seconds", "Latency");
+    assert(latency.quantile(0.5) == 0);
+    // 1ms to 10s, one observation per microsecond
+    for(uint64_t us = 1000; us <= 10000000; us++)
+        latency.observe_ns(us * 1000);
+    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    for(double q: quantiles){
+        double expected = (1000 + q * (10000000 - 1000)) * 1e-6;
+        assert(fabs(latency.quantile(q) - expected) <= expected / 32);
+    }
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing concurrent updates...";
+    metrics::Counter &requests = metrics::counter("test_requests_total", "Requests", "route=\"judge\"");
+    metrics::Histogram &wait = metrics::histogram("test_wait_seconds", "Wait");
+    vector<thread> threads;
+    for(int t = 0; t < 8; t++){
+        threads.push_back(thread([&requests, &wait, t](){
+            for(int i = 0; i < 100000; i++){
+                requests.add();
+                wait.observe((t * 100000 + i) * 1e-6);
+            }
+        }));
+    }
+    for(auto &t: threads)
+        t.join();
+    assert(requests.get() == 800000);
+    assert(wait.count() == 800000);
+    assert(&metrics::counter("test_requests_total", "Requests", "route=\"judge\"") == &requests);
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing render...";
+    metrics::counter("test_requests_total", "Requests", "route=\"begin\"").add(3);
+    metrics::gauge("test_sessions", "Sessions").set(-2);
+    string text = metrics::render();
+    assert(text.find("# HELP test_requests_total Requests\n# TYPE test_requests_total counter\n") != string::npos);
+    assert(text.find("test_requests_total{route=\"judge\"} 800000\n") != string::npos);
+    assert(text.find("test_requests_total{route=\"begin\"} 3\n") != string::npos);
+    assert(text.find("# TYPE test_sessions gauge\ntest_sessions -2\n") != string::npos);
+    assert(text.find("# TYPE test_latency_seconds summary\n") != string::npos);
+    assert(text.find("test_latency_seconds{quantile=\"0.99\"} ") != string::npos);
+    assert(text.find("test_wait_seconds_count 800000\n") != string::npos);
+    cerr<<"OK!"<<endl;
+}
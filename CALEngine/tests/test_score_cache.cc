@@ -0,0 +1,98 @@
+#include <iostream>
+#include <fstream>
+#include <cassert>
+#include <random>
+#include <unistd.h>
+#include "../src/utils/feature_parser.h"
+#include "../src/dataset.h"
+
+using namespace std;
+
+// Rescores `dataset` under weights drifting away from `weights`, checking every cached
+// rescore against a full one. Returns the number of rescores served from the cache.
+static int check_drift(Dataset &dataset, vector<float> weights, size_t num_units, float step, mt19937 &rand_generator){
+    normal_distribution<float> noise(0, step);
+    AtomicBitset judged(num_units);
+    ScoreCache cache;
+    int num_cached = 0;
+    for(int iteration = 0; iteration < 30; iteration++){
+        for(int num_top_docs: {1, 60, 1500}){
+            vector<float> cached_weights = cache.weights;
+            vector<int> top_docs = dataset.rescore_cached(weights, 2, num_top_docs, judged, cache);
+            assert(top_docs == dataset.rescore(weights, 2, num_top_docs, judged));
+            num_cached += cache.weights == cached_weights;
+        }
+        // Judge the best document, as a session would, and move the weights
+        judged.set(dataset.translate_index(dataset.rescore(weights, 1, 1, judged)[0]));
+        for(float &weight: weights)
+            weight += noise(rand_generator);
+    }
+    return num_cached;
+}
+
+int main(int argc, char *argv[]){
+    string svm_file = "/tmp/test_score_cache.svm", para_file = "/tmp/test_score_cache.para.svm";
+    const int num_docs = 4000, dimensionality = 500;
+    mt19937 rand_generator(5);
+    {
+        ofstream svm(svm_file), para(para_file);
+        for(int i = 0; i < num_docs; i++){
+            svm<<"doc"<<i;
+            for(int id = 1 + i % 5; id < dimensionality; id += 1 + rand_generator() % 30)
+                svm<<" "<<id<<":"<<(1 + rand_generator() % 1000) / 5000.0;
+            svm<<"\n";
+            // Some documents have no paragraphs
+            for(int p = 0; p < i % 4; p++){
+                para<<"doc"<<i<<"."<<p;
+                for(int id = 1 + p; id < dimensionality; id += 1 + rand_generator() % 60)
+                    para<<" "<<id<<":"<<(1 + rand_generator() % 1000) / 5000.0;
+                para<<"\n";
+            }
+        }
+    }
+    SVMlightFeatureParser parser(svm_file, ""), para_parser(para_file, "");
+    SVMlightFeatureParser compressed_parser(svm_file, ""), compressed_para_parser(para_file, "");
+    auto documents = Dataset::build(&parser);
+    auto paragraphs = ParagraphDataset::build(&para_parser, *documents);
+    auto compressed = Dataset::build(&compressed_parser, "", 0, 1, true);
+    auto compressed_paragraphs = ParagraphDataset::build(&compressed_para_parser, *compressed, "", 0, 1, true);
+
+    vector<float> weights(dimensionality);
+    normal_distribution<float> initial(0, 1);
+    for(float &weight: weights)
+        weight = initial(rand_generator);
+
+    cerr<<"Testing small changes of the weights...";
+    assert(check_drift(*documents, weights, num_docs, 0.002, rand_generator) > 30);
+    assert(check_drift(*paragraphs, weights, num_docs, 0.002, rand_generator) > 30);
+    assert(check_drift(*compressed, weights, num_docs, 0.002, rand_generator) > 30);
+    assert(check_drift(*compressed_paragraphs, weights, num_docs, 0.002, rand_generator) > 30);
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing large changes of the weights...";
+    check_drift(*documents, weights, num_docs, 0.5, rand_generator);
+    check_drift(*paragraphs, weights, num_docs, 0.5, rand_generator);
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing identical weights...";
+    {
+        AtomicBitset judged(num_docs);
+        ScoreCache cache;
+        vector<int> top_docs = documents->rescore_cached(weights, 2, 100, judged, cache);
+        assert(cache.dataset == documents.get() && cache.scores.size() == num_docs);
+        uint64_t cached_rescores = Dataset::cached_rescores.get();
+        for(int i = 0; i < 50; i++)
+            judged.set(top_docs[top_docs.size() - 1 - i]);
+        vector<int> expected = documents->rescore(weights, 2, 100, judged);
+        assert(documents->rescore_cached(weights, 2, 100, judged, cache) == expected);
+        assert(Dataset::cached_rescores.get() == cached_rescores + 1);
+
+        // A cache of another dataset is refreshed
+        assert(compressed->rescore_cached(weights, 2, 100, judged, cache) == compressed->rescore(weights, 2, 100, judged));
+        assert(cache.dataset == compressed.get() && Dataset::cached_rescores.get() == cached_rescores + 1);
+    }
+    cerr<<"OK!"<<endl;
+
+    unlink(svm_file.c_str());
+    unlink(para_file.c_str());
+}
@@ -0,0 +1,54 @@
+#include <iostream>
+#include <chrono>
+#include <cassert>
+#include <cmath>
+#include <random>
+#include <algorithm>
+#include "../src/utils/select.h"
+
+using namespace std;
+
+// Reference: full sort by score, smaller index first among ties
+vector<int> sort_top_k(const vector<float> &scores, size_t k){
+    vector<int> indices;
+    for(size_t i = 0; i < scores.size(); i++)
+        if(scores[i] != -INFINITY)
+            indices.push_back(i);
+    sort(indices.begin(), indices.end(), [&scores](int a, int b) -> bool {
+        return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+    });
+    indices.resize(min(k, indices.size()));
+    reverse(indices.begin(), indices.end());
+    return indices;
+}
+
+int main(int argc, char *argv[]){
+    mt19937 rand_generator(42);
+    normal_distribution<float> normal(0, 1);
+
+    cerr<<"Testing selection...";
+    for(size_t n: {0, 1, 100, 100000}){
+        vector<float> scores(n);
+        for(size_t i = 0; i < n; i++){
+            scores[i] = normal(rand_generator);
+            if(i % 7 == 0) scores[i] = -INFINITY;          // Judged
+            else if(i % 5 == 0) scores[i] = 0;             // Ties
+            else if(i % 11 == 0) scores[i] = -scores[i - 1];
+        }
+        for(size_t k: {(size_t)1, (size_t)10, n / 2, n, n + 1}){
+            for(int threads: {1, 4})
+                assert(select_top_k(scores.data(), n, k, threads) == sort_top_k(scores, k));
+        }
+    }
+    cerr<<"OK!"<<endl;
+
+    const size_t n = 10000000;
+    vector<float> scores(n);
+    for(auto &score: scores)
+        score = normal(rand_generator);
+    auto start = std::chrono::steady_clock::now();
+    auto top_docs = select_top_k(scores.data(), n, n / 100, 8);
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>
+        (std::chrono::steady_clock::now() - start);
+    cerr<<"Selected "<<top_docs.size()<<" of "<<n<<" in "<<duration.count()<<"ms"<<endl;
+}
@@ -0,0 +1,147 @@
+#include <iostream>
+#include <fstream>
+#include <cassert>
+#include <algorithm>
+#include <unistd.h>
+#include "../src/utils/feature_parser.h"
+#include "../src/session_manager.h"
+
+using namespace std;
+
+int main(int argc, char *argv[]){
+    string svm_file = "/tmp/test_session_manager.svm";
+    string df_file = "/tmp/test_session_manager.df";
+    string spill_dir = "/tmp/test_session_manager-" + to_string(getpid());
+    const int num_docs = 2000;
+    {
+        ofstream svm(svm_file), df(df_file);
+        for(int i = 0; i < num_docs; i++)
+            svm<<"doc"<<i<<" "<<i % 7 + 1<<":0.5 "<<i % 13 + 8<<":"<<i / 1000.0<<"\n";
+        for(int i = 1; i <= 20; i++)
+            df<<i<<" term"<<i<<"\n";
+    }
+    SVMlightFeatureParser parser(svm_file, df_file);
+    auto documents = Dataset::build(&parser);
+
+    // The params hold the seed document of the session
+    auto make_session = [&](const string &params, bool initialize) -> unique_ptr<BMI> {
+        Seed seed = {{documents->get_sf_sparse_vector(stoi(params)), 1}};
+        return make_unique<BMI>(seed, documents.get(), 2, -1, false, 1000, initialize);
+    };
+    auto factory = [&](const string &params, const Corpus &corpus) { return make_session(params, false); };
+
+    // Same as make_session, on a corpus held by the session
+    auto make_corpus_session = [](const string &params, const Corpus &corpus, bool initialize) -> unique_ptr<BMI> {
+        Seed seed = {{corpus.documents->get_sf_sparse_vector(stoi(params)), 1}};
+        auto bmi = make_unique<BMI>(seed, corpus.documents.get(), 2, -1, false, 1000, initialize);
+        assert(bmi->move_to_corpus(corpus));
+        return bmi;
+    };
+
+    // Judges the top documents, half of them relevant
+    auto judge = [](BMI *bmi, int count){
+        vector<int> docs = bmi->get_doc_to_judge(count);
+        for(size_t i = 0; i < docs.size(); i++)
+            bmi->record_judgment(docs[i], i % 2 ? -1 : 1);
+    };
+
+    cerr<<"Testing spill and restore...";
+    {
+        SessionManager sessions(factory, 1, spill_dir);
+        assert(sessions.add("a", "3", make_session("3", true)));
+        assert(!sessions.add("a", "3", make_session("3", true)));
+        vector<int> queue;
+        vector<bool> judged;
+        uint32_t cur_iteration = 0, next_iteration_target = 0;
+        {
+            shared_ptr<BMI> bmi = sessions.get("a");
+            for(int i = 0; i < 3; i++)
+                judge(bmi.get(), 5);
+            queue = bmi->get_doc_to_judge(20);
+            cur_iteration = bmi->get_state().cur_iteration;
+            next_iteration_target = bmi->get_state().next_iteration_target;
+            for(int i = 0; i < num_docs; i++)
+                judged.push_back(bmi->is_judged(i));
+        }
+
+        // Adding a session spills the other one to stay within the budget
+        assert(sessions.add("b/..", "5", make_session("5", true)));
+        assert(sessions.size() == 2 && sessions.num_resident() == 1);
+
+        shared_ptr<BMI> restored = sessions.get("a");
+        assert(restored != nullptr && sessions.num_resident() == 1);
+        assert(restored->get_state().cur_iteration == cur_iteration);
+        assert(restored->get_state().next_iteration_target == next_iteration_target);
+        for(int i = 0; i < num_docs; i++)
+            assert(restored->is_judged(i) == judged[i]);
+        assert(restored->get_doc_to_judge(20) == queue);
+
+        // Training draws from a generator shared by the sessions of a thread,
+        // so only check that the restored session keeps going
+        cur_iteration = restored->get_state().cur_iteration;
+        for(int i = 0; i < 5; i++)
+            judge(restored.get(), 5);
+        assert(restored->get_state().cur_iteration > cur_iteration);
+        assert(restored->get_ranklist().size() == num_docs);
+    }
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing resuming from the spill directory...";
+    {
+        SessionManager sessions(factory, 1, spill_dir);
+        // Only the spilled session was written out
+        assert(sessions.size() == 1 && sessions.num_resident() == 0);
+        assert(sessions.contains("b/..") && !sessions.contains("a"));
+        assert(sessions.get("a") == nullptr && !sessions.remove("a"));
+        assert(sessions.get("b/..") != nullptr && sessions.num_resident() == 1);
+        assert(sessions.remove("b/.."));
+        assert(sessions.size() == 0);
+    }
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing sessions holding their corpus...";
+    {
+        SVMlightFeatureParser corpus_parser(svm_file, df_file), reloaded_parser(svm_file, df_file);
+        Corpus corpus = {Dataset::build(&corpus_parser), nullptr, 0}, current;
+        weak_ptr<Dataset> held = corpus.documents;
+        // Spilled sessions are restored onto the corpus they held, new ones go to `current`
+        SessionManager sessions([&](const string &params, const Corpus &spilled_corpus){
+            return make_corpus_session(params, spilled_corpus.documents != nullptr ? spilled_corpus : current, false);
+        }, 1, spill_dir);
+        assert(sessions.add("a", "3", make_corpus_session("3", corpus, true)));
+        sessions.get("a")->record_judgment_batch(vector<pair<string, int>>{{"doc11", -1}, {"doc10", 1}});
+
+        // Reloading starts a new generation, which "a" cannot move onto
+        current = {Dataset::build(&reloaded_parser), nullptr, 1};
+        corpus = Corpus();
+        assert(sessions.add("b", "5", make_corpus_session("5", current, true)));
+        assert(sessions.num_resident() == 1 && !held.expired());
+        shared_ptr<BMI> a = sessions.get("a");
+        assert(a != nullptr && a->get_dataset() == held.lock().get());
+        assert(!a->move_to_corpus(current));
+
+        // Migrating "a" by doc id
+        vector<pair<string, int>> judgments = a->get_judgments();
+        assert((judgments == vector<pair<string, int>>{{"doc10", 1}, {"doc11", -1}}));
+        unique_ptr<BMI> migrated = make_corpus_session(sessions.get_params("a"), current, true);
+        migrated->record_judgment_batch(judgments);
+        assert(sessions.replace("a", a, move(migrated)));
+        assert(!sessions.replace("a", a, make_corpus_session("3", current, true)));
+        assert(!sessions.replace("c", a, make_corpus_session("3", current, true)));
+        assert(!held.expired());
+        a = nullptr;
+        assert(held.expired());
+        assert(sessions.get("a")->get_dataset() == current.documents.get());
+        assert(sessions.get("a")->get_judgments() == judgments);
+
+        vector<string> ids = sessions.get_ids();
+        sort(ids.begin(), ids.end());
+        assert((ids == vector<string>{"a", "b"}) && sessions.get_params("c").empty());
+        assert(sessions.remove("a") && sessions.remove("b"));
+    }
+    cerr<<"OK!"<<endl;
+
+    rmdir(spill_dir.c_str());
+    unlink(svm_file.c_str());
+    unlink(df_file.c_str());
+}
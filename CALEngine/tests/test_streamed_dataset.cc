@@ -0,0 +1,81 @@
+#include <iostream>
+#include <fstream>
+#include <cassert>
+#include <random>
+#include <unistd.h>
+#include "../src/utils/feature_parser.h"
+#include "../src/dataset.h"
+#include "../src/bmi.h"
+
+using namespace std;
+
+int main(int argc, char *argv[]){
+    string svm_file = "/tmp/test_streamed_dataset.svm";
+    string container = "/tmp/test_streamed_dataset.cal";
+    const int num_docs = 5000, dimensionality = 200;
+    mt19937 rand_generator(7);
+    {
+        ofstream svm(svm_file);
+        for(int i = 0; i < num_docs; i++){
+            svm<<"doc"<<i;
+            for(int id = 1 + i % 5; id < dimensionality; id += 1 + rand_generator() % 20)
+                svm<<" "<<id<<":"<<(rand_generator() % 1000) / 1000.0;
+            svm<<"\n";
+        }
+    }
+    SVMlightFeatureParser parser(svm_file, "");
+    auto loaded = Dataset::build(&parser);
+    loaded->get_store().save(container);
+
+    vector<float> weights(dimensionality);
+    for(float &weight: weights)
+        weight = (int)(rand_generator() % 2001) - 1000;
+    AtomicBitset judged(num_docs);
+    for(int i = 0; i < num_docs; i += 3)
+        judged.set(i);
+
+    cerr<<"Testing rescoring...";
+    for(size_t block_size: {(size_t)1, (size_t)4096, (size_t)1 << 20}){
+        auto streamed = StreamedDataset::open(container, block_size);
+        assert(streamed != nullptr && streamed->size() == num_docs);
+        assert(block_size > 1 || streamed->num_blocks() == num_docs);
+        assert(block_size < (1 << 20) || streamed->num_blocks() == 1);
+        for(int num_threads: {1, 3}){
+            for(int num_top_docs: {10, 1500, num_docs}){
+                assert(streamed->rescore(weights, num_threads, num_top_docs, judged) ==
+                       loaded->rescore(weights, num_threads, num_top_docs, judged));
+            }
+        }
+    }
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing random access...";
+    auto streamed = StreamedDataset::open(container, 4096);
+    for(size_t i = 0; i < num_docs; i += 7){
+        SfSparseVector spv = streamed->get_sf_sparse_vector(i), expected = loaded->get_sf_sparse_vector(i);
+        assert(spv.NumFeatures() == expected.NumFeatures() && spv.GetSquaredNorm() == expected.GetSquaredNorm());
+        for(int j = 0; j < spv.NumFeatures(); j++)
+            assert(spv.FeatureAt(j) == expected.FeatureAt(j) && spv.ValueAt(j) == expected.ValueAt(j));
+        assert(streamed->inner_product(i, weights) == loaded->inner_product(i, weights));
+        assert(streamed->get_index("doc" + to_string(i)) == i);
+    }
+    assert(StreamedDataset::open(svm_file, 4096) == nullptr);
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing sessions...";
+    {
+        Seed seed = {{loaded->get_sf_sparse_vector(0), 1}};
+        BMI bmi(seed, streamed.get(), 2, 5, false, 1000);
+        uint32_t cur_iteration = bmi.get_state().cur_iteration;
+        vector<int> to_judge = bmi.get_doc_to_judge(5);
+        assert(to_judge.size() == 5);
+        for(int i = 0; i < 5; i++)
+            bmi.record_judgment(to_judge[i], i % 2 ? -1 : 1);
+        assert(bmi.get_state().cur_iteration > cur_iteration && bmi.get_doc_to_judge(5).size() == 5);
+        assert(bmi.get_ranklist().size() == num_docs);
+    }
+    cerr<<"OK!"<<endl;
+
+    unlink(svm_file.c_str());
+    unlink(container.c_str());
+}
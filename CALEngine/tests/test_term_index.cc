@@ -0,0 +1,194 @@
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <random>
+#include <set>
+#include <unistd.h>
+#include "../src/utils/feature_parser.h"
+#include "../src/utils/synthetic_corpus.h"
+#include "../src/dataset.h"
+#include "../src/classifier.h"
+#include "../src/bmi.h"
+#include "../src/bmi_para.h"
+
+using namespace std;
+
+// Share of the top `num_top_docs` of an exact rescore which `top_docs` found
+static double recall(Dataset &dataset, const vector<float> &weights, int num_top_docs,
+                     const AtomicBitset &judged, const vector<int> &top_docs){
+    vector<int> expected = dataset.rescore(weights, 2, num_top_docs, judged);
+    set<int> found(top_docs.begin(), top_docs.end());
+    size_t num_found = 0;
+    for(int idx: expected)
+        num_found += found.count(idx);
+    return expected.empty() ? 1 : (double)num_found / expected.size();
+}
+
+int main(int argc, char *argv[]){
+    string doc_features = "/tmp/test_term_index_docs.bin", para_features = "/tmp/test_term_index_paras.bin";
+    // A small bench corpus, whose planted topic is only found by training on it
+    SyntheticCorpusOptions options;
+    options.num_docs = 20000;
+    options.vocabulary_size = 50000;
+    options.relevant_rate = 0.01;
+    SyntheticCorpus corpus(options);
+    corpus.write_features(doc_features, para_features, 2);
+
+    BinFeatureParser parser(doc_features), para_parser(para_features), compressed_parser(doc_features);
+    auto documents = Dataset::build(&parser);
+    auto paragraphs = ParagraphDataset::build(&para_parser, *documents);
+    auto compressed = Dataset::build(&compressed_parser, "", 0, 1, true);
+    documents->build_term_index(1000, 3);
+    compressed->build_term_index(1000);
+    size_t num_docs = documents->size();
+
+    cerr<<"Testing estimates...";
+    {
+        const TermIndex &index = *documents->get_term_index();
+        assert(index.size() == num_docs && index.get_num_terms() == 1000);
+        // Weights on fewer terms than the index estimates from give exact scores, but for the bias
+        mt19937 rand_generator(3);
+        vector<float> weights(documents->get_dimensionality(), 0);
+        weights[0] = 0.5;
+        for(int i = 0; i < 500; i++)
+            weights[1 + rand_generator() % (weights.size() - 1)] = ((int)(rand_generator() % 201) - 100) / 10.0;
+        AtomicBitset judged(num_docs);
+        judged.set(7);
+        vector<float> estimates = index.estimate(weights, judged, 2);
+        assert(estimates.size() == num_docs && estimates[7] == -INFINITY);
+        for(size_t i = 0; i < num_docs; i += 37)
+            if(i != 7)
+                assert(fabs(estimates[i] - (documents->inner_product(i, weights) - weights[0])) < 1e-4);
+    }
+    cerr<<"OK!"<<endl;
+
+    // Weights of a few BMI iterations from a relevant seed, the judged documents of which
+    // are those of the last iteration
+    mt19937 rand_generator(11);
+    uniform_int_distribution<size_t> distribution(0, num_docs - 1);
+    vector<SfSparseVector> judged_vectors;
+    judged_vectors.reserve(num_docs);
+    vector<const SfSparseVector*> positives, negatives;
+    AtomicBitset judged(num_docs);
+    size_t seed_doc = 0;
+    while(!corpus.is_relevant(seed_doc))
+        seed_doc++;
+    judged.set(seed_doc);
+    judged_vectors.push_back(documents->get_sf_sparse_vector(seed_doc));
+    positives.push_back(&judged_vectors.back());
+    vector<float> weights;
+    for(int iteration = 0, batch_size = 1; iteration < 6; iteration++, batch_size += (batch_size + 9) / 10){
+        vector<SfSparseVector> random_negatives;
+        vector<const SfSparseVector*> training_negatives = negatives;
+        for(int i = 0; i < 100; i++)
+            random_negatives.push_back(documents->get_sf_sparse_vector(distribution(rand_generator)));
+        for(const SfSparseVector &spv: random_negatives)
+            training_negatives.push_back(&spv);
+        weights = LRPegasosClassifier(200000).train(positives, training_negatives, documents->get_dimensionality());
+        if(iteration == 5)
+            break;
+        for(int idx: documents->rescore(weights, 2, batch_size, judged)){
+            judged.set(idx);
+            judged_vectors.push_back(documents->get_sf_sparse_vector(idx));
+            (corpus.is_relevant(idx) ? positives : negatives).push_back(&judged_vectors.back());
+        }
+    }
+    assert(positives.size() > 3);
+
+    cerr<<"Testing rescoring...";
+    for(Dataset *dataset: {documents.get(), (Dataset *)paragraphs.get(), compressed.get()}){
+        const TermIndex &index = *(dataset == compressed.get() ? compressed : documents)->get_term_index();
+        for(int num_threads: {1, 3}){
+            // Candidates beyond the share of the units it scores rescore exactly
+            assert(dataset->rescore_retrieved(weights, num_threads, 100, judged, index, num_docs) ==
+                   dataset->rescore(weights, num_threads, 100, judged));
+
+            // Trained weights find their top documents from a fraction of the corpus, which
+            // estimates no better than chance could not
+            for(int num_top_docs: {10, 100, 500}){
+                uint64_t num_retrieved = Dataset::retrieved_rescores.get();
+                vector<int> top_docs = dataset->rescore_retrieved(weights, num_threads, num_top_docs, judged, index, 500);
+                // Too many of the units to find the top 500 from
+                assert(Dataset::retrieved_rescores.get() == num_retrieved + (num_top_docs < 500));
+                assert(recall(*dataset, weights, num_top_docs, judged, top_docs) >= 0.98);
+                for(size_t i = 0; i < top_docs.size(); i++){
+                    assert(!judged.test(dataset->translate_index(top_docs[i])));
+                    // Every top document outscores the next
+                    if(i > 0)
+                        assert(dataset->inner_product(top_docs[i - 1], weights) <= dataset->inner_product(top_docs[i], weights));
+                }
+            }
+        }
+    }
+    // Random weights rank nothing well from a few terms, and are rescored exactly
+    {
+        normal_distribution<float> noise(0, 1);
+        vector<float> random_weights(documents->get_dimensionality());
+        for(float &weight: random_weights)
+            weight = noise(rand_generator);
+        uint64_t num_retrieved = Dataset::retrieved_rescores.get();
+        assert(documents->rescore_retrieved(random_weights, 2, 100, judged, *documents->get_term_index(), 500) ==
+               documents->rescore(random_weights, 2, 100, judged));
+        assert(Dataset::retrieved_rescores.get() == num_retrieved);
+    }
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing appending...";
+    {
+        ParsedFeatures delta;
+        SfSparseVector spv("new0", {{5, 0.25}, {2999, 0.5}});
+        delta.features.assign(spv.features_.begin(), spv.features_.end());
+        delta.doc_offsets.push_back(delta.features.size());
+        delta.squared_norms.push_back(spv.GetSquaredNorm());
+        delta.doc_ids.push_back(spv.doc_id);
+        delta.doc_ids.build();
+        delta.dimensionality = documents->get_dimensionality();
+        auto appended = documents->append(delta, {});
+        const TermIndex &index = *appended->get_term_index();
+        assert(index.size() == num_docs + 1 && index.get_num_terms() == 1000);
+        assert(index.num_postings() == documents->get_term_index()->num_postings() + 2);
+
+        AtomicBitset appended_judged(num_docs + 1);
+        vector<float> new_weights(documents->get_dimensionality(), 0);
+        new_weights[5] = 1;
+        new_weights[2999] = 2;
+        vector<float> estimates = index.estimate(new_weights, appended_judged, 2);
+        vector<float> expected = documents->get_term_index()->estimate(new_weights, appended_judged, 2);
+        for(size_t i = 0; i < num_docs; i += 13)
+            assert(estimates[i] == expected[i]);
+        assert(estimates[num_docs] == 1.25);
+        assert(appended->rescore_retrieved(new_weights, 2, 1, appended_judged, index, 100)[0] == (int)num_docs);
+    }
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing sessions...";
+    {
+        metrics::Counter &recall_hits = metrics::counter("cal_retrieval_recall_hits_total", "");
+        metrics::Counter &recall_docs = metrics::counter("cal_retrieval_recall_documents_total", "");
+        Seed seed = {{documents->get_sf_sparse_vector(seed_doc), 1}};
+        BMI bmi(seed, documents.get(), 2, 20, false, 50000);
+        BMI_para bmi_para(seed, documents.get(), paragraphs.get(), 2, 20, false, 50000);
+        for(BMI *session: {&bmi, (BMI *)&bmi_para}){
+            session->set_retrieval(500, 3, true);
+            uint64_t num_hits = recall_hits.get(), num_recall_docs = recall_docs.get();
+            uint64_t num_retrieved = Dataset::retrieved_rescores.get();
+            for(int iteration = 0; iteration < 6; iteration++){
+                vector<int> to_judge = session->get_doc_to_judge(20);
+                assert(to_judge.size() == 20);
+                for(int idx: to_judge){
+                    int doc = session->get_ranking_dataset()->translate_index(idx);
+                    // Judgments are of documents, for paragraphs too
+                    session->record_judgment(doc, corpus.is_relevant(doc) ? 1 : -1);
+                }
+            }
+            // Two of every three iterations rescore from the index, and find what an exact rescore does
+            assert(Dataset::retrieved_rescores.get() >= num_retrieved + 3);
+            assert(recall_docs.get() >= num_recall_docs + 60);
+            assert(recall_hits.get() - num_hits >= 0.98 * (recall_docs.get() - num_recall_docs));
+        }
+    }
+    cerr<<"OK!"<<endl;
+
+    unlink(doc_features.c_str());
+    unlink(para_features.c_str());
+}
@@ -0,0 +1,67 @@
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <cassert>
+#include <unistd.h>
+#include "../src/utils/tracing.h"
+
+using namespace std;
+
+size_t count(const string &text, const string &pattern){
+    size_t n = 0;
+    for(size_t pos = text.find(pattern); pos != string::npos; pos = text.find(pattern, pos + 1))
+        n++;
+    return n;
+}
+
+string read_trace(const string &path){
+    ifstream trace_file(path);
+    return string((istreambuf_iterator<char>(trace_file)), istreambuf_iterator<char>());
+}
+
+int main(int argc, char *argv[]){
+    string trace_path = "/tmp/test_tracing_" + to_string(getpid()) + ".json";
+
+    cerr<<"Testing spans...";
+    {
+        tracing::Span span("disabled");
+    }
+    tracing::set_enabled(true);
+    {
+        tracing::ScopedContext session_context("session \"a\"");
+        tracing::ScopedContext iteration_context(7);
+        tracing::Span span("training");
+        span.end();
+        span.end();
+
+        // Spans of exited threads are kept
+        const tracing::Context &context = tracing::get_context();
+        thread([&context](){
+            tracing::ScopedContext scoped_context(context);
+            tracing::Span span("scan");
+        }).join();
+    }
+    {
+        tracing::Span span("no_session");
+    }
+    assert(tracing::get_context().session.empty() && tracing::get_context().iteration == -1);
+
+    assert(tracing::write_chrome_trace(trace_path) == 3);
+    string trace = read_trace(trace_path);
+    assert(trace.find("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [") == 0);
+    assert(count(trace, "\"ph\": \"X\"") == 3);
+    assert(count(trace, "\"name\": \"disabled\"") == 0);
+    assert(count(trace, "\"name\": \"training\"") == 1);
+    assert(count(trace, "\"session\": \"session \\\"a\\\"\", \"iteration\": 7") == 2);
+    assert(count(trace, "\"session\": \"\", \"iteration\": -1") == 1);
+    cerr<<"OK!"<<endl;
+
+    cerr<<"Testing buffer bounds...";
+    tracing::clear();
+    for(int i = 0; i < 10000; i++)
+        tracing::Span span("span");
+    assert(tracing::write_chrome_trace(trace_path) == 4096);
+    assert(tracing::write_chrome_trace("/nonexistent/trace.json") == -1);
+    unlink(trace_path.c_str());
+    cerr<<"OK!"<<endl;
+}